@@ -0,0 +1,100 @@
+#pragma once
+
+#include "message.h"
+#include <initializer_list>
+
+namespace common
+{
+  namespace codec
+  {
+    namespace detail
+    {
+      template<typename... Messages>
+      constexpr std::size_t table_size()
+      {
+        std::size_t size = 0;
+        for(std::size_t id : {static_cast<std::size_t>(Messages::type_id)...})
+        {
+          if(id + 1 > size)
+            size = id + 1;
+        }
+        return size;
+      }
+
+      template<typename... Messages>
+      constexpr bool unique_type_ids()
+      {
+        const std::size_t ids[] = {static_cast<std::size_t>(Messages::type_id)...};
+        for(std::size_t i = 0; i < sizeof...(Messages); ++i)
+        {
+          for(std::size_t j = i + 1; j < sizeof...(Messages); ++j)
+          {
+            if(ids[i] == ids[j])
+              return false;
+          }
+        }
+        return true;
+      }
+    } //namespace detail
+
+    // Routes a frame to a_handler(Message::view) by its type id through a
+    // table built at compile time and indexed by type id; one bounds check
+    // and one indirect call per message. Frames shorter than the message
+    // (or than a header), and unknown types, are rejected with false.
+    template<typename Handler, typename... Messages>
+    class dispatcher
+    {
+      static_assert(sizeof...(Messages) > 0, "no messages to dispatch");
+      static_assert(detail::unique_type_ids<Messages...>(), "duplicate message type id");
+
+      public:
+        static bool dispatch(Handler& a_handler, const char *a_frame, std::size_t a_len)
+        {
+          if(a_len < sizeof(message_header_t))
+            return false;
+          std::uint16_t type = message_type(a_frame);
+          if(type >= table_size)
+            return false;
+          entry_t entry = s_table.entries[type];
+          return entry != nullptr && entry(a_handler, a_frame, a_len);
+        }
+
+      private:
+        using entry_t = bool (*)(Handler&, const char *, std::size_t);
+
+        static constexpr std::size_t table_size = detail::table_size<Messages...>();
+
+        template<typename Message>
+        static bool invoke(Handler& a_handler, const char *a_frame, std::size_t a_len)
+        {
+          if(a_len < Message::frame_size)
+            return false;
+          a_handler(typename Message::view(a_frame));
+          return true;
+        }
+
+        struct table_t
+        {
+          entry_t entries[table_size];
+
+          constexpr table_t()
+            : entries{}
+          {
+            int expand[] = {0, (entries[Messages::type_id] = &dispatcher::invoke<Messages>, 0)...};
+            (void)expand;
+          }
+        };
+
+        static constexpr table_t s_table{};
+    };
+
+    template<typename Handler, typename... Messages>
+    constexpr typename dispatcher<Handler, Messages...>::table_t dispatcher<Handler, Messages...>::s_table;
+
+    template<typename... Messages, typename Handler>
+    bool dispatch(Handler& a_handler, const char *a_frame, std::size_t a_len)
+    {
+      return dispatcher<Handler, Messages...>::dispatch(a_handler, a_frame, a_len);
+    }
+  } //namespace codec
+} //namespace common
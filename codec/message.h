@@ -0,0 +1,153 @@
+#pragma once
+
+#include "../communications.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "the codec reads and writes fields in host order, which must be little-endian"
+#endif
+
+// Flat binary messages on top of length_prefixed framing. A message is
+// described once by an X-macro field list (split over lines with
+// backslashes in real code):
+//
+//   #define ORDER_FIELDS(FIELD) FIELD(std::uint64_t, order_id) FIELD(std::int64_t, price) FIELD(std::uint32_t, quantity) FIELD(char, side)
+//   COMMUNICATIONS_MESSAGE(order, 1, ORDER_FIELDS)
+//
+// which generates
+//   order_fields   the C++ layout, fields at their natural alignment
+//   order_view     reads the fields in place from a received frame
+//   order_builder  writes them in place into an outbound frame
+//   order          ties them together: type_id, frame_size, view, builder
+//
+// On the wire a frame is a message_header_t followed by the fields laid out
+// as in order_fields, padded to a multiple of 8 bytes so that frames packed
+// back to back keep their fields aligned. Field types must be trivially
+// copyable; integers are little-endian.
+namespace common
+{
+  namespace codec
+  {
+    struct message_header_t
+    {
+      std::uint32_t length;   // whole frame, header included; read by length_prefixed_framing
+      std::uint16_t type;
+      std::uint16_t reserved;
+    };
+
+    const std::size_t MESSAGE_ALIGNMENT = 8;
+
+    template<typename T>
+    T load(const char *a_src)
+    {
+      T value;
+      memcpy(&value, a_src, sizeof(T));
+      return value;
+    }
+
+    template<typename T>
+    void store(char *a_dst, const T& a_value)
+    {
+      memcpy(a_dst, &a_value, sizeof(T));
+    }
+
+    constexpr std::size_t frame_size_for(std::size_t a_body_size)
+    {
+      return (sizeof(message_header_t) + a_body_size + MESSAGE_ALIGNMENT - 1) / MESSAGE_ALIGNMENT * MESSAGE_ALIGNMENT;
+    }
+
+    // Type id of a frame that is at least a header long.
+    inline std::uint16_t message_type(const char *a_frame)
+    {
+      return load<std::uint16_t>(a_frame + offsetof(message_header_t, type));
+    }
+
+    // Encodes Message in place in the session's outbound buffer;
+    // a_fill(builder) sets the fields.
+    template<typename Message, typename Fill>
+    void send(tcp::iserver& a_server, const int a_client_id, Fill&& a_fill, send_priority_e a_priority = send_priority_e::normal)
+    {
+      a_server.send_encoded(a_client_id, Message::frame_size, [&a_fill](char *a_out)
+      {
+        typename Message::builder builder(a_out);
+        a_fill(builder);
+      }, a_priority);
+    }
+
+    // Encodes Message into a string, for transports without send_encoded().
+    template<typename Message, typename Fill>
+    std::string encode(Fill&& a_fill)
+    {
+      std::string frame(Message::frame_size, '\0');
+      typename Message::builder builder(&frame[0]);
+      a_fill(builder);
+      return frame;
+    }
+  } //namespace codec
+} //namespace common
+
+#define COMMUNICATIONS_CODEC_FIELD_MEMBER(type, name) type name;
+
+#define COMMUNICATIONS_CODEC_FIELD_CHECK(type, name) \
+  static_assert(std::is_trivially_copyable<type>::value, #name " must be trivially copyable");
+
+#define COMMUNICATIONS_CODEC_FIELD_GETTER(type, name) \
+  type name() const \
+  { \
+    return ::common::codec::load<type>(m_body + offsetof(fields_t, name)); \
+  }
+
+#define COMMUNICATIONS_CODEC_FIELD_SETTER(type, name) \
+  builder_t& name(const type& a_value) \
+  { \
+    ::common::codec::store(m_body + offsetof(fields_t, name), a_value); \
+    return *this; \
+  }
+
+#define COMMUNICATIONS_MESSAGE(msg, id, FIELDS) \
+  struct msg##_fields \
+  { \
+    FIELDS(COMMUNICATIONS_CODEC_FIELD_MEMBER) \
+  }; \
+  \
+  class msg##_view \
+  { \
+    using fields_t = msg##_fields; \
+    FIELDS(COMMUNICATIONS_CODEC_FIELD_CHECK) \
+    public: \
+      explicit msg##_view(const char *a_frame) \
+        : m_body(a_frame + sizeof(::common::codec::message_header_t)) \
+      { \
+      } \
+      FIELDS(COMMUNICATIONS_CODEC_FIELD_GETTER) \
+    private: \
+      const char *m_body; \
+  }; \
+  \
+  class msg##_builder \
+  { \
+    using fields_t = msg##_fields; \
+    using builder_t = msg##_builder; \
+    public: \
+      explicit msg##_builder(char *a_frame) \
+        : m_body(a_frame + sizeof(::common::codec::message_header_t)) \
+      { \
+        ::common::codec::message_header_t header{static_cast<std::uint32_t>(::common::codec::frame_size_for(sizeof(fields_t))), id, 0}; \
+        memcpy(a_frame, &header, sizeof(header)); \
+      } \
+      FIELDS(COMMUNICATIONS_CODEC_FIELD_SETTER) \
+    private: \
+      char *m_body; \
+  }; \
+  \
+  struct msg \
+  { \
+    using view = msg##_view; \
+    using builder = msg##_builder; \
+    static constexpr std::uint16_t type_id = id; \
+    static constexpr std::size_t frame_size = ::common::codec::frame_size_for(sizeof(msg##_fields)); \
+  };
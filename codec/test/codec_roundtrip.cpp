@@ -0,0 +1,158 @@
+#include "../dispatch.h"
+#include "../../tcp/framing.h"
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <vector>
+
+// Encodes messages with the codec, splits the byte stream into frames with
+// length_prefixed_framing at every read size from 1 byte up, decodes them
+// through the dispatcher and checks every field comes back as written.
+// Also checks that short frames and unknown types are rejected. Exits
+// non-zero on the first mismatch.
+//
+//   communications_codec_test_app
+
+namespace
+{
+  using namespace common;
+
+#define ORDER_FIELDS(FIELD) \
+  FIELD(std::uint64_t, order_id) \
+  FIELD(std::int64_t, price) \
+  FIELD(std::uint32_t, quantity) \
+  FIELD(char, side)
+  COMMUNICATIONS_MESSAGE(order, 1, ORDER_FIELDS)
+
+#define ACK_FIELDS(FIELD) \
+  FIELD(std::uint64_t, order_id) \
+  FIELD(std::uint16_t, status)
+  COMMUNICATIONS_MESSAGE(ack, 7, ACK_FIELDS)
+
+  static_assert(order::frame_size % codec::MESSAGE_ALIGNMENT == 0, "frames keep 8 byte alignment");
+  static_assert(ack::frame_size % codec::MESSAGE_ALIGNMENT == 0, "frames keep 8 byte alignment");
+
+  const std::size_t message_count = 200;
+
+  std::int64_t price_of(std::size_t a_index)
+  {
+    return a_index % 3 == 0 ? std::numeric_limits<std::int64_t>::min() + static_cast<std::int64_t>(a_index) : -static_cast<std::int64_t>(a_index) * 1000;
+  }
+
+  // every other message is an order, the rest acks
+  std::string encode_stream()
+  {
+    std::string stream;
+    for(std::size_t i = 0; i < message_count; i++)
+    {
+      if(i % 2 == 0)
+      {
+        stream += codec::encode<order>([i](order_builder& a_builder)
+        {
+          a_builder.order_id(0xFEDCBA9876543210ull + i).price(price_of(i)).quantity(static_cast<std::uint32_t>(i * 7)).side(i % 4 == 0 ? 'B' : 'S');
+        });
+      }
+      else
+      {
+        stream += codec::encode<ack>([i](ack_builder& a_builder)
+        {
+          a_builder.order_id(i).status(static_cast<std::uint16_t>(0xFFFF - i));
+        });
+      }
+    }
+    return stream;
+  }
+
+  struct checker
+  {
+    std::size_t next = 0;
+    std::size_t errors = 0;
+
+    void operator()(const order_view& a_view)
+    {
+      const std::size_t i = next++;
+      if(i % 2 != 0 || a_view.order_id() != 0xFEDCBA9876543210ull + i || a_view.price() != price_of(i) ||
+         a_view.quantity() != i * 7 || a_view.side() != (i % 4 == 0 ? 'B' : 'S'))
+        errors++;
+    }
+
+    void operator()(const ack_view& a_view)
+    {
+      const std::size_t i = next++;
+      if(i % 2 != 1 || a_view.order_id() != i || a_view.status() != 0xFFFF - i)
+        errors++;
+    }
+  };
+
+  bool check_read_size(const std::string& a_stream, std::size_t a_read_size)
+  {
+    tcp::length_prefixed_framing framing;
+    checker check;
+    std::size_t rejected = 0;
+    for(std::size_t pos = 0; pos < a_stream.size(); pos += a_read_size)
+    {
+      framing.on_data(a_stream.data() + pos, std::min(a_read_size, a_stream.size() - pos));
+      const char *data;
+      std::size_t len;
+      while(framing.next_frame(data, len))
+      {
+        if(!codec::dispatch<order, ack>(check, data, len))
+          rejected++;
+      }
+    }
+
+    if(check.next != message_count || check.errors != 0 || rejected != 0)
+    {
+      printf("read size %zu: %zu of %zu decoded, %zu wrong, %zu rejected\n", a_read_size, check.next, message_count, check.errors, rejected);
+      return false;
+    }
+    return true;
+  }
+
+  bool check_rejects()
+  {
+    checker check;
+    std::string frame = codec::encode<order>([](order_builder& a_builder){ a_builder.order_id(1); });
+
+    bool is_ok = true;
+    if(codec::dispatch<order, ack>(check, frame.data(), sizeof(codec::message_header_t) - 1))
+    {
+      printf("a frame shorter than a header was dispatched\n");
+      is_ok = false;
+    }
+    if(codec::dispatch<order, ack>(check, frame.data(), order::frame_size - 1))
+    {
+      printf("a frame shorter than its message was dispatched\n");
+      is_ok = false;
+    }
+    for(std::uint16_t type : {std::uint16_t{0}, std::uint16_t{2}, std::uint16_t{8}, std::uint16_t{0xFFFF}})
+    {
+      codec::store(&frame[offsetof(codec::message_header_t, type)], type);
+      if(codec::dispatch<order, ack>(check, frame.data(), frame.size()))
+      {
+        printf("unknown type %u was dispatched\n", type);
+        is_ok = false;
+      }
+    }
+    if(check.next != 0)
+    {
+      printf("a rejected frame reached the handler\n");
+      is_ok = false;
+    }
+    return is_ok;
+  }
+}
+
+int main()
+{
+  const std::string stream = encode_stream();
+
+  bool is_ok = true;
+  for(std::size_t read_size = 1; read_size <= order::frame_size + ack::frame_size + 1; read_size++)
+    is_ok = check_read_size(stream, read_size) && is_ok;
+  is_ok = check_read_size(stream, stream.size()) && is_ok;
+  is_ok = check_rejects() && is_ok;
+
+  printf("%zu messages, order frame %zu bytes, ack frame %zu bytes: %s\n", message_count, order::frame_size, ack::frame_size, is_ok ? "ok" : "FAILED");
+  return is_ok ? 0 : 1;
+}
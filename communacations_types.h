@@ -1,5 +1,12 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
 namespace common
 {
   const int BUF_LENGTH = 32768;
@@ -10,7 +17,79 @@ namespace common
   {
       completion_eol,
       read_until_eol,
-      async_read_some_eol
+      async_read_some_eol,
+      length_prefixed,
+      chunked_eol
+  };
+
+  // Position of a chunk within its frame in chunked_eol mode. A frame that
+  // arrives in one piece is a single CHUNK_BEGIN | CHUNK_END chunk; a chunk
+  // with neither flag continues the frame.
+  const std::uint32_t CHUNK_BEGIN = 1;
+  const std::uint32_t CHUNK_END = 2;
+
+  enum class send_priority_e
+  {
+      control,
+      normal,
+      bulk
+  };
+
+  const std::size_t SEND_PRIORITY_COUNT = 3;
+
+  struct tcp_lane_depth_t
+  {
+    std::size_t messages = 0;
+    std::size_t bytes = 0;
+  };
+
+  using tcp_lane_depths_t = std::array<tcp_lane_depth_t, SEND_PRIORITY_COUNT>;
+
+  enum class byte_order_e
+  {
+      big_endian,
+      little_endian
+  };
+
+  struct packet_field_t
+  {
+    std::size_t offset = 0;
+    std::size_t width = 4;
+    byte_order_e byte_order = byte_order_e::big_endian;
+  };
+
+  // Socket tuning presets. system_default leaves every option to the
+  // kernel; low_latency disables Nagle, acks at once, keeps little unsent
+  // data in the kernel (so send priorities stay in user space), busy-polls
+  // and marks traffic EF with a high priority; bulk keeps Nagle and asks
+  // for large buffers (capped by net.core.rmem_max/wmem_max).
+  enum class socket_profile_e
+  {
+      system_default,
+      low_latency,
+      bulk
+  };
+
+  // A profile plus per-option overrides; -1 takes the profile's choice.
+  // Options that do not apply to a socket (TCP_* on udp) are ignored.
+  struct socket_options_t
+  {
+    socket_profile_e profile = socket_profile_e::system_default;
+    int no_delay = -1;
+    int quick_ack = -1;
+    int not_sent_lowat = -1;
+    int rcvbuf = -1;
+    int sndbuf = -1;
+    int busy_poll_us = -1;
+    int priority = -1;
+    int tos = -1;
+  };
+
+  enum class request_status_e
+  {
+      ok,
+      timeout,
+      disconnected
   };
 
   struct tcp_server_params_t
@@ -19,6 +98,14 @@ namespace common
     std::uint16_t port;
     read_func_type_e do_read_type;
     bool use_strand = false;
+    std::uint64_t max_messages_per_sec = 0;
+    std::uint64_t max_bytes_per_sec = 0;
+    std::uint32_t rate_burst_ms = 100;
+    std::size_t messages_per_read = 0;
+    std::size_t max_write_batch_bytes = 65536;
+    std::size_t dispatch_shards = 0;
+    std::size_t max_frame_size = 16 * 1024 * 1024;
+    socket_options_t socket_options;
   };
 
   struct tcp_client_params_t
@@ -27,6 +114,52 @@ namespace common
     std::uint16_t port;
     read_func_type_e do_read_type;
     bool use_strand;
+    packet_field_t correlation;
+    std::size_t max_in_flight = 256;
+    std::size_t max_frame_size = 16 * 1024 * 1024;
+    socket_options_t socket_options;
+  };
+
+  enum class shm_wakeup_e
+  {
+      futex,
+      eventfd,
+      spin
+  };
+
+  struct shm_server_params_t
+  {
+    std::string socket_path;
+    read_func_type_e do_read_type = read_func_type_e::async_read_some_eol;
+    std::size_t ring_size = 1 << 20;
+    shm_wakeup_e wakeup = shm_wakeup_e::futex;
+    bool use_strand = false;
+    int cpu_core = -1;
+    std::size_t max_frame_size = 16 * 1024 * 1024;
+  };
+
+  struct shm_client_params_t
+  {
+    std::string socket_path;
+    read_func_type_e do_read_type = read_func_type_e::async_read_some_eol;
+    bool use_strand = false;
+    int cpu_core = -1;
+    packet_field_t correlation;
+    std::size_t max_in_flight = 256;
+    std::size_t max_frame_size = 16 * 1024 * 1024;
+  };
+
+  struct udp_multicast_filter_t
+  {
+    packet_field_t field;
+    std::vector<std::uint64_t> values;
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> ranges;
+  };
+
+  enum class udp_multicast_backend_e
+  {
+      socket,
+      packet_mmap
   };
 
   struct udp_multicast_params_t
@@ -36,6 +169,192 @@ namespace common
     std::uint16_t port;
     std::string interface_name;
     bool use_strand = false;
+    std::size_t pool_size = 0;
+    std::size_t pool_buffer_size = 2048;
+    udp_multicast_backend_e backend = udp_multicast_backend_e::socket;
+    std::size_t packet_block_size = 1 << 20;
+    std::size_t packet_block_count = 16;
+    std::uint32_t packet_block_timeout_ms = 1;
+    std::vector<udp_multicast_filter_t> filters;
+    std::uint32_t filter_drop_sample_rate = 0;
+    socket_options_t socket_options;
+  };
+
+  struct udp_multicast_client_stats_t
+  {
+    std::uint64_t packets = 0;
+    std::uint64_t bytes = 0;
+    std::uint64_t pool_exhausted = 0;
+    // datagrams longer than the receive buffer, dropped
+    std::uint64_t truncated = 0;
+    std::vector<std::uint64_t> filter_dropped;
+  };
+
+  struct udp_multicast_arbiter_params_t
+  {
+    udp_multicast_params_t line_a;
+    udp_multicast_params_t line_b;
+    packet_field_t sequence;
+    std::uint32_t gap_timeout_ms = 50;
+    // a line whose sequence drops by more than this has restarted; 0 never
+    // resyncs
+    std::uint64_t reset_threshold = 1 << 16;
+  };
+
+  struct udp_multicast_arbiter_stats_t
+  {
+    std::uint64_t received_a = 0;
+    std::uint64_t received_b = 0;
+    std::uint64_t delivered_a = 0;
+    std::uint64_t delivered_b = 0;
+    std::uint64_t duplicates = 0;
+    std::uint64_t gaps = 0;
+    std::uint64_t recovered = 0;
+    std::uint64_t lost = 0;
+    std::uint64_t malformed = 0;
+    std::uint64_t resets = 0;
+  };
+
+  struct udp_multicast_group_t
+  {
+    std::string source_ip;
+    std::string group_ip;
+    std::uint16_t port;
+  };
+
+  struct udp_multicast_multi_params_t
+  {
+    std::vector<udp_multicast_group_t> groups;
+    std::string interface_name;
+    int cpu_core = -1;
+    socket_options_t socket_options;
+  };
+
+  struct udp_multicast_group_stats_t
+  {
+    std::uint64_t packets = 0;
+    std::uint64_t bytes = 0;
+  };
+
+  struct udp_multicast_ring_params_t
+  {
+    udp_multicast_params_t multicast;
+    std::size_t ring_slots = 4096;
+    std::size_t slot_size = 2048;
+    int cpu_core = -1;
+  };
+
+  struct udp_multicast_ring_stats_t
+  {
+    std::uint64_t received = 0;
+    std::uint64_t dropped = 0;
+    std::uint64_t truncated = 0;
+  };
+
+  struct udp_multicast_recorder_params_t
+  {
+    udp_multicast_params_t multicast;
+    std::string file_path;
+    std::size_t grow_size = 64 * 1024 * 1024;
+  };
+
+  enum class replay_pace_e
+  {
+      max_speed,
+      original
+  };
+
+  struct udp_multicast_replay_params_t
+  {
+    std::string file_path;
+    replay_pace_e pace = replay_pace_e::max_speed;
+    double speed = 1.0;
+    std::string resend_group_ip;
+    std::uint16_t resend_port = 0;
+    std::string resend_interface_ip = "127.0.0.1";
+  };
+
+  struct udp_multicast_publisher_params_t
+  {
+    std::string source_ip;
+    std::string group_ip;
+    std::uint16_t port;
+    std::string interface_name;
+    int ttl = 1;
+    bool loopback = false;
+    int dscp = 0;
+    std::size_t batch_size = 64;
+    std::size_t max_datagram_size = 1472;
+    std::size_t gso_segment_size = 0;
+    std::uint64_t max_packets_per_sec = 0;
+    socket_options_t socket_options;
+  };
+
+  struct udp_multicast_publisher_stats_t
+  {
+    std::uint64_t packets = 0;
+    std::uint64_t bytes = 0;
+    std::uint64_t send_calls = 0;
+    std::uint64_t errors = 0;
+  };
+
+  struct udp_multicast_relay_params_t
+  {
+    udp_multicast_params_t multicast;
+    tcp_server_params_t tcp;
+    packet_field_t key;
+    std::size_t max_queued_bytes = 1 << 20;
+  };
+
+  struct udp_multicast_relay_stats_t
+  {
+    std::uint64_t received = 0;
+    std::uint64_t forwarded = 0;
+    std::uint64_t conflated = 0;
+    std::uint64_t flushed = 0;
+    std::uint64_t malformed = 0;
+    std::uint64_t subscribers = 0;
+    std::uint64_t conflating = 0;
+  };
+
+  struct udp_multicast_retransmit_params_t
+  {
+    tcp_server_params_t tcp;
+    packet_field_t sequence;
+    std::string history_path;
+    std::size_t history_size = 64 * 1024 * 1024;
+    std::size_t history_slots = 1 << 18;
+  };
+
+  struct udp_multicast_retransmit_stats_t
+  {
+    std::uint64_t stored = 0;
+    std::uint64_t naks = 0;
+    std::uint64_t retransmitted = 0;
+    std::uint64_t unavailable = 0;
+    std::uint64_t malformed = 0;
+  };
+
+  struct udp_multicast_reliable_params_t
+  {
+    udp_multicast_params_t multicast;
+    tcp_client_params_t retransmit;
+    packet_field_t sequence;
+    std::uint32_t nak_timeout_ms = 20;
+    std::uint32_t nak_retries = 3;
+    std::size_t max_pending = 65536;
+  };
+
+  struct udp_multicast_reliable_stats_t
+  {
+    std::uint64_t received = 0;
+    std::uint64_t delivered = 0;
+    std::uint64_t duplicates = 0;
+    std::uint64_t gaps = 0;
+    std::uint64_t naks = 0;
+    std::uint64_t recovered = 0;
+    std::uint64_t lost = 0;
+    std::uint64_t malformed = 0;
   };
 
 } //namespace common
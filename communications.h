@@ -2,9 +2,11 @@
 
 #include "../interface/interface.h"
 #include "communacations_types.h"
+#include "packet_pool.h"
 #include <boost/asio.hpp>
 #include <boost/asio/socket_base.hpp>
 #include <array>
+#include <chrono>
 #include <functional>
 
 namespace common
@@ -16,17 +18,28 @@ namespace common
     {
       public:
         virtual void run() = 0;
+        // stops accepting and disconnects every client
+        virtual void stop() = 0;
         virtual void remove_client(const int a_client_id) = 0;
         virtual void set_on_connected(std::function<void(const int)> a_on_connected) = 0;
         virtual void set_on_disconnected(std::function<void(const int)> a_on_disconnected) = 0;
         virtual void set_on_message(std::function<void(const int, const char *, std::size_t)> a_on_message) = 0;
+        // chunked_eol only: called per chunk with its offset in the line and CHUNK_* flags
+        virtual void set_on_chunk(std::function<void(const int, const char *, std::size_t, std::uint64_t, std::uint32_t)> a_on_chunk) = 0;
+        // called when a client's outbound queue has drained
+        virtual void set_on_writable(std::function<void(const int)> a_on_writable) = 0;
         virtual void on_connected(const int a_client_id) = 0;
         virtual void on_disconnected(const int a_client_id) = 0;
         virtual void on_message(const int a_client_id, const char *a_data, std::size_t a_len) = 0;
+        virtual void on_chunk(const int a_client_id, const char *a_data, std::size_t a_len, std::uint64_t a_offset, std::uint32_t a_flags) = 0;
+        virtual void on_writable(const int a_client_id) = 0;
         virtual void send_message(const int a_client_id, const std::string& a_message) = 0;
-        virtual void send_data(const int a_client_id, const char *a_data, std::size_t a_len) = 0;
-        virtual void send_data_for_all(const char *a_data, std::size_t a_len) = 0;
+        virtual void send_data(const int a_client_id, const char *a_data, std::size_t a_len, send_priority_e a_priority = send_priority_e::normal) = 0;
+        virtual void send_data_for_all(const char *a_data, std::size_t a_len, send_priority_e a_priority = send_priority_e::normal) = 0;
+        // a_fill(out) encodes the a_len byte message in place in the outbound buffer
+        virtual void send_encoded(const int a_client_id, std::size_t a_len, const std::function<void(char *)>& a_fill, send_priority_e a_priority = send_priority_e::normal) = 0;
         virtual std::size_t clients_count() = 0;
+        virtual tcp_lane_depths_t lane_depths(const int a_client_id) = 0;
 
       protected:
         virtual void do_accept() = 0;
@@ -39,7 +52,9 @@ namespace common
     {
       public:
         virtual void send_message(const std::string& a_data) = 0;
-        virtual void send_data(const char *a_data, std::size_t a_len) = 0;
+        virtual void send_data(const char *a_data, std::size_t a_len, send_priority_e a_priority = send_priority_e::normal) = 0;
+        virtual void send_encoded(std::size_t a_len, const std::function<void(char *)>& a_fill, send_priority_e a_priority = send_priority_e::normal) = 0;
+        virtual tcp_lane_depths_t lane_depths() = 0;
         virtual void start() = 0;
         virtual void shutdown() = 0;
     };
@@ -55,6 +70,20 @@ namespace common
         virtual void set_on_connected(std::function<void()> a_on_connected) = 0;
         virtual void set_on_disconnected(std::function<void()> a_on_disconnected) = 0;
         virtual void set_on_message(std::function<void(const std::string&)> a_on_message) = 0;
+        // chunked_eol only: called per chunk with its offset in the line and CHUNK_* flags
+        virtual void set_on_chunk(std::function<void(const char *, std::size_t, std::uint64_t, std::uint32_t)> a_on_chunk) = 0;
+        // Sends a_payload with a correlation id written at params.correlation
+        // and calls a_on_response once: with the first received frame that
+        // carries the same id at that offset, or on timeout or disconnect.
+        // Up to max_in_flight requests may be outstanding; their responses
+        // may arrive in any order. Frames that answer no request go to
+        // on_message. The id is written as raw binary, so requests are only
+        // supported in length_prefixed mode, where it cannot be mistaken
+        // for a delimiter. With use_strand, responses and timeouts
+        // are called on the client's strand. False if not connected, not
+        // length_prefixed, the window is full or the payload is too short
+        // to hold the id.
+        virtual bool request(const std::string& a_payload, std::function<void(request_status_e, const std::string&)> a_on_response, std::chrono::milliseconds a_timeout) = 0;
 
       protected:
         virtual void do_connect() = 0;
@@ -64,6 +93,16 @@ namespace common
 
   } //namespace tcp
 
+  namespace shm
+  {
+    // Same-host transport with the tcp callback API: each connection gets a
+    // pair of shared-memory rings, handed over on a Unix domain socket.
+    // Received bytes go through the tcp framing of do_read_type, so
+    // messages arrive as they would over tcp.
+    tcp::iserver::ref create_server(shm_server_params_t& a_params, boost::asio::io_service& a_io_service);
+    tcp::iclient::ref create_client(shm_client_params_t& a_params, boost::asio::io_service& a_io_service);
+  } //namespace shm
+
   namespace udp
   {
     namespace multicast
@@ -75,12 +114,154 @@ namespace common
           virtual void run() = 0;
           virtual void stop() = 0;
           virtual void set_on_data(std::function<void(const char *a_data, std::size_t a_len)> a_on_data) = 0;
+          virtual void set_on_packet(std::function<void(packet_handle a_packet)> a_on_packet) = 0;
+          virtual udp_multicast_client_stats_t stats() = 0;
 
         protected:
           virtual void do_receive() = 0;
       };
 
       iclient::ref create_client(udp_multicast_params_t& a_params, boost::asio::io_service& a_io_service);
+      iclient::ref create_client(udp_multicast_params_t& a_params, std::shared_ptr<boost::asio::io_service::strand> a_strand);
+
+      // Delivers each sequence number once, from whichever line brings it
+      // first. A packet past the next expected one is delivered at once and
+      // opens a gap; a fill from the other line within gap_timeout_ms is
+      // delivered when it arrives, so on_data sees sequence numbers out of
+      // order around a gap, and what is still missing then goes to on_gap.
+      // A line whose sequence drops by more than reset_threshold is taken as
+      // a publisher restart: open gaps go to on_gap, arbitration resyncs on
+      // that line and the other line counts as duplicates until it restarts
+      // too.
+      class iarbiter
+        : public interface<iarbiter>
+      {
+        public:
+          virtual void run() = 0;
+          virtual void stop() = 0;
+          virtual void set_on_data(std::function<void(std::uint64_t a_seq, const char *a_data, std::size_t a_len)> a_on_data) = 0;
+          virtual void set_on_gap(std::function<void(std::uint64_t a_first, std::uint64_t a_last)> a_on_gap) = 0;
+          virtual udp_multicast_arbiter_stats_t stats() = 0;
+      };
+
+      iarbiter::ref create_arbiter(udp_multicast_arbiter_params_t& a_params, boost::asio::io_service& a_io_service);
+
+      class imulti_client
+        : public interface<imulti_client>
+      {
+        public:
+          virtual void run() = 0;
+          virtual void stop() = 0;
+          virtual void set_on_data(std::size_t a_group, std::function<void(const char *a_data, std::size_t a_len)> a_on_data) = 0;
+          virtual udp_multicast_group_stats_t stats(std::size_t a_group) = 0;
+          virtual std::uint64_t unmatched_count() = 0;
+      };
+
+      // A group and port may be listed once per source, with an empty
+      // source_ip meaning any source; a repeated entry throws
+      // std::invalid_argument.
+      imulti_client::ref create_multi_client(udp_multicast_multi_params_t& a_params);
+
+      class iring_client
+        : public interface<iring_client>
+      {
+        public:
+          virtual void run() = 0;
+          virtual void stop() = 0;
+          virtual bool front(const char *&a_data, std::size_t& a_len) = 0;
+          virtual void pop() = 0;
+          virtual udp_multicast_ring_stats_t stats() = 0;
+      };
+
+      iring_client::ref create_ring_client(udp_multicast_ring_params_t& a_params);
+
+      class irecorder
+        : public interface<irecorder>
+      {
+        public:
+          virtual void run() = 0;
+          virtual void stop() = 0;
+          virtual void set_on_data(std::function<void(const char *a_data, std::size_t a_len)> a_on_data) = 0;
+          virtual std::uint64_t recorded_count() = 0;
+
+        protected:
+          virtual void do_receive() = 0;
+      };
+
+      irecorder::ref create_recorder(udp_multicast_recorder_params_t& a_params, boost::asio::io_service& a_io_service);
+
+      class ireplayer
+        : public interface<ireplayer>
+      {
+        public:
+          virtual void run() = 0;
+          virtual void stop() = 0;
+          virtual void set_on_data(std::function<void(const char *a_data, std::size_t a_len)> a_on_data) = 0;
+          virtual void set_on_finished(std::function<void()> a_on_finished) = 0;
+          virtual std::uint64_t replayed_count() = 0;
+      };
+
+      ireplayer::ref create_replayer(udp_multicast_replay_params_t& a_params, boost::asio::io_service& a_io_service);
+
+      class ipublisher
+        : public interface<ipublisher>
+      {
+        public:
+          virtual void send(const char *a_data, std::size_t a_len) = 0;
+          virtual void flush() = 0;
+          virtual udp_multicast_publisher_stats_t stats() = 0;
+      };
+
+      ipublisher::ref create_publisher(udp_multicast_publisher_params_t& a_params, boost::asio::io_service& a_io_service);
+
+      // Re-serves a multicast feed to tcp subscribers as length_prefixed
+      // frames. A subscriber whose outbound queue grows past
+      // max_queued_bytes only keeps the latest datagram per key until its
+      // queue drains, so memory per subscriber is bounded by the key count.
+      // Part of communications_tcp.
+      class irelay
+        : public interface<irelay>
+      {
+        public:
+          virtual void run() = 0;
+          virtual void stop() = 0;
+          virtual udp_multicast_relay_stats_t stats() = 0;
+      };
+
+      irelay::ref create_relay(udp_multicast_relay_params_t& a_params, boost::asio::io_service& a_io_service);
+
+      // Sender side of reliable multicast: keeps the datagrams passed to
+      // store() in a bounded memory-mapped history and replays the ranges
+      // that ireliable_client receivers ask for over tcp. Store each
+      // datagram before publishing it. Part of communications_tcp.
+      class iretransmit_server
+        : public interface<iretransmit_server>
+      {
+        public:
+          virtual void run() = 0;
+          virtual void store(const char *a_data, std::size_t a_len) = 0;
+          virtual udp_multicast_retransmit_stats_t stats() = 0;
+      };
+
+      iretransmit_server::ref create_retransmit_server(udp_multicast_retransmit_params_t& a_params, boost::asio::io_service& a_io_service);
+
+      // Receiver side: delivers the feed in sequence order. A gap holds the
+      // datagrams after it back and is requested from the retransmit
+      // server, then again every nak_timeout_ms up to nak_retries times. A
+      // gap still open after that, or one the server no longer holds, is
+      // reported to on_gap and skipped. Part of communications_tcp.
+      class ireliable_client
+        : public interface<ireliable_client>
+      {
+        public:
+          virtual void run() = 0;
+          virtual void stop() = 0;
+          virtual void set_on_data(std::function<void(std::uint64_t a_seq, const char *a_data, std::size_t a_len)> a_on_data) = 0;
+          virtual void set_on_gap(std::function<void(std::uint64_t a_first, std::uint64_t a_last)> a_on_gap) = 0;
+          virtual udp_multicast_reliable_stats_t stats() = 0;
+      };
+
+      ireliable_client::ref create_reliable_client(udp_multicast_reliable_params_t& a_params, boost::asio::io_service& a_io_service);
     } //namespace multicast
   } //namespace udp
 } //namespace common
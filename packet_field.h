@@ -0,0 +1,42 @@
+#pragma once
+
+#include "communacations_types.h"
+#include <cstring>
+
+namespace common
+{
+  inline bool read_packet_field(const packet_field_t& a_field, const char *a_data, std::size_t a_len, std::uint64_t& a_value)
+  {
+    if(a_field.width == 0 || a_field.width > sizeof(std::uint64_t) || a_field.offset + a_field.width > a_len)
+      return false;
+
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(a_data + a_field.offset);
+    a_value = 0;
+    if(a_field.byte_order == byte_order_e::big_endian)
+    {
+      for(std::size_t i = 0; i < a_field.width; i++)
+        a_value = (a_value << 8) | bytes[i];
+    }
+    else
+    {
+      for(std::size_t i = a_field.width; i > 0; i--)
+        a_value = (a_value << 8) | bytes[i - 1];
+    }
+    return true;
+  }
+
+  inline bool write_packet_field(const packet_field_t& a_field, char *a_data, std::size_t a_len, std::uint64_t a_value)
+  {
+    if(a_field.width == 0 || a_field.width > sizeof(std::uint64_t) || a_field.offset + a_field.width > a_len)
+      return false;
+
+    unsigned char *bytes = reinterpret_cast<unsigned char *>(a_data + a_field.offset);
+    for(std::size_t i = 0; i < a_field.width; i++)
+    {
+      std::size_t pos = (a_field.byte_order == byte_order_e::big_endian) ? a_field.width - 1 - i : i;
+      bytes[pos] = static_cast<unsigned char>(a_value & 0xFF);
+      a_value >>= 8;
+    }
+    return true;
+  }
+} //namespace common
@@ -0,0 +1,236 @@
+#pragma once
+
+#include "packet_ring.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+namespace common
+{
+  class packet_pool;
+
+  // Move-only owner of one pool buffer; the buffer goes back to the pool when
+  // the handle is destroyed.
+  class packet_handle
+  {
+    public:
+      packet_handle() = default;
+
+      packet_handle(std::shared_ptr<packet_pool> a_pool, std::uint32_t a_index, char *a_data, std::size_t a_capacity)
+        : m_pool(std::move(a_pool))
+        , m_index(a_index)
+        , m_data(a_data)
+        , m_capacity(a_capacity)
+      {
+      }
+
+      packet_handle(packet_handle&& a_other) noexcept
+      {
+        swap(a_other);
+      }
+
+      packet_handle& operator=(packet_handle&& a_other) noexcept
+      {
+        if(this != &a_other)
+        {
+          reset();
+          swap(a_other);
+        }
+        return *this;
+      }
+
+      packet_handle(const packet_handle&) = delete;
+      packet_handle& operator=(const packet_handle&) = delete;
+
+      ~packet_handle()
+      {
+        reset();
+      }
+
+      explicit operator bool() const
+      {
+        return m_data != nullptr;
+      }
+
+      char *data()
+      {
+        return m_data;
+      }
+
+      const char *data() const
+      {
+        return m_data;
+      }
+
+      std::size_t size() const
+      {
+        return m_size;
+      }
+
+      std::size_t capacity() const
+      {
+        return m_capacity;
+      }
+
+      void resize(std::size_t a_size)
+      {
+        m_size = a_size < m_capacity ? a_size : m_capacity;
+      }
+
+      inline void reset();
+
+    private:
+      void swap(packet_handle& a_other)
+      {
+        std::swap(m_pool, a_other.m_pool);
+        std::swap(m_index, a_other.m_index);
+        std::swap(m_data, a_other.m_data);
+        std::swap(m_size, a_other.m_size);
+        std::swap(m_capacity, a_other.m_capacity);
+      }
+
+    private:
+      std::shared_ptr<packet_pool> m_pool;
+      std::uint32_t m_index = 0;
+      char *m_data = nullptr;
+      std::size_t m_size = 0;
+      std::size_t m_capacity = 0;
+  };
+
+  // Fixed set of cache-line aligned buffers. The free list is a bounded
+  // multi-producer/multi-consumer queue of buffer indices, so buffers can be
+  // acquired on the receive thread and released on any consumer thread.
+  class packet_pool
+    : public std::enable_shared_from_this<packet_pool>
+  {
+    public:
+      packet_pool(std::size_t a_buffers, std::size_t a_buffer_size)
+        : m_count(a_buffers == 0 ? 1 : a_buffers)
+        , m_buffer_size(a_buffer_size)
+        , m_stride((a_buffer_size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE)
+        , m_mask(round_up_pow2(m_count) - 1)
+        , m_cells(new cell_t[m_mask + 1])
+      {
+        void *data = nullptr;
+        if(posix_memalign(&data, CACHE_LINE_SIZE, m_stride * m_count) != 0)
+          throw std::bad_alloc();
+        m_data.reset(static_cast<char *>(data));
+
+        for(std::size_t i = 0; i <= m_mask; i++)
+          m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        for(std::size_t i = 0; i < m_count; i++)
+          push(static_cast<std::uint32_t>(i));
+      }
+
+      packet_pool(const packet_pool&) = delete;
+      packet_pool& operator=(const packet_pool&) = delete;
+
+      static std::shared_ptr<packet_pool> create(std::size_t a_buffers, std::size_t a_buffer_size)
+      {
+        return std::make_shared<packet_pool>(a_buffers, a_buffer_size);
+      }
+
+      // Returns an empty handle when every buffer is in use.
+      packet_handle acquire()
+      {
+        std::uint32_t index;
+        if(!pop(index))
+          return packet_handle();
+        return packet_handle(shared_from_this(), index, m_data.get() + index * m_stride, m_buffer_size);
+      }
+
+      void release(std::uint32_t a_index)
+      {
+        push(a_index);
+      }
+
+      std::size_t buffer_size() const
+      {
+        return m_buffer_size;
+      }
+
+    private:
+      struct cell_t
+      {
+        std::atomic<std::size_t> sequence;
+        std::uint32_t index;
+      };
+
+      struct free_deleter
+      {
+        void operator()(char *a_ptr) const
+        {
+          free(a_ptr);
+        }
+      };
+
+      void push(std::uint32_t a_index)
+      {
+        std::size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        while(true)
+        {
+          cell_t& cell = m_cells[pos & m_mask];
+          std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+          std::intptr_t diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+          if(diff == 0)
+          {
+            if(m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+              cell.index = a_index;
+              cell.sequence.store(pos + 1, std::memory_order_release);
+              return;
+            }
+          }
+          else
+            pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+      }
+
+      bool pop(std::uint32_t& a_index)
+      {
+        std::size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        while(true)
+        {
+          cell_t& cell = m_cells[pos & m_mask];
+          std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+          std::intptr_t diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1);
+          if(diff == 0)
+          {
+            if(m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+              a_index = cell.index;
+              cell.sequence.store(pos + m_mask + 1, std::memory_order_release);
+              return true;
+            }
+          }
+          else if(diff < 0)
+            return false;
+          else
+            pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        }
+      }
+
+    private:
+      const std::size_t m_count;
+      const std::size_t m_buffer_size;
+      const std::size_t m_stride;
+      const std::size_t m_mask;
+      std::unique_ptr<char, free_deleter> m_data;
+      std::unique_ptr<cell_t[]> m_cells;
+      alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> m_enqueue_pos{0};
+      alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> m_dequeue_pos{0};
+  };
+
+  void packet_handle::reset()
+  {
+    if(m_pool != nullptr)
+      m_pool->release(m_index);
+    m_pool.reset();
+    m_data = nullptr;
+    m_size = 0;
+    m_capacity = 0;
+  }
+} //namespace common
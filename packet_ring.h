@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+namespace common
+{
+  const std::size_t CACHE_LINE_SIZE = 64;
+
+  inline std::size_t round_up_pow2(std::size_t a_value)
+  {
+    std::size_t result = 1;
+    while(result < a_value)
+      result <<= 1;
+    return result;
+  }
+
+  // Single-producer/single-consumer ring of fixed-size packet slots. Both
+  // sides work on batches: the producer fills write_slot(0..n-1) and then
+  // publish(n), the consumer reads read_slot(0..n-1) and then consume(n).
+  class packet_ring
+  {
+    public:
+      packet_ring(std::size_t a_slots, std::size_t a_slot_size)
+        : m_mask(round_up_pow2(a_slots) - 1)
+        , m_slot_size(a_slot_size)
+        , m_stride((a_slot_size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE)
+        , m_lengths(new std::size_t[m_mask + 1])
+      {
+        void *data = nullptr;
+        if(posix_memalign(&data, CACHE_LINE_SIZE, m_stride * (m_mask + 1)) != 0)
+          throw std::bad_alloc();
+        m_data.reset(static_cast<char *>(data));
+      }
+
+      packet_ring(const packet_ring&) = delete;
+      packet_ring& operator=(const packet_ring&) = delete;
+
+      std::size_t capacity() const
+      {
+        return m_mask + 1;
+      }
+
+      std::size_t slot_size() const
+      {
+        return m_slot_size;
+      }
+
+      // producer side
+      std::size_t writable()
+      {
+        std::size_t head = m_head.value.load(std::memory_order_relaxed);
+        if(head - m_cached_tail.value == capacity())
+          m_cached_tail.value = m_tail.value.load(std::memory_order_acquire);
+        return capacity() - (head - m_cached_tail.value);
+      }
+
+      char *write_slot(std::size_t a_offset)
+      {
+        return slot(m_head.value.load(std::memory_order_relaxed) + a_offset);
+      }
+
+      void set_length(std::size_t a_offset, std::size_t a_len)
+      {
+        m_lengths[(m_head.value.load(std::memory_order_relaxed) + a_offset) & m_mask] = a_len;
+      }
+
+      void publish(std::size_t a_count)
+      {
+        m_head.value.store(m_head.value.load(std::memory_order_relaxed) + a_count, std::memory_order_release);
+      }
+
+      // consumer side
+      std::size_t readable()
+      {
+        std::size_t tail = m_tail.value.load(std::memory_order_relaxed);
+        if(m_cached_head.value == tail)
+          m_cached_head.value = m_head.value.load(std::memory_order_acquire);
+        return m_cached_head.value - tail;
+      }
+
+      const char *read_slot(std::size_t a_offset, std::size_t& a_len)
+      {
+        std::size_t pos = m_tail.value.load(std::memory_order_relaxed) + a_offset;
+        a_len = m_lengths[pos & m_mask];
+        return slot(pos);
+      }
+
+      void consume(std::size_t a_count)
+      {
+        m_tail.value.store(m_tail.value.load(std::memory_order_relaxed) + a_count, std::memory_order_release);
+      }
+
+    private:
+      struct free_deleter
+      {
+        void operator()(char *a_ptr) const
+        {
+          free(a_ptr);
+        }
+      };
+
+      template<typename T>
+      struct alignas(CACHE_LINE_SIZE) padded_t
+      {
+        T value{};
+      };
+
+      char *slot(std::size_t a_pos)
+      {
+        return m_data.get() + (a_pos & m_mask) * m_stride;
+      }
+
+    private:
+      const std::size_t m_mask;
+      const std::size_t m_slot_size;
+      const std::size_t m_stride;
+      std::unique_ptr<char, free_deleter> m_data;
+      std::unique_ptr<std::size_t[]> m_lengths;
+
+      padded_t<std::atomic<std::size_t>> m_head;
+      padded_t<std::size_t> m_cached_tail;
+      padded_t<std::atomic<std::size_t>> m_tail;
+      padded_t<std::size_t> m_cached_head;
+  };
+} //namespace common
@@ -0,0 +1,229 @@
+#include "connection.h"
+#include "record_framing.h"
+#include "../../tcp/request_table.h"
+
+namespace common
+{
+  namespace shm
+  {
+    // Socket, handshake and connection callbacks hold a weak reference, so
+    // one in flight either keeps the client alive or is dropped once it
+    // has gone. As with tcp, a lost connection reconnects right away and a
+    // failed connect raises on_disconnected and stays down.
+    class client
+     : public tcp::iclient
+     , public std::enable_shared_from_this<tcp::iclient>
+    {
+      public:
+        client(shm_client_params_t& a_params, boost::asio::io_service& a_io_service);
+        ~client() override;
+        void run() override;
+        void send_message(const std::string& a_data) override;
+        void set_on_connected(std::function<void()> a_on_connected) override;
+        void set_on_disconnected(std::function<void()> a_on_disconnected) override;
+        void set_on_message(std::function<void(const std::string&)> a_on_message) override;
+        void set_on_chunk(std::function<void(const char *, std::size_t, std::uint64_t, std::uint32_t)> a_on_chunk) override;
+        bool request(const std::string& a_payload, std::function<void(request_status_e, const std::string&)> a_on_response, std::chrono::milliseconds a_timeout) override;
+
+      private:
+        void do_connect() override;
+        void do_handshake();
+        void disconnected();
+        void reconnect();
+
+      private:
+        boost::asio::io_service& m_io_service;
+        std::shared_ptr<boost::asio::io_service::strand> m_strand;
+        std::shared_ptr<local_socket> m_sock;
+        std::shared_ptr<connection> m_connection;
+        std::atomic<bool> m_is_connected;
+        std::shared_ptr<shm_client_params_t> m_params;
+        tcp::request_table m_requests;
+
+        std::function<void()> m_on_connected_func;
+        std::function<void()> m_on_disconnected_func;
+        std::function<void(const std::string&)> m_on_message_func;
+        std::function<void(const char *, std::size_t, std::uint64_t, std::uint32_t)> m_on_chunk_func;
+    };
+
+    client::client(shm_client_params_t& a_params, boost::asio::io_service& a_io_service)
+     : m_io_service(a_io_service)
+     , m_strand(std::make_shared<boost::asio::io_service::strand>(a_io_service))
+     , m_is_connected(false)
+     , m_params(std::make_shared<shm_client_params_t>(a_params))
+     , m_requests(a_params.correlation, a_params.max_in_flight, a_io_service, a_params.use_strand ? m_strand : nullptr)
+    {
+    }
+
+    client::~client()
+    {
+      if(auto conn = std::atomic_load(&m_connection))
+        conn->close();
+    }
+
+    void client::run()
+    {
+      do_connect();
+    }
+
+    void client::send_message(const std::string& a_data)
+    {
+      auto conn = std::atomic_load(&m_connection);
+      if(m_is_connected && conn != nullptr)
+        conn->send(a_data.c_str(), a_data.length());
+    }
+
+    void client::set_on_connected(std::function<void()> a_on_connected)
+    {
+      m_on_connected_func = a_on_connected;
+    }
+
+    void client::set_on_disconnected(std::function<void()> a_on_disconnected)
+    {
+      m_on_disconnected_func = a_on_disconnected;
+    }
+
+    void client::set_on_message(std::function<void(const std::string&)> a_on_message)
+    {
+      m_on_message_func = a_on_message;
+    }
+
+    void client::set_on_chunk(std::function<void(const char *, std::size_t, std::uint64_t, std::uint32_t)> a_on_chunk)
+    {
+      m_on_chunk_func = a_on_chunk;
+    }
+
+    bool client::request(const std::string& a_payload, std::function<void(request_status_e, const std::string&)> a_on_response, std::chrono::milliseconds a_timeout)
+    {
+      // as with tcp, a binary id is only safe in length_prefixed frames
+      if(!m_is_connected || m_params->do_read_type != read_func_type_e::length_prefixed)
+        return false;
+
+      std::string frame = a_payload;
+      auto conn = std::atomic_load(&m_connection);
+      if(conn == nullptr || !m_requests.add(frame, std::move(a_on_response), a_timeout))
+        return false;
+      conn->send(frame.c_str(), frame.length());
+      return true;
+    }
+
+    void client::do_connect()
+    {
+      std::weak_ptr<tcp::iclient> weak_self = shared_from_this();
+      m_sock = std::make_shared<local_socket>(m_io_service);
+      m_sock->async_connect(boost::asio::local::stream_protocol::endpoint(m_params->socket_path), m_strand->wrap([this, weak_self](const boost::system::error_code& a_ec)
+      {
+        auto self = weak_self.lock();
+        if(self == nullptr)
+          return;
+
+        if(!a_ec)
+          do_handshake();
+        else
+          disconnected();
+      }));
+    }
+
+    void client::do_handshake()
+    {
+      // the server sends the segment right after accept
+      std::weak_ptr<tcp::iclient> weak_self = shared_from_this();
+      m_sock->async_read_some(boost::asio::null_buffers(), m_strand->wrap([this, weak_self](const boost::system::error_code& a_ec, std::size_t /*bytes*/)
+      {
+        auto self = weak_self.lock();
+        if(self == nullptr)
+          return;
+
+        if(a_ec)
+        {
+          disconnected();
+          return;
+        }
+
+        std::shared_ptr<connection> conn;
+        try
+        {
+          auto seg = segment::receive(m_sock->native_handle());
+          conn = std::make_shared<connection>(std::move(*m_sock), std::move(seg), false, m_params->use_strand ? m_strand : std::make_shared<boost::asio::io_service::strand>(m_io_service), m_params->use_strand, m_params->cpu_core);
+        }
+        catch(const boost::system::system_error&)
+        {
+          disconnected();
+          return;
+        }
+
+        std::atomic_store(&m_connection, conn);
+        auto framing = std::make_shared<record_framing>(m_params->do_read_type, m_params->max_frame_size);
+        std::weak_ptr<connection> weak_conn = conn;
+        conn->start([this, weak_self, weak_conn, framing](const char *a_data, std::size_t a_len)
+          {
+            auto self = weak_self.lock();
+            if(self == nullptr)
+              return;
+            bool is_ok = framing->on_record(a_data, a_len,
+              [this](const char *a_msg, std::size_t a_msg_len)
+              {
+                if(m_requests.complete(a_msg, a_msg_len))
+                  return;
+                if(m_on_message_func != nullptr)
+                  m_on_message_func({a_msg, a_msg_len});
+              },
+              [this](const char *a_chunk, std::size_t a_chunk_len, std::uint64_t a_offset, std::uint32_t a_flags)
+              {
+                if(m_on_chunk_func != nullptr)
+                  m_on_chunk_func(a_chunk, a_chunk_len, a_offset, a_flags);
+              });
+            // a frame over max_frame_size; start over on a fresh connection
+            auto oversized = weak_conn.lock();
+            if(!is_ok && oversized != nullptr)
+            {
+              oversized->close();
+              reconnect();
+            }
+          },
+          [this, weak_self]
+          {
+            if(auto self = weak_self.lock())
+              reconnect();
+          });
+        m_is_connected = true;
+
+        if(m_on_connected_func != nullptr)
+          m_on_connected_func();
+      }));
+    }
+
+    void client::disconnected()
+    {
+      m_is_connected = false;
+      m_requests.fail_all(request_status_e::disconnected);
+
+      if(m_on_disconnected_func != nullptr)
+        m_on_disconnected_func();
+    }
+
+    // the connection closes on its own strand, which without use_strand
+    // is not the client's
+    void client::reconnect()
+    {
+      disconnected();
+      std::weak_ptr<tcp::iclient> weak_self = shared_from_this();
+      m_strand->post([this, weak_self]
+      {
+        if(auto self = weak_self.lock())
+          do_connect();
+      });
+    }
+  } //namespace shm
+} //namespace common
+
+namespace common
+{
+  namespace shm
+  {
+    tcp::iclient::ref create_client(shm_client_params_t& a_params, boost::asio::io_service& a_io_service)
+    {
+      return std::make_shared<client>(a_params, a_io_service);
+    }
+  } //namespace shm
+} //namespace common
@@ -0,0 +1,380 @@
+#include "connection.h"
+#include <new>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+namespace common
+{
+  namespace shm
+  {
+    const int max_segment_fds = 3;
+
+    // set on receive threads, which never join one another
+    thread_local bool t_is_receive_thread = false;
+
+    segment::segment(segment&& a_other) noexcept
+    {
+      *this = std::move(a_other);
+    }
+
+    segment& segment::operator=(segment&& a_other) noexcept
+    {
+      if(this != &a_other)
+      {
+        reset();
+        std::swap(m_memfd, a_other.m_memfd);
+        std::swap(m_event_fds, a_other.m_event_fds);
+        std::swap(m_base, a_other.m_base);
+        std::swap(m_size, a_other.m_size);
+      }
+      return *this;
+    }
+
+    segment::~segment()
+    {
+      reset();
+    }
+
+    void segment::reset()
+    {
+      if(m_base != nullptr)
+        munmap(m_base, m_size);
+      if(m_memfd >= 0)
+        ::close(m_memfd);
+      for(auto& fd : m_event_fds)
+      {
+        if(fd >= 0)
+          ::close(fd);
+        fd = -1;
+      }
+      m_memfd = -1;
+      m_base = nullptr;
+      m_size = 0;
+    }
+
+    void segment::map(std::size_t a_size)
+    {
+      void *base = mmap(nullptr, a_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_memfd, 0);
+      if(base == MAP_FAILED)
+        throw boost::system::system_error(errno, boost::system::system_category(), "shm mmap");
+      m_base = static_cast<char *>(base);
+      m_size = a_size;
+    }
+
+    segment segment::create(std::size_t a_ring_size, shm_wakeup_e a_wakeup)
+    {
+      segment result;
+      std::size_t ring_size = round_up_pow2(a_ring_size < 4096 ? 4096 : a_ring_size);
+
+      result.m_memfd = static_cast<int>(syscall(SYS_memfd_create, "communications_shm", 0));
+      if(result.m_memfd < 0)
+        throw boost::system::system_error(errno, boost::system::system_category(), "shm memfd_create");
+      if(ftruncate(result.m_memfd, segment_size(ring_size)) != 0)
+        throw boost::system::system_error(errno, boost::system::system_category(), "shm ftruncate");
+      result.map(segment_size(ring_size));
+
+      auto header = new(result.m_base) shm_segment_header_t();
+      memcpy(header->magic, segment_magic, sizeof(segment_magic));
+      header->version = segment_version;
+      header->wakeup = static_cast<std::uint32_t>(a_wakeup);
+      header->ring_size = ring_size;
+
+      if(a_wakeup == shm_wakeup_e::eventfd)
+      {
+        for(auto& fd : result.m_event_fds)
+        {
+          fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+          if(fd < 0)
+            throw boost::system::system_error(errno, boost::system::system_category(), "shm eventfd");
+        }
+      }
+      return result;
+    }
+
+    void segment::send(int a_sock_fd) const
+    {
+      int fds[max_segment_fds] = {m_memfd, m_event_fds[0], m_event_fds[1]};
+      std::size_t fd_count = m_event_fds[0] >= 0 ? 3 : 1;
+
+      char control[CMSG_SPACE(sizeof(fds))];
+      memset(control, 0, sizeof(control));
+      char tag = 'S';
+      struct iovec iov = {&tag, sizeof(tag)};
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control;
+      msg.msg_controllen = CMSG_SPACE(fd_count * sizeof(int));
+
+      struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = CMSG_LEN(fd_count * sizeof(int));
+      memcpy(CMSG_DATA(cmsg), fds, fd_count * sizeof(int));
+
+      if(sendmsg(a_sock_fd, &msg, MSG_NOSIGNAL) != 1)
+        throw boost::system::system_error(errno, boost::system::system_category(), "shm send segment");
+    }
+
+    segment segment::receive(int a_sock_fd)
+    {
+      segment result;
+
+      char control[CMSG_SPACE(max_segment_fds * sizeof(int))];
+      char tag = 0;
+      struct iovec iov = {&tag, sizeof(tag)};
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+
+      ssize_t received = recvmsg(a_sock_fd, &msg, MSG_CMSG_CLOEXEC);
+      if(received < 0)
+        throw boost::system::system_error(errno, boost::system::system_category(), "shm receive segment");
+
+      int fds[max_segment_fds] = {-1, -1, -1};
+      for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+      {
+        if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+          std::size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+          memcpy(fds, CMSG_DATA(cmsg), (count < max_segment_fds ? count : max_segment_fds) * sizeof(int));
+        }
+      }
+      result.m_memfd = fds[0];
+      result.m_event_fds[0] = fds[1];
+      result.m_event_fds[1] = fds[2];
+      if(received != 1 || tag != 'S' || result.m_memfd < 0)
+        throw boost::system::system_error(EPROTO, boost::system::system_category(), "shm receive segment");
+
+      struct stat st;
+      if(fstat(result.m_memfd, &st) != 0)
+        throw boost::system::system_error(errno, boost::system::system_category(), "shm fstat");
+      if(static_cast<std::size_t>(st.st_size) < sizeof(shm_segment_header_t))
+        throw boost::system::system_error(EPROTO, boost::system::system_category(), "shm segment size");
+      result.map(st.st_size);
+
+      auto header = result.header();
+      if(memcmp(header->magic, segment_magic, sizeof(segment_magic)) != 0 || header->version != segment_version ||
+         segment_size(header->ring_size) != result.m_size ||
+         (result.wakeup() == shm_wakeup_e::eventfd && (result.m_event_fds[0] < 0 || result.m_event_fds[1] < 0)))
+        throw boost::system::system_error(EPROTO, boost::system::system_category(), "shm segment header");
+      return result;
+    }
+
+    connection::connection(local_socket&& a_sock, segment&& a_segment, bool a_is_server, std::shared_ptr<boost::asio::io_service::strand> a_strand, bool a_use_strand, int a_cpu_core)
+      : m_strand(a_strand)
+      , m_sock(std::move(a_sock))
+      , m_segment(std::move(a_segment))
+      , m_wakeup(m_segment.wakeup())
+      , m_tx(&m_segment.header()->rings[a_is_server ? 1 : 0], m_segment.ring_data(a_is_server ? 1 : 0), m_segment.header()->ring_size, m_wakeup, m_segment.event_fd(a_is_server ? 1 : 0))
+      , m_rx(&m_segment.header()->rings[a_is_server ? 0 : 1], m_segment.ring_data(a_is_server ? 0 : 1), m_segment.header()->ring_size, m_wakeup, m_segment.event_fd(a_is_server ? 0 : 1))
+      , m_event(m_strand->get_io_service())
+      , m_use_strand(a_use_strand)
+      , m_cpu_core(a_cpu_core)
+    {
+      if(m_wakeup == shm_wakeup_e::eventfd)
+        m_event.assign(m_segment.release_event_fd(a_is_server ? 0 : 1));
+    }
+
+    connection::~connection()
+    {
+      if(m_thread.joinable())
+      {
+        if(m_thread.get_id() == std::this_thread::get_id())
+          m_thread.detach();
+        else
+          m_thread.join();
+      }
+    }
+
+    void connection::start(std::function<void(const char *a_data, std::size_t a_len)> a_on_message, std::function<void()> a_on_closed)
+    {
+      // closed before it started, e.g. by the server's on_connected
+      if(!m_is_open)
+        return;
+
+      m_on_message_func = a_on_message;
+      m_on_closed_func = a_on_closed;
+      m_is_run = true;
+
+      if(m_wakeup == shm_wakeup_e::eventfd)
+        m_strand->dispatch([this, self = shared_from_this()]{
+          drain_event();
+        });
+      else
+      {
+        // the thread keeps the connection alive until it has left the loop
+        m_thread = std::thread([this, self = shared_from_this()]{
+          t_is_receive_thread = true;
+          if(m_cpu_core >= 0)
+          {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            CPU_SET(m_cpu_core, &cpu_set);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+          }
+          receive_loop();
+        });
+      }
+
+      do_watch_socket();
+    }
+
+    void connection::send(const char *a_data, std::size_t a_len)
+    {
+      send_record(a_len, [a_data, a_len](char *a_out)
+      {
+        memcpy(a_out, a_data, a_len);
+      });
+    }
+
+    void connection::send_with(std::size_t a_len, const std::function<void(char *)>& a_fill)
+    {
+      send_record(a_len, a_fill);
+    }
+
+    template<typename Fill>
+    void connection::send_record(std::size_t a_len, Fill&& a_fill)
+    {
+      if(a_len > m_tx.max_message_size())
+        throw boost::system::system_error(EMSGSIZE, boost::system::system_category(), "shm send");
+
+      std::lock_guard<std::mutex> lock(m_tx_mutex);
+      // a full ring blocks the sender until the peer catches up, the same
+      // back pressure a blocking socket write gives
+      while(!m_tx.try_write_with(a_len, a_fill))
+      {
+        if(!m_is_open || m_tx.is_reader_closed())
+          return;
+        std::this_thread::yield();
+      }
+      m_tx.notify();
+    }
+
+    void connection::close()
+    {
+      if(!m_is_open.exchange(false))
+        return;
+
+      m_rx.close_reader();
+      m_is_run = false;
+      m_rx.wake();
+      // Only a caller outside the receive threads waits for this one to
+      // stop. A receive thread closing a connection (its own, or a peer
+      // that may be closing it in turn) just signals; the thread holds a
+      // reference and leaves the loop on its own.
+      if(m_thread.joinable() && !t_is_receive_thread)
+        m_thread.join();
+
+      m_strand->dispatch([this, self = shared_from_this()]{
+        boost::system::error_code ec;
+        m_sock.close(ec);
+        m_event.close(ec);
+      });
+    }
+
+    void connection::receive_loop()
+    {
+      auto on_message = [this](const char *a_data, std::size_t a_len)
+      {
+        if(m_on_message_func == nullptr)
+          return;
+
+        if(!m_use_strand)
+        {
+          // the owner may have closed it from a callback earlier in this drain
+          if(m_is_open)
+            m_on_message_func(a_data, a_len);
+          return;
+        }
+
+        // the record is released when drain returns, so the strand gets a copy
+        m_strand->post([this, self = shared_from_this(), message = std::string(a_data, a_len)]
+        {
+          if(m_is_open)
+            m_on_message_func(message.data(), message.size());
+        });
+      };
+
+      while(m_is_run)
+      {
+        if(m_rx.drain(on_message) != 0 || m_wakeup == shm_wakeup_e::spin)
+        {
+          if(m_wakeup == shm_wakeup_e::spin)
+            cpu_relax();
+          continue;
+        }
+
+        std::uint32_t signal;
+        if(!m_rx.prepare_wait(signal))
+          continue;
+        if(!m_is_run)
+        {
+          m_rx.finish_wait();
+          break;
+        }
+        m_rx.wait(signal);
+      }
+    }
+
+    void connection::do_wait_event()
+    {
+      m_event.async_read_some(boost::asio::null_buffers(), m_strand->wrap([this, self = shared_from_this()](boost::system::error_code ec, std::size_t /*bytes*/)
+      {
+        if(ec || !m_is_run)
+          return;
+
+        std::uint64_t value;
+        ssize_t count = read(m_event.native_handle(), &value, sizeof(value));
+        (void)count;
+        m_rx.finish_wait();
+        drain_event();
+      }));
+    }
+
+    void connection::drain_event()
+    {
+      while(true)
+      {
+        m_rx.drain([this](const char *a_data, std::size_t a_len)
+        {
+          // the owner may have closed it from a callback earlier in this drain
+          if(m_on_message_func != nullptr && m_is_open)
+            m_on_message_func(a_data, a_len);
+        });
+        if(!m_is_open)
+          return;
+
+        std::uint32_t signal;
+        if(m_rx.prepare_wait(signal))
+          break;
+      }
+      do_wait_event();
+    }
+
+    void connection::do_watch_socket()
+    {
+      m_sock.async_read_some(boost::asio::buffer(m_sock_buffer), m_strand->wrap([this, self = shared_from_this()](boost::system::error_code ec, std::size_t /*bytes*/)
+      {
+        if(!m_is_open)
+          return;
+
+        if(!ec)
+        {
+          do_watch_socket();
+          return;
+        }
+
+        close();
+        if(m_on_closed_func != nullptr)
+          m_on_closed_func();
+      }));
+    }
+  } //namespace shm
+} //namespace common
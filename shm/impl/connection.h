@@ -0,0 +1,117 @@
+#pragma once
+
+#include "../../communications.h"
+#include "shm_ring.h"
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace common
+{
+  namespace shm
+  {
+    using local_socket = boost::asio::local::stream_protocol::socket;
+
+    // Mapping and descriptors of one connection. The server creates it and
+    // passes the descriptors to the client over the Unix socket.
+    class segment
+    {
+      public:
+        segment() = default;
+        segment(segment&& a_other) noexcept;
+        segment& operator=(segment&& a_other) noexcept;
+        segment(const segment&) = delete;
+        segment& operator=(const segment&) = delete;
+        ~segment();
+
+        static segment create(std::size_t a_ring_size, shm_wakeup_e a_wakeup);
+        static segment receive(int a_sock_fd);
+        void send(int a_sock_fd) const;
+
+        shm_segment_header_t *header() const
+        {
+          return reinterpret_cast<shm_segment_header_t *>(m_base);
+        }
+
+        char *ring_data(std::size_t a_ring) const
+        {
+          return m_base + sizeof(shm_segment_header_t) + a_ring * header()->ring_size;
+        }
+
+        shm_wakeup_e wakeup() const
+        {
+          return static_cast<shm_wakeup_e>(header()->wakeup);
+        }
+
+        int event_fd(std::size_t a_ring) const
+        {
+          return m_event_fds[a_ring];
+        }
+
+        int release_event_fd(std::size_t a_ring)
+        {
+          int fd = m_event_fds[a_ring];
+          m_event_fds[a_ring] = -1;
+          return fd;
+        }
+
+      private:
+        void map(std::size_t a_size);
+        void reset();
+
+      private:
+        int m_memfd = -1;
+        int m_event_fds[2] = {-1, -1};
+        char *m_base = nullptr;
+        std::size_t m_size = 0;
+    };
+
+    // One end of a connection: writes to its tx ring, reads its rx ring and
+    // watches the Unix socket, whose EOF means the peer is gone. With futex or
+    // spin wakeup the rx ring is read on a dedicated thread, which calls
+    // on_message directly or, with a_use_strand, posts a copy of each
+    // message to the strand; with eventfd it is read on the io_service
+    // through the strand.
+    class connection
+      : public std::enable_shared_from_this<connection>
+    {
+      public:
+        using ref = std::shared_ptr<connection>;
+
+        connection(local_socket&& a_sock, segment&& a_segment, bool a_is_server, std::shared_ptr<boost::asio::io_service::strand> a_strand, bool a_use_strand, int a_cpu_core);
+        ~connection();
+
+        void start(std::function<void(const char *a_data, std::size_t a_len)> a_on_message, std::function<void()> a_on_closed);
+        void send(const char *a_data, std::size_t a_len);
+        void send_with(std::size_t a_len, const std::function<void(char *)>& a_fill);
+        void close();
+
+      private:
+        template<typename Fill>
+        void send_record(std::size_t a_len, Fill&& a_fill);
+        void receive_loop();
+        void do_wait_event();
+        void drain_event();
+        void do_watch_socket();
+
+      private:
+        std::shared_ptr<boost::asio::io_service::strand> m_strand;
+        local_socket m_sock;
+        segment m_segment;
+        shm_wakeup_e m_wakeup;
+        shm_ring m_tx;
+        shm_ring m_rx;
+        std::mutex m_tx_mutex;
+        boost::asio::posix::stream_descriptor m_event;
+        std::array<char, 1> m_sock_buffer;
+        bool m_use_strand;
+        int m_cpu_core;
+        std::thread m_thread;
+        std::function<void(const char *a_data, std::size_t a_len)> m_on_message_func;
+        std::function<void()> m_on_closed_func;
+        std::atomic<bool> m_is_run{false};
+        std::atomic<bool> m_is_open{true};
+    };
+  } //namespace shm
+} //namespace common
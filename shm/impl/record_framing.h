@@ -0,0 +1,66 @@
+#pragma once
+
+#include "../../tcp/framing.h"
+#include <memory>
+
+namespace common
+{
+  namespace shm
+  {
+    // Runs the records of one connection through the tcp framing of
+    // a_type, so the same sender produces the same messages over shm as
+    // over tcp: the eol modes split on '\n' and strip it (completion_eol
+    // and read_until_eol behave as async_read_some_eol here), a line or
+    // frame may span records, and chunked_eol hands out chunks. Records
+    // of one connection must be fed in order and one at a time. on_record()
+    // is false once a frame is over a_max_frame_size, and the connection
+    // is to be closed.
+    class record_framing
+    {
+      public:
+        record_framing(read_func_type_e a_type, std::size_t a_max_frame_size)
+        {
+          if(a_type == read_func_type_e::length_prefixed)
+            m_length_prefixed = std::make_unique<tcp::length_prefixed_framing>(a_max_frame_size);
+          else if(a_type == read_func_type_e::chunked_eol)
+            m_chunked = std::make_unique<tcp::chunked_eol_framing>(a_max_frame_size);
+          else
+            m_eol = std::make_unique<tcp::read_some_eol_framing>(a_max_frame_size);
+        }
+
+        template<typename OnMessage, typename OnChunk>
+        bool on_record(const char *a_data, std::size_t a_len, OnMessage&& a_on_message, OnChunk&& a_on_chunk)
+        {
+          if(m_chunked != nullptr)
+          {
+            const char *data;
+            std::size_t len;
+            m_chunked->on_data(a_data, a_len);
+            while(m_chunked->next_frame(data, len))
+              a_on_chunk(data, len, m_chunked->chunk().offset, m_chunked->chunk().flags);
+            return true;
+          }
+          if(m_length_prefixed != nullptr)
+            return split(*m_length_prefixed, a_data, a_len, a_on_message);
+          return split(*m_eol, a_data, a_len, a_on_message);
+        }
+
+      private:
+        template<typename Framing, typename OnMessage>
+        static bool split(Framing& a_framing, const char *a_data, std::size_t a_len, OnMessage& a_on_message)
+        {
+          const char *data;
+          std::size_t len;
+          a_framing.on_data(a_data, a_len);
+          while(a_framing.next_frame(data, len))
+            a_on_message(data, len);
+          return !a_framing.is_oversized();
+        }
+
+      private:
+        std::unique_ptr<tcp::read_some_eol_framing> m_eol;
+        std::unique_ptr<tcp::length_prefixed_framing> m_length_prefixed;
+        std::unique_ptr<tcp::chunked_eol_framing> m_chunked;
+    };
+  } //namespace shm
+} //namespace common
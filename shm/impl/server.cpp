@@ -0,0 +1,317 @@
+#include "connection.h"
+#include "record_framing.h"
+#include <unordered_map>
+
+namespace common
+{
+  namespace shm
+  {
+    class server
+     : public tcp::iserver
+     , public std::enable_shared_from_this<tcp::iserver>
+    {
+      public:
+        server(shm_server_params_t& a_params, boost::asio::io_service& a_io_service);
+        ~server() override;
+        void run() override;
+        void stop() override;
+        void remove_client(const int a_client_id) override;
+        void set_on_connected(std::function<void(const int)> a_on_connected) override;
+        void set_on_disconnected(std::function<void(const int)> a_on_disconnected) override;
+        void set_on_message(std::function<void(const int, const char *, std::size_t)> a_on_message) override;
+        void set_on_chunk(std::function<void(const int, const char *, std::size_t, std::uint64_t, std::uint32_t)> a_on_chunk) override;
+        void set_on_writable(std::function<void(const int)> a_on_writable) override;
+        void on_connected(const int a_client_id) override;
+        void on_disconnected(const int a_client_id) override;
+        void on_message(const int a_client_id, const char *a_data, std::size_t a_len) override;
+        void on_chunk(const int a_client_id, const char *a_data, std::size_t a_len, std::uint64_t a_offset, std::uint32_t a_flags) override;
+        void on_writable(const int a_client_id) override;
+        void send_message(const int a_client_id, const std::string &a_message) override;
+        void send_data(const int a_client_id, const char *a_data, std::size_t a_len, send_priority_e a_priority = send_priority_e::normal) override;
+        void send_data_for_all(const char *a_data, std::size_t a_len, send_priority_e a_priority = send_priority_e::normal) override;
+        void send_encoded(const int a_client_id, std::size_t a_len, const std::function<void(char *)>& a_fill, send_priority_e a_priority = send_priority_e::normal) override;
+        std::size_t clients_count() override;
+        tcp_lane_depths_t lane_depths(const int a_client_id) override;
+
+      private:
+        void do_accept() override;
+        connection::ref find_client(const int a_client_id);
+
+      private:
+        std::shared_ptr<boost::asio::io_service::strand> m_strand;
+        std::shared_ptr<local_socket> m_listener;
+        std::shared_ptr<boost::asio::local::stream_protocol::acceptor> m_acceptor;
+        std::unordered_map<int, connection::ref> m_clients;
+        std::mutex m_clients_mutex;
+        std::shared_ptr<shm_server_params_t> m_params;
+
+        std::function<void(const int)> m_on_connected_func;
+        std::function<void(const int)> m_on_disconnected_func;
+        std::function<void(const int, const char *, std::size_t)> m_on_message_func;
+        std::function<void(const int, const char *, std::size_t, std::uint64_t, std::uint32_t)> m_on_chunk_func;
+        std::function<void(const int)> m_on_writable_func;
+    };
+
+    server::server(shm_server_params_t& a_params, boost::asio::io_service& a_io_service)
+     : m_strand(std::make_shared<boost::asio::io_service::strand>(a_io_service))
+     , m_listener(std::make_shared<local_socket>(a_io_service))
+     , m_acceptor(std::make_shared<boost::asio::local::stream_protocol::acceptor>(a_io_service))
+     , m_params(std::make_shared<shm_server_params_t>(a_params))
+    {
+      // a socket file left behind by a previous run would fail the bind
+      unlink(m_params->socket_path.c_str());
+      boost::asio::local::stream_protocol::endpoint ep(m_params->socket_path);
+      m_acceptor->open(ep.protocol());
+      m_acceptor->bind(ep);
+      m_acceptor->listen();
+    }
+
+    server::~server()
+    {
+      std::unordered_map<int, connection::ref> clients;
+      {
+        std::lock_guard<std::mutex> lock(m_clients_mutex);
+        clients.swap(m_clients);
+      }
+      for(auto& cl : clients)
+        cl.second->close();
+      unlink(m_params->socket_path.c_str());
+    }
+
+    void server::run()
+    {
+      do_accept();
+    }
+
+    // on the strand, like the accept handler
+    void server::stop()
+    {
+      std::weak_ptr<tcp::iserver> weak_self = shared_from_this();
+      m_strand->post([this, weak_self]
+      {
+        auto self = weak_self.lock();
+        if(self == nullptr)
+          return;
+
+        boost::system::error_code ec;
+        m_acceptor->close(ec);
+
+        std::unordered_map<int, connection::ref> clients;
+        {
+          std::lock_guard<std::mutex> lock(m_clients_mutex);
+          clients.swap(m_clients);
+        }
+        for(auto& cl : clients)
+        {
+          cl.second->close();
+          on_disconnected(cl.first);
+        }
+      });
+    }
+
+    void server::remove_client(const int a_client_id)
+    {
+      connection::ref client;
+      {
+        std::lock_guard<std::mutex> lock(m_clients_mutex);
+        const auto& found_it = m_clients.find(a_client_id);
+        if(found_it == m_clients.end())
+          return;
+        client = found_it->second;
+        m_clients.erase(found_it);
+      }
+      client->close();
+      on_disconnected(a_client_id);
+    }
+
+    void server::set_on_connected(std::function<void(const int)> a_on_connected)
+    {
+      m_on_connected_func = a_on_connected;
+    }
+
+    void server::set_on_disconnected(std::function<void(const int)> a_on_disconnected)
+    {
+      m_on_disconnected_func = a_on_disconnected;
+    }
+
+    void server::set_on_message(std::function<void(const int, const char *, std::size_t)> a_on_message)
+    {
+      m_on_message_func = a_on_message;
+    }
+
+    void server::set_on_chunk(std::function<void(const int, const char *, std::size_t, std::uint64_t, std::uint32_t)> a_on_chunk)
+    {
+      m_on_chunk_func = a_on_chunk;
+    }
+
+    // sends block until the message is in the ring, so nothing ever queues
+    // and on_writable is not raised by the server itself
+    void server::set_on_writable(std::function<void(const int)> a_on_writable)
+    {
+      m_on_writable_func = a_on_writable;
+    }
+
+    void server::on_connected(const int a_client_id)
+    {
+      if(m_on_connected_func != nullptr)
+        m_on_connected_func(a_client_id);
+    }
+
+    void server::on_disconnected(const int a_client_id)
+    {
+      if(m_on_disconnected_func != nullptr)
+        m_on_disconnected_func(a_client_id);
+    }
+
+    void server::on_message(const int a_client_id, const char *a_data, std::size_t a_len)
+    {
+      if(m_on_message_func != nullptr)
+        m_on_message_func(a_client_id, a_data, a_len);
+    }
+
+    void server::on_chunk(const int a_client_id, const char *a_data, std::size_t a_len, std::uint64_t a_offset, std::uint32_t a_flags)
+    {
+      if(m_on_chunk_func != nullptr)
+        m_on_chunk_func(a_client_id, a_data, a_len, a_offset, a_flags);
+    }
+
+    void server::on_writable(const int a_client_id)
+    {
+      if(m_on_writable_func != nullptr)
+        m_on_writable_func(a_client_id);
+    }
+
+    void server::send_message(const int a_client_id, const std::string &a_message)
+    {
+      send_data(a_client_id, a_message.c_str(), a_message.size());
+    }
+
+    // Messages are copied into the ring synchronously, so nothing queues up
+    // behind a send and the priority has nothing to reorder.
+    void server::send_data(const int a_client_id, const char *a_data, std::size_t a_len, send_priority_e /*a_priority*/)
+    {
+      if(auto client = find_client(a_client_id))
+        client->send(a_data, a_len);
+    }
+
+    void server::send_data_for_all(const char *a_data, std::size_t a_len, send_priority_e /*a_priority*/)
+    {
+      std::vector<connection::ref> clients;
+      {
+        std::lock_guard<std::mutex> lock(m_clients_mutex);
+        for(auto& cl : m_clients)
+          clients.push_back(cl.second);
+      }
+      for(auto& cl : clients)
+        cl->send(a_data, a_len);
+    }
+
+    void server::send_encoded(const int a_client_id, std::size_t a_len, const std::function<void(char *)>& a_fill, send_priority_e /*a_priority*/)
+    {
+      if(auto client = find_client(a_client_id))
+        client->send_with(a_len, a_fill);
+    }
+
+    std::size_t server::clients_count()
+    {
+      std::lock_guard<std::mutex> lock(m_clients_mutex);
+      return m_clients.size();
+    }
+
+    tcp_lane_depths_t server::lane_depths(const int /*a_client_id*/)
+    {
+      return tcp_lane_depths_t{};
+    }
+
+    connection::ref server::find_client(const int a_client_id)
+    {
+      std::lock_guard<std::mutex> lock(m_clients_mutex);
+      const auto& found_it = m_clients.find(a_client_id);
+      return found_it != m_clients.end() ? found_it->second : nullptr;
+    }
+
+    void server::do_accept()
+    {
+      // connections call back through a weak reference, so a callback
+      // either keeps the server alive or is dropped once it has gone
+      std::weak_ptr<tcp::iserver> weak_self = shared_from_this();
+      m_acceptor->async_accept(*m_listener, m_strand->wrap([this, weak_self](boost::system::error_code a_ec)
+      {
+        auto self = weak_self.lock();
+        if(a_ec == boost::asio::error::operation_aborted || self == nullptr)
+          return;
+
+        // stopped; a connection accepted just before is not served
+        if(!m_acceptor->is_open())
+        {
+          boost::system::error_code ec;
+          m_listener->close(ec);
+          return;
+        }
+
+        if(!a_ec)
+        {
+          int client_id = m_listener->native_handle();
+          try
+          {
+            auto seg = segment::create(m_params->ring_size, m_params->wakeup);
+            seg.send(client_id);
+
+            // with use_strand every connection delivers through the server
+            // strand, so callbacks are serialized across clients as with tcp
+            // in every wakeup mode
+            auto new_client = std::make_shared<connection>(std::move(*m_listener), std::move(seg), true, m_params->use_strand ? m_strand : std::make_shared<boost::asio::io_service::strand>(m_strand->get_io_service()), m_params->use_strand, m_params->cpu_core);
+            {
+              std::lock_guard<std::mutex> lock(m_clients_mutex);
+              m_clients.insert(std::make_pair(client_id, new_client));
+            }
+            // raised before the receive side starts, so no on_message or
+            // on_disconnected of this client can come ahead of it
+            on_connected(client_id);
+            auto framing = std::make_shared<record_framing>(m_params->do_read_type, m_params->max_frame_size);
+            new_client->start([weak_self, client_id, framing](const char *a_data, std::size_t a_len)
+              {
+                auto owner = weak_self.lock();
+                if(owner == nullptr)
+                  return;
+                bool is_ok = framing->on_record(a_data, a_len,
+                  [&owner, client_id](const char *a_msg, std::size_t a_msg_len)
+                  {
+                    owner->on_message(client_id, a_msg, a_msg_len);
+                  },
+                  [&owner, client_id](const char *a_chunk, std::size_t a_chunk_len, std::uint64_t a_offset, std::uint32_t a_flags)
+                  {
+                    owner->on_chunk(client_id, a_chunk, a_chunk_len, a_offset, a_flags);
+                  });
+                // a frame over max_frame_size; drop the client
+                if(!is_ok)
+                  owner->remove_client(client_id);
+              },
+              [weak_self, client_id]
+              {
+                if(auto owner = weak_self.lock())
+                  owner->remove_client(client_id);
+              });
+          }
+          catch(const boost::system::system_error&)
+          {
+            boost::system::error_code ec;
+            m_listener->close(ec);
+          }
+        }
+        do_accept();
+      }));
+    }
+  } //namespace shm
+} //namespace common
+
+namespace common
+{
+  namespace shm
+  {
+    tcp::iserver::ref create_server(shm_server_params_t& a_params, boost::asio::io_service& a_io_service)
+    {
+      return std::make_shared<server>(a_params, a_io_service);
+    }
+  } //namespace shm
+} //namespace common
@@ -0,0 +1,240 @@
+#pragma once
+
+#include "../../communacations_types.h"
+#include "../../packet_ring.h"
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace common
+{
+  namespace shm
+  {
+    const char segment_magic[8] = {'C', 'O', 'M', 'M', 'S', 'H', 'M', '1'};
+    const std::uint32_t segment_version = 1;
+    const std::uint32_t record_header_size = 8;
+    const std::uint32_t record_padding = 0xffffffff;
+
+    // Lives in the shared mapping; every field is touched by both processes.
+    struct shm_ring_header_t
+    {
+      alignas(CACHE_LINE_SIZE) std::atomic<std::uint64_t> head;
+      alignas(CACHE_LINE_SIZE) std::atomic<std::uint64_t> tail;
+      alignas(CACHE_LINE_SIZE) std::atomic<std::uint32_t> signal;
+      std::atomic<std::uint32_t> waiting;
+      std::atomic<std::uint32_t> reader_closed;
+    };
+
+    // ring 0 carries client -> server, ring 1 server -> client
+    struct shm_segment_header_t
+    {
+      char magic[8];
+      std::uint32_t version;
+      std::uint32_t wakeup;
+      std::uint64_t ring_size;
+      shm_ring_header_t rings[2];
+    };
+
+    inline std::size_t segment_size(std::size_t a_ring_size)
+    {
+      return sizeof(shm_segment_header_t) + 2 * a_ring_size;
+    }
+
+    inline int futex_wait(std::atomic<std::uint32_t>& a_word, std::uint32_t a_expected)
+    {
+      return static_cast<int>(syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&a_word), FUTEX_WAIT, a_expected, nullptr, nullptr, 0));
+    }
+
+    inline int futex_wake(std::atomic<std::uint32_t>& a_word)
+    {
+      return static_cast<int>(syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&a_word), FUTEX_WAKE, 1, nullptr, nullptr, 0));
+    }
+
+    inline void cpu_relax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#endif
+    }
+
+    // One direction of a connection: a byte ring of 8-byte aligned records,
+    // each a 32-bit length followed by the payload. A record that would run
+    // past the end is preceded by a padding marker and starts again at 0.
+    // The writer signals the reader only when the reader has announced that
+    // it is about to sleep.
+    class shm_ring
+    {
+      public:
+        shm_ring(shm_ring_header_t *a_header, char *a_data, std::size_t a_size, shm_wakeup_e a_wakeup, int a_event_fd)
+          : m_header(a_header)
+          , m_data(a_data)
+          , m_size(a_size)
+          , m_mask(a_size - 1)
+          , m_wakeup(a_wakeup)
+          , m_event_fd(a_event_fd)
+        {
+        }
+
+        std::size_t max_message_size() const
+        {
+          return m_size / 2 - record_header_size;
+        }
+
+        // writer side
+        bool try_write(const char *a_data, std::size_t a_len)
+        {
+          return try_write_with(a_len, [a_data, a_len](char *a_out)
+          {
+            memcpy(a_out, a_data, a_len);
+          });
+        }
+
+        // a_fill(out) writes the a_len byte payload in place in the ring
+        template<typename Fill>
+        bool try_write_with(std::size_t a_len, Fill&& a_fill)
+        {
+          std::uint64_t head = m_header->head.load(std::memory_order_relaxed);
+          std::uint64_t record = record_header_size + ((a_len + 7) & ~std::uint64_t(7));
+          std::uint64_t pos = head & m_mask;
+          std::uint64_t padding = pos + record > m_size ? m_size - pos : 0;
+
+          if(head + padding + record - m_cached_tail > m_size)
+          {
+            m_cached_tail = m_header->tail.load(std::memory_order_acquire);
+            if(head + padding + record - m_cached_tail > m_size)
+              return false;
+          }
+
+          if(padding != 0)
+          {
+            write_length(pos, record_padding);
+            head += padding;
+            pos = 0;
+          }
+          write_length(pos, static_cast<std::uint32_t>(a_len));
+          a_fill(m_data + pos + record_header_size);
+          m_header->head.store(head + record, std::memory_order_release);
+          return true;
+        }
+
+        void notify()
+        {
+          // pairs with the fence in prepare_wait(): either the reader sees the
+          // new head or we see its waiting flag
+          std::atomic_thread_fence(std::memory_order_seq_cst);
+          if(m_header->waiting.load(std::memory_order_relaxed) == 0)
+            return;
+
+          wake();
+        }
+
+        void wake()
+        {
+          if(m_wakeup == shm_wakeup_e::futex)
+          {
+            m_header->signal.fetch_add(1, std::memory_order_release);
+            futex_wake(m_header->signal);
+          }
+          else if(m_wakeup == shm_wakeup_e::eventfd)
+          {
+            std::uint64_t value = 1;
+            ssize_t written = write(m_event_fd, &value, sizeof(value));
+            (void)written;  // a full counter already means "readable"
+          }
+        }
+
+        bool is_reader_closed() const
+        {
+          return m_header->reader_closed.load(std::memory_order_acquire) != 0;
+        }
+
+        // reader side
+        bool empty()
+        {
+          return m_header->tail.load(std::memory_order_relaxed) == m_header->head.load(std::memory_order_acquire);
+        }
+
+        template<typename F>
+        std::size_t drain(F&& a_on_message)
+        {
+          std::uint64_t tail = m_header->tail.load(std::memory_order_relaxed);
+          std::uint64_t head = m_header->head.load(std::memory_order_acquire);
+          std::size_t count = 0;
+          while(tail != head)
+          {
+            std::uint64_t pos = tail & m_mask;
+            std::uint32_t len = read_length(pos);
+            if(len == record_padding)
+            {
+              tail += m_size - pos;
+              continue;
+            }
+
+            a_on_message(m_data + pos + record_header_size, static_cast<std::size_t>(len));
+            tail += record_header_size + ((len + 7) & ~std::uint64_t(7));
+            count++;
+          }
+          m_header->tail.store(tail, std::memory_order_release);
+          return count;
+        }
+
+        // Returns the futex value to wait on; false means data arrived in
+        // the meantime and the caller should drain instead of sleeping.
+        bool prepare_wait(std::uint32_t& a_signal)
+        {
+          a_signal = m_header->signal.load(std::memory_order_acquire);
+          m_header->waiting.store(1, std::memory_order_relaxed);
+          std::atomic_thread_fence(std::memory_order_seq_cst);
+          if(!empty())
+          {
+            m_header->waiting.store(0, std::memory_order_relaxed);
+            return false;
+          }
+          return true;
+        }
+
+        void wait(std::uint32_t a_signal)
+        {
+          futex_wait(m_header->signal, a_signal);
+          m_header->waiting.store(0, std::memory_order_relaxed);
+        }
+
+        void finish_wait()
+        {
+          m_header->waiting.store(0, std::memory_order_relaxed);
+        }
+
+        void close_reader()
+        {
+          m_header->reader_closed.store(1, std::memory_order_release);
+        }
+
+      private:
+        void write_length(std::uint64_t a_pos, std::uint32_t a_len)
+        {
+          memcpy(m_data + a_pos, &a_len, sizeof(a_len));
+        }
+
+        std::uint32_t read_length(std::uint64_t a_pos) const
+        {
+          std::uint32_t len;
+          memcpy(&len, m_data + a_pos, sizeof(len));
+          return len;
+        }
+
+      private:
+        shm_ring_header_t *m_header;
+        char *m_data;
+        const std::uint64_t m_size;
+        const std::uint64_t m_mask;
+        const shm_wakeup_e m_wakeup;
+        const int m_event_fd;
+        std::uint64_t m_cached_tail = 0;
+    };
+  } //namespace shm
+} //namespace common
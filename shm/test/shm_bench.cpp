@@ -0,0 +1,187 @@
+#include "../../communications.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Measures shm per wakeup mode, with the server echoing eol messages:
+//   rtt     one message in flight at a time; round trip in us, from
+//           send_message on the client to on_message on the client
+//   stream  one-way messages the server only counts; messages per second
+//
+//   communications_shm_bench [--rtts=N] [--stream=N] [--size=BYTES]
+//                            [--use_strand=0|1]
+
+namespace
+{
+  using namespace common;
+  using bench_clock = std::chrono::steady_clock;
+
+  struct bench_options_t
+  {
+    std::size_t rtts = 20000;
+    std::size_t stream = 1000000;
+    std::size_t size = 64;
+    std::size_t use_strand = 0;
+  };
+
+  const char KIND_ECHO = 'E';
+  const char KIND_SINK = 'S';
+
+  const char *wakeup_name(shm_wakeup_e a_wakeup)
+  {
+    switch(a_wakeup)
+    {
+      case shm_wakeup_e::eventfd:
+        return "eventfd";
+      case shm_wakeup_e::spin:
+        return "spin";
+      case shm_wakeup_e::futex:
+      default:
+        return "futex";
+    }
+  }
+
+  double percentile(std::vector<double>& a_samples, double a_fraction)
+  {
+    if(a_samples.empty())
+      return 0;
+    std::sort(a_samples.begin(), a_samples.end());
+    std::size_t index = static_cast<std::size_t>(a_fraction * (a_samples.size() - 1));
+    return a_samples[index];
+  }
+
+  template<typename Condition>
+  bool wait_for(Condition a_condition, std::chrono::seconds a_timeout = std::chrono::seconds(30))
+  {
+    auto deadline = bench_clock::now() + a_timeout;
+    while(!a_condition())
+    {
+      if(bench_clock::now() > deadline)
+        return false;
+      std::this_thread::yield();
+    }
+    return true;
+  }
+
+  double elapsed_us(bench_clock::time_point a_start)
+  {
+    return std::chrono::duration<double, std::micro>(bench_clock::now() - a_start).count();
+  }
+
+  void run_wakeup(const bench_options_t& a_options, shm_wakeup_e a_wakeup)
+  {
+    const std::string path = "/tmp/communications_shm_bench_" + std::to_string(getpid()) + ".sock";
+    boost::asio::io_service io_service;
+    auto work = std::make_shared<boost::asio::io_service::work>(io_service);
+
+    shm_server_params_t server_params;
+    server_params.socket_path = path;
+    server_params.wakeup = a_wakeup;
+    server_params.use_strand = a_options.use_strand != 0;
+    auto server = shm::create_server(server_params, io_service);
+    tcp::iserver *raw = server.get();
+    std::atomic<std::uint64_t> sunk{0};
+    server->set_on_message([raw, &sunk](const int a_client, const char *a_data, std::size_t a_len)
+    {
+      if(a_len > 0 && a_data[0] == KIND_ECHO)
+      {
+        std::string reply(a_data, a_len);
+        reply += '\n';
+        raw->send_data(a_client, reply.c_str(), reply.length());
+      }
+      else
+        sunk.store(sunk.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    });
+    server->run();
+
+    shm_client_params_t client_params;
+    client_params.socket_path = path;
+    client_params.use_strand = a_options.use_strand != 0;
+    auto client = shm::create_client(client_params, io_service);
+    std::atomic<bool> is_connected{false};
+    std::atomic<std::uint64_t> echoed{0};
+    client->set_on_connected([&is_connected]{ is_connected = true; });
+    client->set_on_message([&echoed](const std::string&){ echoed.fetch_add(1, std::memory_order_relaxed); });
+    client->run();
+
+    std::thread io_thread([&io_service](){
+      io_service.run();
+    });
+    wait_for([&is_connected]{ return is_connected.load(); });
+
+    std::string echo(std::max<std::size_t>(a_options.size, 2) - 1, 'x');
+    echo[0] = KIND_ECHO;
+    echo += '\n';
+    std::vector<double> rtts;
+    for(std::size_t i = 0; i < a_options.rtts; i++)
+    {
+      auto start = bench_clock::now();
+      client->send_message(echo);
+      if(!wait_for([&echoed, i]{ return echoed.load(std::memory_order_relaxed) > i; }))
+        break;
+      rtts.push_back(elapsed_us(start));
+    }
+
+    std::string sink = echo;
+    sink[0] = KIND_SINK;
+    auto stream_start = bench_clock::now();
+    for(std::size_t queued = 0; queued < a_options.stream; queued++)
+    {
+      // stay well inside the ring rather than measure a full one
+      wait_for([&sunk, queued]{ return queued < sunk.load(std::memory_order_relaxed) + 4096; });
+      client->send_message(sink);
+    }
+    wait_for([&sunk, &a_options]{ return sunk.load(std::memory_order_relaxed) >= a_options.stream; });
+    double stream_seconds = elapsed_us(stream_start) / 1e6;
+
+    client.reset();
+    server.reset();
+    work.reset();
+    io_service.stop();
+    io_thread.join();
+
+    printf("%-8s %9.1f %9.1f %9.1f %12.0f\n", wakeup_name(a_wakeup),
+           percentile(rtts, 0.5), percentile(rtts, 0.99), percentile(rtts, 0.999),
+           a_options.stream / stream_seconds);
+  }
+
+  bool parse_option(const char *a_arg, const char *a_name, std::size_t& a_value)
+  {
+    std::size_t len = strlen(a_name);
+    if(strncmp(a_arg, a_name, len) != 0 || a_arg[len] != '=')
+      return false;
+    a_value = std::stoull(a_arg + len + 1);
+    return true;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  bench_options_t options;
+  for(int i = 1; i < argc; i++)
+  {
+    if(!parse_option(argv[i], "--rtts", options.rtts) &&
+       !parse_option(argv[i], "--stream", options.stream) &&
+       !parse_option(argv[i], "--size", options.size) &&
+       !parse_option(argv[i], "--use_strand", options.use_strand))
+    {
+      std::cerr << "unknown option " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+
+  printf("%zu byte messages, use_strand %zu, %u cpus\n", std::max<std::size_t>(options.size, 2), options.use_strand, std::thread::hardware_concurrency());
+  printf("%-8s %9s %9s %9s %12s\n", "wakeup", "rtt p50", "rtt p99", "rtt p99.9", "stream msg/s");
+
+  for(auto wakeup : {shm_wakeup_e::futex, shm_wakeup_e::eventfd, shm_wakeup_e::spin})
+    run_wakeup(options, wakeup);
+
+  return 0;
+}
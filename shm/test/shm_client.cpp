@@ -0,0 +1,161 @@
+#include "../../communications.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Echoes messages over shm in every wakeup mode and checks that they come
+// back whole and in order, then drops the connection from the server side
+// and checks that the client reconnects and echoes again. Exits non-zero
+// on the first failure.
+//
+//   communications_shm_test_app [messages]
+
+namespace
+{
+  using namespace common;
+  using test_clock = std::chrono::steady_clock;
+
+  template<typename Condition>
+  bool wait_for(Condition a_condition, std::chrono::seconds a_timeout = std::chrono::seconds(10))
+  {
+    auto deadline = test_clock::now() + a_timeout;
+    while(!a_condition())
+    {
+      if(test_clock::now() > deadline)
+        return false;
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+  }
+
+  const char *wakeup_name(shm_wakeup_e a_wakeup)
+  {
+    switch(a_wakeup)
+    {
+      case shm_wakeup_e::eventfd:
+        return "eventfd";
+      case shm_wakeup_e::spin:
+        return "spin";
+      case shm_wakeup_e::futex:
+      default:
+        return "futex";
+    }
+  }
+
+  struct echo_state_t
+  {
+    std::mutex mutex;
+    std::vector<std::string> received;
+    std::atomic<int> client_id{-1};
+    std::atomic<int> accepted{0};
+    std::atomic<int> connected{0};
+    std::atomic<int> disconnected{0};
+  };
+
+  bool echo_round(tcp::iclient::ref& a_client, echo_state_t& a_state, std::size_t a_messages, const char *a_round)
+  {
+    {
+      std::lock_guard<std::mutex> lk(a_state.mutex);
+      a_state.received.clear();
+    }
+    for(std::size_t i = 0; i < a_messages; i++)
+      a_client->send_message("message " + std::to_string(i) + "\n");
+
+    if(!wait_for([&a_state, a_messages]{ std::lock_guard<std::mutex> lk(a_state.mutex); return a_state.received.size() >= a_messages; }))
+    {
+      std::lock_guard<std::mutex> lk(a_state.mutex);
+      printf("  %s: %zu of %zu echoes\n", a_round, a_state.received.size(), a_messages);
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lk(a_state.mutex);
+    for(std::size_t i = 0; i < a_messages; i++)
+    {
+      if(a_state.received[i] != "message " + std::to_string(i))
+      {
+        printf("  %s: echo %zu is '%s'\n", a_round, i, a_state.received[i].c_str());
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool run_test(shm_wakeup_e a_wakeup, std::size_t a_messages)
+  {
+    const std::string path = "/tmp/communications_shm_test_" + std::to_string(getpid()) + ".sock";
+    boost::asio::io_service io_service;
+    auto work = std::make_shared<boost::asio::io_service::work>(io_service);
+    echo_state_t state;
+
+    shm_server_params_t server_params;
+    server_params.socket_path = path;
+    server_params.wakeup = a_wakeup;
+    server_params.use_strand = true;
+    auto server = shm::create_server(server_params, io_service);
+    tcp::iserver *raw = server.get();
+    server->set_on_connected([&state](const int a_client){ state.client_id = a_client; state.accepted++; });
+    server->set_on_message([raw](const int a_client, const char *a_data, std::size_t a_len)
+    {
+      std::string reply(a_data, a_len);
+      reply += '\n';
+      raw->send_data(a_client, reply.c_str(), reply.length());
+    });
+    server->run();
+
+    shm_client_params_t client_params;
+    client_params.socket_path = path;
+    client_params.use_strand = true;
+    auto client = shm::create_client(client_params, io_service);
+    client->set_on_connected([&state]{ state.connected++; });
+    client->set_on_disconnected([&state]{ state.disconnected++; });
+    client->set_on_message([&state](const std::string& a_data)
+    {
+      std::lock_guard<std::mutex> lk(state.mutex);
+      state.received.push_back(a_data);
+    });
+    client->run();
+
+    std::thread io_thread([&io_service](){
+      io_service.run();
+    });
+
+    bool is_ok = wait_for([&state]{ return state.connected == 1 && state.accepted == 1; });
+    if(!is_ok)
+      printf("  connect failed\n");
+    is_ok = is_ok && echo_round(client, state, a_messages, "first connection");
+
+    if(is_ok)
+    {
+      server->remove_client(state.client_id);
+      is_ok = wait_for([&state]{ return state.connected == 2 && state.accepted == 2; });
+      if(!is_ok)
+        printf("  no reconnect, %d disconnects\n", state.disconnected.load());
+      is_ok = is_ok && echo_round(client, state, a_messages, "after reconnect");
+    }
+
+    client.reset();
+    server.reset();
+    work.reset();
+    io_service.stop();
+    io_thread.join();
+
+    printf("%-8s %s\n", wakeup_name(a_wakeup), is_ok ? "ok" : "FAILED");
+    return is_ok;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  std::size_t messages = argc > 1 ? std::stoull(argv[1]) : 10000;
+
+  bool is_ok = true;
+  for(auto wakeup : {shm_wakeup_e::futex, shm_wakeup_e::eventfd, shm_wakeup_e::spin})
+    is_ok = run_test(wakeup, messages) && is_ok;
+
+  return is_ok ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "communacations_types.h"
+#include <boost/asio.hpp>
+#include <boost/system/system_error.hpp>
+#include <cerrno>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+namespace common
+{
+  // The options a_options asks for: its profile's values with the
+  // overrides on top, -1 where the system default stays.
+  inline socket_options_t resolve_socket_options(const socket_options_t& a_options)
+  {
+    socket_options_t resolved;
+    resolved.profile = a_options.profile;
+    switch(a_options.profile)
+    {
+      case socket_profile_e::low_latency:
+        resolved.no_delay = 1;
+        resolved.quick_ack = 1;
+        resolved.not_sent_lowat = 16384;
+        resolved.busy_poll_us = 50;
+        resolved.priority = 6;
+        resolved.tos = 0xB8;
+        break;
+      case socket_profile_e::bulk:
+        resolved.no_delay = 0;
+        resolved.rcvbuf = 4 * 1024 * 1024;
+        resolved.sndbuf = 4 * 1024 * 1024;
+        break;
+      case socket_profile_e::system_default:
+      default:
+        break;
+    }
+
+    auto override_with = [](int& a_value, int a_override)
+    {
+      if(a_override >= 0)
+        a_value = a_override;
+    };
+    override_with(resolved.no_delay, a_options.no_delay);
+    override_with(resolved.quick_ack, a_options.quick_ack);
+    override_with(resolved.not_sent_lowat, a_options.not_sent_lowat);
+    override_with(resolved.rcvbuf, a_options.rcvbuf);
+    override_with(resolved.sndbuf, a_options.sndbuf);
+    override_with(resolved.busy_poll_us, a_options.busy_poll_us);
+    override_with(resolved.priority, a_options.priority);
+    override_with(resolved.tos, a_options.tos);
+    return resolved;
+  }
+
+  namespace detail
+  {
+    // a_value < 0 leaves the option alone
+    inline void set_socket_option(int a_fd, int a_level, int a_name, int a_value, bool a_is_override, const char *a_what)
+    {
+      if(a_value < 0)
+        return;
+      if(setsockopt(a_fd, a_level, a_name, &a_value, sizeof(a_value)) != 0 && a_is_override)
+        throw boost::system::system_error(errno, boost::system::system_category(), a_what);
+    }
+
+    // Values that come from the profile are best effort: SO_BUSY_POLL above
+    // net.core.busy_read and SO_PRIORITY above 6 need CAP_NET_ADMIN, and
+    // older kernels lack TCP_NOTSENT_LOWAT. An explicit override the kernel
+    // refuses throws.
+    inline void apply_socket_options(int a_fd, const socket_options_t& a_options, bool a_is_tcp)
+    {
+      const socket_options_t resolved = resolve_socket_options(a_options);
+      if(a_is_tcp)
+      {
+        set_socket_option(a_fd, IPPROTO_TCP, TCP_NODELAY, resolved.no_delay, a_options.no_delay >= 0, "TCP_NODELAY");
+        set_socket_option(a_fd, IPPROTO_TCP, TCP_QUICKACK, resolved.quick_ack, a_options.quick_ack >= 0, "TCP_QUICKACK");
+        set_socket_option(a_fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, resolved.not_sent_lowat, a_options.not_sent_lowat >= 0, "TCP_NOTSENT_LOWAT");
+      }
+      set_socket_option(a_fd, SOL_SOCKET, SO_RCVBUF, resolved.rcvbuf, a_options.rcvbuf >= 0, "SO_RCVBUF");
+      set_socket_option(a_fd, SOL_SOCKET, SO_SNDBUF, resolved.sndbuf, a_options.sndbuf >= 0, "SO_SNDBUF");
+      set_socket_option(a_fd, SOL_SOCKET, SO_BUSY_POLL, resolved.busy_poll_us, a_options.busy_poll_us >= 0, "SO_BUSY_POLL");
+      // IP_TOS resets the priority from the tos bits, so it goes first
+      set_socket_option(a_fd, IPPROTO_IP, IP_TOS, resolved.tos, a_options.tos >= 0, "IP_TOS");
+      set_socket_option(a_fd, SOL_SOCKET, SO_PRIORITY, resolved.priority, a_options.priority >= 0, "SO_PRIORITY");
+    }
+  } //namespace detail
+
+  // Sockets must be open. The buffer sizes only shape the window scale a
+  // tcp connection negotiates when set before connect, or on the acceptor
+  // before the connection arrives.
+  inline void apply_socket_options(boost::asio::ip::tcp::socket& a_sock, const socket_options_t& a_options)
+  {
+    detail::apply_socket_options(a_sock.native_handle(), a_options, true);
+  }
+
+  inline void apply_socket_options(boost::asio::ip::tcp::acceptor& a_acceptor, const socket_options_t& a_options)
+  {
+    detail::apply_socket_options(a_acceptor.native_handle(), a_options, true);
+  }
+
+  inline void apply_socket_options(boost::asio::ip::udp::socket& a_sock, const socket_options_t& a_options)
+  {
+    detail::apply_socket_options(a_sock.native_handle(), a_options, false);
+  }
+
+  // The kernel leaves quick-ack mode again on its own, so a socket that
+  // wants it re-arms it after every read.
+  inline void rearm_quick_ack(int a_fd)
+  {
+    int on = 1;
+    setsockopt(a_fd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+  }
+} //namespace common
@@ -0,0 +1,230 @@
+#pragma once
+
+#include "basic_session.h"
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace common
+{
+  namespace tcp
+  {
+    template<typename Handler, typename = void>
+    struct has_on_writable
+      : std::false_type
+    {
+    };
+
+    template<typename Handler>
+    struct has_on_writable<Handler, decltype(std::declval<Handler&>().on_writable(0), void())>
+      : std::true_type
+    {
+    };
+
+    // Accepts connections and runs a basic_session per client. Handler must
+    // provide
+    //   void on_connected(const int a_client_id);
+    //   void on_disconnected(const int a_client_id);
+    //   void on_message(const int a_client_id, const char *a_data, std::size_t a_len);
+    // and optionally
+    //   void on_writable(const int a_client_id);
+    // With a chunked framing (see is_chunked_framing) it provides
+    //   void on_chunk(const int a_client_id, const char *a_data, std::size_t a_len, std::uint64_t a_offset, std::uint32_t a_flags);
+    // in place of on_message. The handler is called directly, so a concrete
+    // handler is inlined into the read path. Create with std::make_shared.
+    //
+    // With sharded_executor the server owns a worker_pool of
+    // dispatch_shards threads; on_connected, on_message and on_disconnected
+    // of a client all run, in order, on that client's shard.
+    template<typename Framing, typename Executor, typename Handler>
+    class basic_server
+      : public std::enable_shared_from_this<basic_server<Framing, Executor, Handler>>
+    {
+      public:
+        using session_t = basic_session<Framing, Executor, basic_server>;
+
+        basic_server(tcp_server_params_t& a_params, boost::asio::io_service& a_io_service, Handler a_handler)
+          : m_io_service(a_io_service)
+          , m_strand(std::make_shared<boost::asio::io_service::strand>(a_io_service))
+          , m_listener(std::make_shared<boost::asio::ip::tcp::socket>(a_io_service))
+          , m_acceptor(std::make_shared<boost::asio::ip::tcp::acceptor>(a_io_service, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::from_string(a_params.ip), a_params.port)))
+          , m_params(a_params)
+          , m_handler(std::move(a_handler))
+        {
+          if(std::is_same<Executor, sharded_executor>::value)
+            m_workers = std::make_shared<worker_pool>(a_params.dispatch_shards);
+          apply_socket_options(*m_acceptor, a_params.socket_options);
+        }
+
+        void run()
+        {
+          do_accept();
+        }
+
+        // On the strand, like the accept handler, so the acceptor is never
+        // closed under a running accept. Sessions are only shut down: each
+        // one's failing read removes it through its executor, behind the
+        // messages it has already delivered, as a peer close would.
+        void stop()
+        {
+          auto self = this->shared_from_this();
+          m_strand->post([this, self]
+          {
+            boost::system::error_code ec;
+            m_acceptor->close(ec);
+
+            std::vector<std::shared_ptr<session_t>> clients;
+            {
+              std::lock_guard<std::mutex> lock(m_clients_mutex);
+              for(auto& cl : m_clients)
+                clients.push_back(cl.second);
+            }
+            for(auto& client : clients)
+              client->shutdown();
+          });
+        }
+
+        void remove_client(const int a_client_id)
+        {
+          {
+            std::lock_guard<std::mutex> lock(m_clients_mutex);
+            const auto& found_it = m_clients.find(a_client_id);
+            if(found_it == m_clients.end())
+              return;
+            m_clients.erase(found_it);
+          }
+          m_handler.on_disconnected(a_client_id);
+        }
+
+        void on_message(const int a_client_id, const char *a_data, std::size_t a_len)
+        {
+          m_handler.on_message(a_client_id, a_data, a_len);
+        }
+
+        void on_chunk(const int a_client_id, const char *a_data, std::size_t a_len, std::uint64_t a_offset, std::uint32_t a_flags)
+        {
+          m_handler.on_chunk(a_client_id, a_data, a_len, a_offset, a_flags);
+        }
+
+        void on_writable(const int a_client_id)
+        {
+          call_on_writable(a_client_id, has_on_writable<Handler>());
+        }
+
+        void send_data(const int a_client_id, const char *a_data, std::size_t a_len, send_priority_e a_priority = send_priority_e::normal)
+        {
+          if(auto client = find_client(a_client_id))
+            client->send_data(a_data, a_len, a_priority);
+        }
+
+        void send_data_for_all(const char *a_data, std::size_t a_len, send_priority_e a_priority = send_priority_e::normal)
+        {
+          std::lock_guard<std::mutex> lock(m_clients_mutex);
+          for(auto& cl : m_clients)
+            cl.second->send_data(a_data, a_len, a_priority);
+        }
+
+        void send_encoded(const int a_client_id, std::size_t a_len, const std::function<void(char *)>& a_fill, send_priority_e a_priority = send_priority_e::normal)
+        {
+          if(auto client = find_client(a_client_id))
+            client->send_encoded(a_len, a_fill, a_priority);
+        }
+
+        tcp_lane_depths_t lane_depths(const int a_client_id)
+        {
+          if(auto client = find_client(a_client_id))
+            return client->lane_depths();
+          return tcp_lane_depths_t{};
+        }
+
+        std::size_t clients_count()
+        {
+          std::lock_guard<std::mutex> lock(m_clients_mutex);
+          return m_clients.size();
+        }
+
+        Handler& handler()
+        {
+          return m_handler;
+        }
+
+      private:
+        void call_on_writable(const int a_client_id, std::true_type)
+        {
+          m_handler.on_writable(a_client_id);
+        }
+
+        void call_on_writable(const int /*a_client_id*/, std::false_type)
+        {
+        }
+
+        std::shared_ptr<session_t> find_client(const int a_client_id)
+        {
+          std::lock_guard<std::mutex> lock(m_clients_mutex);
+          const auto& found_it = m_clients.find(a_client_id);
+          return found_it != m_clients.end() ? found_it->second : nullptr;
+        }
+
+        // The pending accept holds the server weakly, so dropping the last
+        // reference ends the accept loop; the acceptor and listener it uses
+        // stay alive until it completes. stop() closes the acceptor, which
+        // ends it too.
+        void do_accept()
+        {
+          std::weak_ptr<basic_server> weak_self = this->shared_from_this();
+          auto acceptor = m_acceptor;
+          auto listener = m_listener;
+          acceptor->async_accept(*listener, m_strand->wrap([this, weak_self, acceptor, listener](boost::system::error_code a_ec)
+          {
+            auto self = weak_self.lock();
+            if(self == nullptr)
+              return;
+
+            // stopped; a connection accepted just before is not served
+            if(!acceptor->is_open())
+            {
+              boost::system::error_code ec;
+              listener->close(ec);
+              return;
+            }
+
+            if(!a_ec)
+            {
+              int client_id = m_listener->native_handle();
+              auto new_client = std::make_shared<session_t>(*m_listener, m_io_service, *m_strand, this->shared_from_this(), m_params, m_workers);
+              {
+                std::lock_guard<std::mutex> lock(m_clients_mutex);
+                m_clients.insert(std::make_pair(client_id, new_client));
+              }
+              if(m_workers != nullptr)
+              {
+                // queued ahead of the client's first message
+                m_workers->post(static_cast<std::size_t>(client_id), [self, client_id]{
+                  self->m_handler.on_connected(client_id);
+                });
+                new_client->start();
+              }
+              else
+              {
+                new_client->start();
+                m_handler.on_connected(client_id);
+              }
+            }
+            do_accept();
+          }));
+        }
+
+      private:
+        boost::asio::io_service& m_io_service;
+        std::shared_ptr<boost::asio::io_service::strand> m_strand;
+        std::shared_ptr<boost::asio::ip::tcp::socket> m_listener;
+        std::shared_ptr<boost::asio::ip::tcp::acceptor> m_acceptor;
+        std::unordered_map<int, std::shared_ptr<session_t>> m_clients;
+        std::mutex m_clients_mutex;
+        tcp_server_params_t m_params;
+        std::shared_ptr<worker_pool> m_workers;
+        Handler m_handler;
+    };
+  } //namespace tcp
+} //namespace common
@@ -0,0 +1,308 @@
+#pragma once
+
+#include "../communications.h"
+#include "../socket_profile.h"
+#include "../token_bucket.h"
+#include "../trace.h"
+#include "executor.h"
+#include "framing.h"
+#include "send_lanes.h"
+
+namespace common
+{
+  namespace tcp
+  {
+    // Server side of one connection. Owner must provide
+    //   void on_message(const int a_client_id, const char *a_data, std::size_t a_len);
+    //   void remove_client(const int a_client_id);
+    //   void on_writable(const int a_client_id);
+    // and, with a chunked framing, instead of on_message
+    //   void on_chunk(const int a_client_id, const char *a_data, std::size_t a_len, std::uint64_t a_offset, std::uint32_t a_flags);
+    // and is held weakly. With a concrete Owner the read -> frame -> callback
+    // path is resolved at compile time; iserver works as Owner too.
+    //
+    // Reads are paced per client: frames are held back while the message
+    // token bucket is out of credit, and the next read is not issued until
+    // the byte bucket is back in credit, so a fast sender is slowed down by
+    // TCP flow control rather than dropped. At most messages_per_read frames
+    // are delivered in one go; the rest are delivered from a fresh handler
+    // so other sessions on the same thread get a turn.
+    //
+    // A frame longer than max_frame_size closes the connection.
+    //
+    // Outgoing data is copied into per-priority send_lanes and written one
+    // batch at a time, so a control message overtakes queued bulk data.
+    // Once the lanes have drained the owner's on_writable() is posted like
+    // a message.
+    template<typename Framing, typename Executor, typename Owner>
+    class basic_session final
+      : public iclient_session
+      , public std::enable_shared_from_this<basic_session<Framing, Executor, Owner>>
+    {
+      public:
+        basic_session(boost::asio::ip::tcp::socket& a_sock, boost::asio::io_service& a_io_service, boost::asio::io_service::strand& a_sync_strand, std::weak_ptr<Owner> a_owner, const tcp_server_params_t& a_params, const std::shared_ptr<worker_pool>& a_workers = nullptr)
+          : m_io_service(a_io_service)
+          , m_framing(a_params.max_frame_size)
+          , m_executor(a_io_service, a_sync_strand, a_workers, a_sock.native_handle())
+          , m_sock(std::make_shared<boost::asio::ip::tcp::socket>(std::move(a_sock)))
+          , m_timer(a_io_service)
+          , m_owner(a_owner)
+          , m_client_id(m_sock->native_handle())
+          , m_messages_per_read(a_params.messages_per_read)
+          , m_message_bucket(static_cast<double>(a_params.max_messages_per_sec), static_cast<double>(a_params.max_messages_per_sec) * a_params.rate_burst_ms / 1000)
+          , m_byte_bucket(static_cast<double>(a_params.max_bytes_per_sec), static_cast<double>(a_params.max_bytes_per_sec) * a_params.rate_burst_ms / 1000)
+          , m_send_lanes(a_params.max_write_batch_bytes)
+          , m_is_quick_ack(resolve_socket_options(a_params.socket_options).quick_ack > 0)
+        {
+          apply_socket_options(*m_sock, a_params.socket_options);
+        }
+
+        void send_message(const std::string& a_data) override
+        {
+          send_data(a_data.c_str(), a_data.length());
+        }
+
+        void send_data(const char *a_data, std::size_t a_len, send_priority_e a_priority = send_priority_e::normal) override
+        {
+          const std::uint32_t seq = next_tx_seq();
+          COMMUNICATIONS_TRACE(write_enqueue, m_client_id, m_trace_generation, seq);
+          if(m_send_lanes.push(a_priority, a_data, a_len, seq))
+            do_write();
+        }
+
+        void send_encoded(std::size_t a_len, const std::function<void(char *)>& a_fill, send_priority_e a_priority = send_priority_e::normal) override
+        {
+          const std::uint32_t seq = next_tx_seq();
+          COMMUNICATIONS_TRACE(write_enqueue, m_client_id, m_trace_generation, seq);
+          if(m_send_lanes.push_with(a_priority, a_len, seq, a_fill))
+            do_write();
+        }
+
+        tcp_lane_depths_t lane_depths() override
+        {
+          return m_send_lanes.depths();
+        }
+
+        void start() override
+        {
+          do_receive();
+        }
+
+        void shutdown() override
+        {
+          boost::system::error_code ec;
+          m_sock->shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+          m_sock->close(ec);
+          m_timer.cancel(ec);
+          m_send_lanes.close();
+        }
+
+      private:
+        void do_receive()
+        {
+          auto self = this->shared_from_this();
+          m_framing.async_read(*m_sock, m_executor.wrap([this, self](const boost::system::error_code& a_ec, std::size_t a_len)
+          {
+            if(a_ec || a_len == 0)
+            {
+              remove_client();
+              return;
+            }
+
+            COMMUNICATIONS_TRACE(read_complete, m_client_id, m_trace_generation, m_rx_seq);
+            if(m_is_quick_ack)
+              rearm_quick_ack(m_client_id);
+            m_framing.on_read(a_len);
+            m_byte_bucket.consume(static_cast<double>(a_len));
+            deliver_frames();
+          }));
+        }
+
+        void deliver_frames()
+        {
+          auto owner = m_owner.lock();
+          std::size_t budget = m_messages_per_read;
+          const char *data;
+          std::size_t len;
+          for(;;)
+          {
+            auto delay = m_message_bucket.delay();
+            if(delay.count() != 0)
+            {
+              // out of message credit; the remaining frames stay buffered
+              wait(delay, &basic_session::deliver_frames);
+              return;
+            }
+            if(!m_framing.next_frame(data, len))
+            {
+              if(!m_framing.is_oversized())
+                break;
+              // a frame over max_frame_size; drop the client
+              shutdown();
+              remove_client();
+              return;
+            }
+
+            const std::uint32_t seq = next_rx_seq();
+            COMMUNICATIONS_TRACE(frame_extracted, m_client_id, m_trace_generation, seq);
+            if(owner != nullptr)
+              deliver(owner, data, len, seq, is_chunked_framing<Framing>());
+            m_message_bucket.consume(1);
+
+            if(budget != 0 && --budget == 0)
+            {
+              // yield to the other sessions before delivering the rest
+              auto self = this->shared_from_this();
+              m_io_service.post(m_executor.wrap([this, self]
+              {
+                deliver_frames();
+              }));
+              return;
+            }
+          }
+
+          auto delay = m_byte_bucket.delay();
+          if(delay.count() != 0)
+            wait(delay, &basic_session::do_receive);
+          else
+            do_receive();
+        }
+
+        // callback_enter is recorded once the executor runs the handler, so
+        // frame -> callback enter covers the queueing
+        void deliver(const std::shared_ptr<Owner>& a_owner, const char *a_data, std::size_t a_len, std::uint32_t a_seq, std::false_type)
+        {
+          const int client_id = m_client_id;
+          const std::uint32_t generation = trace_generation();
+          m_executor.deliver(a_data, a_len, [a_owner, client_id, generation, a_seq](const char *a_msg, std::size_t a_msg_len)
+          {
+            COMMUNICATIONS_TRACE(callback_enter, client_id, generation, a_seq);
+            a_owner->on_message(client_id, a_msg, a_msg_len);
+            COMMUNICATIONS_TRACE(callback_exit, client_id, generation, a_seq);
+          });
+        }
+
+        void deliver(const std::shared_ptr<Owner>& a_owner, const char *a_data, std::size_t a_len, std::uint32_t a_seq, std::true_type)
+        {
+          const int client_id = m_client_id;
+          const std::uint32_t generation = trace_generation();
+          const chunk_t chunk = m_framing.chunk();
+          m_executor.deliver(a_data, a_len, [a_owner, client_id, generation, a_seq, chunk](const char *a_msg, std::size_t a_msg_len)
+          {
+            COMMUNICATIONS_TRACE(callback_enter, client_id, generation, a_seq);
+            a_owner->on_chunk(client_id, a_msg, a_msg_len, chunk.offset, chunk.flags);
+            COMMUNICATIONS_TRACE(callback_exit, client_id, generation, a_seq);
+          });
+        }
+
+        void wait(std::chrono::nanoseconds a_delay, void (basic_session::*a_resume)())
+        {
+          auto self = this->shared_from_this();
+          m_timer.expires_from_now(std::chrono::duration_cast<boost::asio::steady_timer::duration>(a_delay));
+          m_timer.async_wait(m_executor.wrap([this, self, a_resume](const boost::system::error_code& a_ec)
+          {
+            // cancelled by shutdown(); no read is pending to notice it
+            if(a_ec)
+              remove_client();
+            else
+              (this->*a_resume)();
+          }));
+        }
+
+        void do_write()
+        {
+          if(!m_send_lanes.next_batch(m_write_buffers))
+          {
+            if(!m_send_lanes.is_closed())
+              notify_writable();
+            return;
+          }
+
+          auto self = this->shared_from_this();
+          boost::asio::async_write(*m_sock, m_write_buffers, m_executor.wrap([this, self](const boost::system::error_code& a_ec, std::size_t /*a_len*/)
+          {
+            if(a_ec)
+              m_send_lanes.close();
+            const int client_id = m_client_id;
+            const std::uint32_t generation = trace_generation();
+            m_send_lanes.pop_batch(m_write_buffers.size(), [client_id, generation](std::uint32_t a_seq)
+            {
+              COMMUNICATIONS_TRACE(write_complete, client_id, generation, a_seq);
+            });
+            do_write();
+          }));
+        }
+
+        void notify_writable()
+        {
+          if(auto owner = m_owner.lock())
+          {
+            const int client_id = m_client_id;
+            m_executor.post_sync([owner, client_id]{
+              owner->on_writable(client_id);
+            });
+          }
+        }
+
+        // message sequence numbers and the generation only exist in
+        // tracing builds; elsewhere they are 0
+        std::uint32_t next_rx_seq()
+        {
+#ifdef COMMUNICATIONS_TRACING
+          return m_rx_seq++;
+#else
+          return 0;
+#endif
+        }
+
+        std::uint32_t next_tx_seq()
+        {
+#ifdef COMMUNICATIONS_TRACING
+          return m_tx_seq.fetch_add(1, std::memory_order_relaxed);
+#else
+          return 0;
+#endif
+        }
+
+        std::uint32_t trace_generation() const
+        {
+#ifdef COMMUNICATIONS_TRACING
+          return m_trace_generation;
+#else
+          return 0;
+#endif
+        }
+
+        void remove_client()
+        {
+          if(auto owner = m_owner.lock())
+          {
+            const int client_id = m_client_id;
+            m_executor.post_sync([owner, client_id]{
+              owner->remove_client(client_id);
+            });
+          }
+        }
+
+      private:
+        boost::asio::io_service& m_io_service;
+        Framing m_framing;
+        Executor m_executor;
+        std::shared_ptr<boost::asio::ip::tcp::socket> m_sock;
+        boost::asio::steady_timer m_timer;
+        std::weak_ptr<Owner> m_owner;
+        int m_client_id;
+        std::size_t m_messages_per_read;
+        token_bucket m_message_bucket;
+        token_bucket m_byte_bucket;
+        send_lanes m_send_lanes;
+        bool m_is_quick_ack;
+        std::vector<boost::asio::const_buffer> m_write_buffers;
+#ifdef COMMUNICATIONS_TRACING
+        const std::uint32_t m_trace_generation = trace::next_generation();
+        std::uint32_t m_rx_seq = 0;
+        std::atomic<std::uint32_t> m_tx_seq{0};
+#endif
+    };
+  } //namespace tcp
+} //namespace common
@@ -0,0 +1,221 @@
+#pragma once
+
+#include "../socket_profile.h"
+#include "framing.h"
+#include <boost/asio.hpp>
+
+// Coroutine counterpart of basic_session/basic_server, for C++20 builds
+// where asio supports co_await. Coroutine frames come from asio's
+// per-thread recycling allocator, so a steady stream of read_frame() and
+// write() calls does not hit the heap.
+#if defined(__cpp_impl_coroutine) && defined(BOOST_ASIO_HAS_CO_AWAIT)
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+namespace common
+{
+  namespace tcp
+  {
+    // One connection: co_await read_frame() for the next message and
+    // write() to send. A frame stays valid until the next read_frame().
+    // send() only appends to an output buffer, which read_frame() flushes
+    // before it waits on the socket, so replies to a burst of pipelined
+    // requests leave in one write. Reads and writes may be awaited from
+    // different coroutines of the same strand, one of each at a time. Only
+    // one write is ever on the socket: a flush() while one is in flight
+    // returns at once and the write in flight sends its bytes too. On the
+    // client side construct it from an executor and co_await connect().
+    template<typename Framing>
+    class coro_session
+    {
+      public:
+        explicit coro_session(boost::asio::ip::tcp::socket a_sock, const socket_options_t& a_options = socket_options_t(), std::size_t a_max_frame_size = 0)
+          : m_sock(std::move(a_sock))
+          , m_framing(a_max_frame_size)
+          , m_client_id(m_sock.native_handle())
+          , m_is_quick_ack(resolve_socket_options(a_options).quick_ack > 0)
+        {
+          apply_socket_options(m_sock, a_options);
+        }
+
+        explicit coro_session(boost::asio::any_io_executor a_executor, std::size_t a_max_frame_size = 0)
+          : m_sock(a_executor)
+          , m_framing(a_max_frame_size)
+          , m_client_id(-1)
+        {
+        }
+
+        coro_session(const coro_session&) = delete;
+        coro_session& operator=(const coro_session&) = delete;
+
+        boost::asio::awaitable<bool> connect(const tcp_client_params_t& a_params)
+        {
+          boost::asio::ip::tcp::endpoint ep(boost::asio::ip::address::from_string(a_params.ip), a_params.port);
+          if(!m_sock.is_open())
+          {
+            m_sock.open(ep.protocol());
+            apply_socket_options(m_sock, a_params.socket_options);
+            m_is_quick_ack = resolve_socket_options(a_params.socket_options).quick_ack > 0;
+          }
+          boost::system::error_code ec;
+          co_await m_sock.async_connect(ep, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+          if(ec)
+            co_return false;
+          m_client_id = m_sock.native_handle();
+          co_return true;
+        }
+
+        int client_id() const
+        {
+          return m_client_id;
+        }
+
+        // false once the peer has gone or sent a frame over the framing's
+        // max_frame_size
+        boost::asio::awaitable<bool> read_frame(const char *&a_data, std::size_t& a_len)
+        {
+          while(!m_framing.next_frame(a_data, a_len))
+          {
+            if(m_framing.is_oversized())
+              co_return false;
+            if(!m_output.empty() && !co_await flush())
+              co_return false;
+
+            boost::system::error_code ec;
+            std::size_t len = co_await m_framing.async_read(m_sock, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+            if(ec || len == 0)
+              co_return false;
+            if(m_is_quick_ack)
+              rearm_quick_ack(m_client_id);
+            m_framing.on_read(len);
+          }
+          co_return true;
+        }
+
+        // chunked framings only: where the last frame sits in its message
+        const chunk_t& chunk() const
+        {
+          return m_framing.chunk();
+        }
+
+        void send(const char *a_data, std::size_t a_len)
+        {
+          m_output.append(a_data, a_len);
+        }
+
+        boost::asio::awaitable<bool> flush()
+        {
+          if(m_is_writing)
+            co_return !m_is_write_failed;
+
+          m_is_writing = true;
+          boost::system::error_code ec;
+          while(!ec && !m_output.empty())
+          {
+            m_writing.swap(m_output);
+            m_output.clear();
+            co_await boost::asio::async_write(m_sock, boost::asio::buffer(m_writing), boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+            m_writing.clear();
+          }
+          m_is_writing = false;
+          m_is_write_failed = static_cast<bool>(ec);
+          co_return !ec;
+        }
+
+        boost::asio::awaitable<bool> write(const char *a_data, std::size_t a_len)
+        {
+          send(a_data, a_len);
+          co_return co_await flush();
+        }
+
+        void shutdown()
+        {
+          boost::system::error_code ec;
+          m_sock.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+          m_sock.close(ec);
+        }
+
+      private:
+        boost::asio::ip::tcp::socket m_sock;
+        Framing m_framing;
+        int m_client_id;
+        bool m_is_quick_ack = false;
+        std::string m_output;
+        std::string m_writing;
+        bool m_is_writing = false;
+        bool m_is_write_failed = false;
+    };
+
+    // Accepts connections and runs co_await a_handler(session) for each on
+    // its own strand; the session is closed when the handler returns.
+    // Handler is any callable returning boost::asio::awaitable<void>.
+    template<typename Framing, typename Handler>
+    class coro_server
+      : public std::enable_shared_from_this<coro_server<Framing, Handler>>
+    {
+      public:
+        coro_server(tcp_server_params_t& a_params, boost::asio::io_service& a_io_service, Handler a_handler)
+          : m_io_service(a_io_service)
+          , m_acceptor(a_io_service, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::from_string(a_params.ip), a_params.port))
+          , m_handler(std::move(a_handler))
+          , m_socket_options(a_params.socket_options)
+          , m_max_frame_size(a_params.max_frame_size)
+        {
+          apply_socket_options(m_acceptor, m_socket_options);
+        }
+
+        void run()
+        {
+          boost::asio::co_spawn(m_io_service, do_accept(this->shared_from_this()), boost::asio::detached);
+        }
+
+        void stop()
+        {
+          boost::system::error_code ec;
+          m_acceptor.close(ec);
+        }
+
+      private:
+        static boost::asio::awaitable<void> do_accept(std::shared_ptr<coro_server> a_self)
+        {
+          for(;;)
+          {
+            boost::system::error_code ec;
+            auto strand = boost::asio::make_strand(a_self->m_io_service);
+            boost::asio::ip::tcp::socket sock(strand);
+            co_await a_self->m_acceptor.async_accept(sock, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+            if(ec == boost::asio::error::operation_aborted)
+              co_return;
+            if(!ec)
+              boost::asio::co_spawn(strand, do_session(a_self, std::move(sock)), boost::asio::detached);
+          }
+        }
+
+        static boost::asio::awaitable<void> do_session(std::shared_ptr<coro_server> a_self, boost::asio::ip::tcp::socket a_sock)
+        {
+          coro_session<Framing> session(std::move(a_sock), a_self->m_socket_options, a_self->m_max_frame_size);
+          co_await a_self->m_handler(session);
+          session.shutdown();
+        }
+
+      private:
+        boost::asio::io_service& m_io_service;
+        boost::asio::ip::tcp::acceptor m_acceptor;
+        Handler m_handler;
+        socket_options_t m_socket_options;
+        std::size_t m_max_frame_size;
+    };
+
+    template<typename Framing, typename Handler>
+    std::shared_ptr<coro_server<Framing, Handler>> make_coro_server(tcp_server_params_t& a_params, boost::asio::io_service& a_io_service, Handler a_handler)
+    {
+      return std::make_shared<coro_server<Framing, Handler>>(a_params, a_io_service, std::move(a_handler));
+    }
+  } //namespace tcp
+} //namespace common
+
+#endif
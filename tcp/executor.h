@@ -0,0 +1,122 @@
+#pragma once
+
+#include "worker_pool.h"
+#include <boost/asio.hpp>
+#include <string>
+#include <utility>
+
+namespace common
+{
+  namespace tcp
+  {
+    // Executor policies decide where a session's completions and user
+    // callbacks run. Each session builds one from the io_service, the
+    // server-wide sync strand and worker pool (null unless the server
+    // dispatches to workers) and its client id.
+
+    // Completions run on a per-session strand; messages are copied and
+    // posted to the sync strand, so callbacks are serialized across all
+    // sessions of a server.
+    class strand_executor
+    {
+      public:
+        strand_executor(boost::asio::io_service& a_io_service, boost::asio::io_service::strand& a_sync_strand, const std::shared_ptr<worker_pool>& /*a_workers*/, int /*a_client_id*/)
+          : m_strand(a_io_service)
+          , m_sync_strand(a_sync_strand)
+        {
+        }
+
+        template<typename Handler>
+        auto wrap(Handler a_handler) -> decltype(std::declval<boost::asio::io_service::strand&>().wrap(std::move(a_handler)))
+        {
+          return m_strand.wrap(std::move(a_handler));
+        }
+
+        template<typename F>
+        void post_sync(F a_func)
+        {
+          m_sync_strand.post(std::move(a_func));
+        }
+
+        template<typename OnMessage>
+        void deliver(const char *a_data, std::size_t a_len, OnMessage a_on_message)
+        {
+          std::string cmd{a_data, a_len};
+          m_sync_strand.post([cmd, a_on_message]{
+            a_on_message(cmd.c_str(), cmd.size());
+          });
+        }
+
+      private:
+        boost::asio::io_service::strand m_strand;
+        boost::asio::io_service::strand& m_sync_strand;
+    };
+
+    // Completions and callbacks run inline on whichever io_service thread
+    // completed the read.
+    class inline_executor
+    {
+      public:
+        inline_executor(boost::asio::io_service& /*a_io_service*/, boost::asio::io_service::strand& /*a_sync_strand*/, const std::shared_ptr<worker_pool>& /*a_workers*/, int /*a_client_id*/)
+        {
+        }
+
+        template<typename Handler>
+        Handler wrap(Handler a_handler)
+        {
+          return a_handler;
+        }
+
+        template<typename F>
+        void post_sync(F a_func)
+        {
+          a_func();
+        }
+
+        template<typename OnMessage>
+        void deliver(const char *a_data, std::size_t a_len, OnMessage&& a_on_message)
+        {
+          a_on_message(a_data, a_len);
+        }
+    };
+
+    // Completions run inline; messages are copied and posted to the worker
+    // shard picked by the client id. Callbacks of one client stay in order
+    // while different clients run in parallel on up to dispatch_shards
+    // threads.
+    class sharded_executor
+    {
+      public:
+        sharded_executor(boost::asio::io_service& /*a_io_service*/, boost::asio::io_service::strand& /*a_sync_strand*/, const std::shared_ptr<worker_pool>& a_workers, int a_client_id)
+          : m_workers(a_workers)
+          , m_key(static_cast<std::size_t>(a_client_id))
+        {
+        }
+
+        template<typename Handler>
+        Handler wrap(Handler a_handler)
+        {
+          return a_handler;
+        }
+
+        template<typename F>
+        void post_sync(F a_func)
+        {
+          m_workers->post(m_key, std::move(a_func));
+        }
+
+        template<typename OnMessage>
+        void deliver(const char *a_data, std::size_t a_len, OnMessage a_on_message)
+        {
+          std::string cmd{a_data, a_len};
+          m_workers->post(m_key, [cmd, a_on_message]{
+            a_on_message(cmd.c_str(), cmd.size());
+          });
+        }
+
+      private:
+        std::shared_ptr<worker_pool> m_workers;
+        std::size_t m_key;
+    };
+  } //namespace tcp
+} //namespace common
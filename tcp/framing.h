@@ -0,0 +1,432 @@
+#pragma once
+
+#include "../communacations_types.h"
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace common
+{
+  namespace tcp
+  {
+    // Framing policies split the byte stream into messages. A policy issues
+    // one read with async_read(stream, token), which returns whatever the
+    // completion token makes of it (an awaitable with use_awaitable); once
+    // it completes, on_read(bytes) hands the data over and
+    // next_frame(data, len) returns the complete messages one at a time, so
+    // a session can stop part way and resume later. A frame points into the policy's buffers and stays
+    // valid until the next call to next_frame() or async_read(). The
+    // policies that split with async_read_some also take bytes from
+    // elsewhere through on_data(data, len), which is how shm runs the same
+    // framing over its ring records.
+    //
+    // Every policy is built with a max_frame_size, 0 for no limit. A policy
+    // that buffers a message (read_until_eol, read_some_eol and
+    // length_prefixed) stops at a frame longer than that: next_frame()
+    // stays false and is_oversized() is true from then on, or for
+    // read_until_eol the read fails, and the session closes the connection.
+    // completion_eol and chunked_eol never hold more than one read buffer.
+
+    // Reads until the last received byte is '\n'; one message per read.
+    class completion_eol_framing
+    {
+      public:
+        explicit completion_eol_framing(std::size_t /*a_max_frame_size*/ = 0)
+        {
+        }
+
+        bool is_oversized() const
+        {
+          return false;
+        }
+
+        template<typename Stream, typename Handler>
+        auto async_read(Stream& a_stream, Handler&& a_handler)
+        {
+          auto completion_condition = [this](const boost::system::error_code& a_ec, std::size_t a_len)->std::size_t
+          {
+            if(a_ec)
+              return 0;
+            if(a_len > 0)
+              return m_buffer->data()[a_len - 1] == '\n' ? 0 : 1;
+            return 1;
+          };
+          return boost::asio::async_read(a_stream, boost::asio::buffer(m_buffer->data(), BUF_LENGTH), completion_condition, std::forward<Handler>(a_handler));
+        }
+
+        void on_read(std::size_t a_len)
+        {
+          m_len = a_len;
+        }
+
+        bool next_frame(const char *&a_data, std::size_t& a_len)
+        {
+          if(m_len == 0)
+            return false;
+          a_data = m_buffer->data();
+          a_len = m_len - 1;
+          m_len = 0;
+          return true;
+        }
+
+      private:
+        pbuf_t m_buffer = std::make_unique<buf_t>();
+        std::size_t m_len = 0;
+    };
+
+    // async_read_until '\n' into a streambuf; one message per read.
+    class read_until_eol_framing
+    {
+      public:
+        explicit read_until_eol_framing(std::size_t a_max_frame_size = 0)
+          : m_streambuf(a_max_frame_size != 0 ? a_max_frame_size + 1 : std::numeric_limits<std::size_t>::max())
+        {
+        }
+
+        // a line over the limit fails the read with error::not_found
+        bool is_oversized() const
+        {
+          return false;
+        }
+
+        template<typename Stream, typename Handler>
+        auto async_read(Stream& a_stream, Handler&& a_handler)
+        {
+          release();
+          return boost::asio::async_read_until(a_stream, m_streambuf, '\n', std::forward<Handler>(a_handler));
+        }
+
+        void on_read(std::size_t a_len)
+        {
+          // a_len runs up to and including the delimiter
+          m_len = a_len;
+        }
+
+        bool next_frame(const char *&a_data, std::size_t& a_len)
+        {
+          release();
+          if(m_len == 0)
+            return false;
+          a_data = boost::asio::buffer_cast<const char *>(m_streambuf.data());
+          a_len = m_len - 1;
+          m_used = m_len;
+          m_len = 0;
+          return true;
+        }
+
+      private:
+        void release()
+        {
+          m_streambuf.consume(m_used);
+          m_used = 0;
+        }
+
+      private:
+        boost::asio::streambuf m_streambuf;
+        std::size_t m_len = 0;
+        std::size_t m_used = 0;
+    };
+
+    // async_read_some and split on '\n'. Complete lines are handed out
+    // straight from the read buffer; only a partial tail is copied aside.
+    class read_some_eol_framing
+    {
+      public:
+        explicit read_some_eol_framing(std::size_t a_max_frame_size = 0)
+          : m_max_frame_size(a_max_frame_size != 0 ? a_max_frame_size : std::numeric_limits<std::size_t>::max())
+        {
+        }
+
+        bool is_oversized() const
+        {
+          return m_is_oversized;
+        }
+
+        template<typename Stream, typename Handler>
+        auto async_read(Stream& a_stream, Handler&& a_handler)
+        {
+          return a_stream.async_read_some(boost::asio::buffer(m_buffer->data(), BUF_LENGTH), std::forward<Handler>(a_handler));
+        }
+
+        void on_read(std::size_t a_len)
+        {
+          on_data(m_buffer->data(), a_len);
+        }
+
+        // bytes read elsewhere; they stay in use until next_frame() is false
+        void on_data(const char *a_data, std::size_t a_len)
+        {
+          m_pos = a_data;
+          m_end = a_data + a_len;
+        }
+
+        bool next_frame(const char *&a_data, std::size_t& a_len)
+        {
+          if(m_is_partial_delivered)
+          {
+            m_partial.clear();
+            m_is_partial_delivered = false;
+          }
+
+          if(m_pos == m_end || m_is_oversized)
+            return false;
+
+          const char *eol = static_cast<const char *>(memchr(m_pos, '\n', m_end - m_pos));
+          if(m_partial.size() + ((eol != nullptr ? eol : m_end) - m_pos) > m_max_frame_size)
+          {
+            m_is_oversized = true;
+            return false;
+          }
+
+          if(eol == nullptr)
+          {
+            m_partial.append(m_pos, m_end);
+            m_pos = m_end;
+            return false;
+          }
+
+          if(m_partial.empty())
+          {
+            a_data = m_pos;
+            a_len = eol - m_pos;
+          }
+          else
+          {
+            m_partial.append(m_pos, eol);
+            a_data = m_partial.data();
+            a_len = m_partial.size();
+            m_is_partial_delivered = true;
+          }
+          m_pos = eol + 1;
+          return true;
+        }
+
+      private:
+        pbuf_t m_buffer = std::make_unique<buf_t>();
+        const char *m_pos = nullptr;
+        const char *m_end = nullptr;
+        std::string m_partial;
+        bool m_is_partial_delivered = false;
+        std::size_t m_max_frame_size;
+        bool m_is_oversized = false;
+    };
+
+    const std::size_t LENGTH_PREFIX_SIZE = 4;
+
+    // Binary frames behind a 32-bit little-endian length that counts the
+    // whole frame, prefix included. Frames are handed out with their prefix
+    // so a codec sees the same bytes the sender encoded; complete frames
+    // come straight from the read buffer and only one straddling two reads
+    // is copied aside. A length below the prefix size is taken as an empty
+    // frame.
+    class length_prefixed_framing
+    {
+      public:
+        explicit length_prefixed_framing(std::size_t a_max_frame_size = 0)
+          : m_max_frame_size(a_max_frame_size != 0 ? a_max_frame_size : std::numeric_limits<std::size_t>::max())
+        {
+        }
+
+        bool is_oversized() const
+        {
+          return m_is_oversized;
+        }
+
+        template<typename Stream, typename Handler>
+        auto async_read(Stream& a_stream, Handler&& a_handler)
+        {
+          return a_stream.async_read_some(boost::asio::buffer(m_buffer->data(), BUF_LENGTH), std::forward<Handler>(a_handler));
+        }
+
+        void on_read(std::size_t a_len)
+        {
+          on_data(m_buffer->data(), a_len);
+        }
+
+        // bytes read elsewhere; they stay in use until next_frame() is false
+        void on_data(const char *a_data, std::size_t a_len)
+        {
+          m_pos = a_data;
+          m_end = a_data + a_len;
+        }
+
+        bool next_frame(const char *&a_data, std::size_t& a_len)
+        {
+          if(m_is_partial_delivered)
+          {
+            m_partial.clear();
+            m_is_partial_delivered = false;
+          }
+
+          if(m_is_oversized)
+            return false;
+
+          if(!m_partial.empty())
+          {
+            if(!fill_partial(LENGTH_PREFIX_SIZE))
+              return false;
+            if(is_too_long(m_partial.data()) || !fill_partial(frame_length(m_partial.data())))
+              return false;
+            a_data = m_partial.data();
+            a_len = m_partial.size();
+            m_is_partial_delivered = true;
+            return true;
+          }
+
+          std::size_t available = m_end - m_pos;
+          if(available == 0)
+            return false;
+          if(available >= LENGTH_PREFIX_SIZE && is_too_long(m_pos))
+            return false;
+          if(available < LENGTH_PREFIX_SIZE || available < frame_length(m_pos))
+          {
+            m_partial.assign(m_pos, m_end);
+            m_pos = m_end;
+            return false;
+          }
+
+          a_data = m_pos;
+          a_len = frame_length(m_pos);
+          m_pos += a_len;
+          return true;
+        }
+
+      private:
+        static std::size_t frame_length(const char *a_prefix)
+        {
+          std::uint32_t len;
+          memcpy(&len, a_prefix, sizeof(len));
+          return len < LENGTH_PREFIX_SIZE ? LENGTH_PREFIX_SIZE : len;
+        }
+
+        bool is_too_long(const char *a_prefix)
+        {
+          m_is_oversized = frame_length(a_prefix) > m_max_frame_size;
+          return m_is_oversized;
+        }
+
+        // tops m_partial up to a_size bytes from the read buffer
+        bool fill_partial(std::size_t a_size)
+        {
+          if(m_partial.size() < a_size)
+          {
+            std::size_t take = std::min<std::size_t>(a_size - m_partial.size(), m_end - m_pos);
+            m_partial.append(m_pos, take);
+            m_pos += take;
+          }
+          return m_partial.size() >= a_size;
+        }
+
+      private:
+        pbuf_t m_buffer = std::make_unique<buf_t>();
+        const char *m_pos = nullptr;
+        const char *m_end = nullptr;
+        std::string m_partial;
+        bool m_is_partial_delivered = false;
+        std::size_t m_max_frame_size;
+        bool m_is_oversized = false;
+    };
+
+    struct chunk_t
+    {
+      std::uint64_t offset = 0;
+      std::uint32_t flags = 0;
+    };
+
+    // Lines of any length, handed out piece by piece as they arrive rather
+    // than buffered whole: every stretch of a line found in one read is a
+    // frame of its own, and chunk() tells where the last one sits in its
+    // line (offset) and whether it begins and/or ends it. The trailing
+    // '\n' is not part of the line, so a line whose data ended with the
+    // previous read is closed by an empty CHUNK_END chunk. Memory use is
+    // the read buffer alone, whatever the line length.
+    class chunked_eol_framing
+    {
+      public:
+        explicit chunked_eol_framing(std::size_t /*a_max_frame_size*/ = 0)
+        {
+        }
+
+        bool is_oversized() const
+        {
+          return false;
+        }
+
+        template<typename Stream, typename Handler>
+        auto async_read(Stream& a_stream, Handler&& a_handler)
+        {
+          return a_stream.async_read_some(boost::asio::buffer(m_buffer->data(), BUF_LENGTH), std::forward<Handler>(a_handler));
+        }
+
+        void on_read(std::size_t a_len)
+        {
+          on_data(m_buffer->data(), a_len);
+        }
+
+        // bytes read elsewhere; they stay in use until next_frame() is false
+        void on_data(const char *a_data, std::size_t a_len)
+        {
+          m_pos = a_data;
+          m_end = a_data + a_len;
+        }
+
+        bool next_frame(const char *&a_data, std::size_t& a_len)
+        {
+          if(m_pos == m_end)
+            return false;
+
+          const char *eol = static_cast<const char *>(memchr(m_pos, '\n', m_end - m_pos));
+          a_data = m_pos;
+          a_len = (eol != nullptr ? eol : m_end) - m_pos;
+          m_chunk.offset = m_offset;
+          m_chunk.flags = m_is_in_line ? 0 : CHUNK_BEGIN;
+          if(eol != nullptr)
+          {
+            m_chunk.flags |= CHUNK_END;
+            m_is_in_line = false;
+            m_offset = 0;
+            m_pos = eol + 1;
+          }
+          else
+          {
+            m_is_in_line = true;
+            m_offset += a_len;
+            m_pos = m_end;
+          }
+          return true;
+        }
+
+        const chunk_t& chunk() const
+        {
+          return m_chunk;
+        }
+
+      private:
+        pbuf_t m_buffer = std::make_unique<buf_t>();
+        const char *m_pos = nullptr;
+        const char *m_end = nullptr;
+        chunk_t m_chunk;
+        std::uint64_t m_offset = 0;
+        bool m_is_in_line = false;
+    };
+
+    // Framings whose frames are pieces of a message, reported through
+    // chunk() and on_chunk() instead of on_message().
+    template<typename Framing>
+    struct is_chunked_framing
+      : std::false_type
+    {
+    };
+
+    template<>
+    struct is_chunked_framing<chunked_eol_framing>
+      : std::true_type
+    {
+    };
+  } //namespace tcp
+} //namespace common
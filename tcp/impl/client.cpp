@@ -1,6 +1,12 @@
 #include "../../communications.h"
+#include "../../socket_profile.h"
+#include "../framing.h"
+#include "../request_table.h"
+#include "../send_lanes.h"
+#include <atomic>
 #include <functional>
 #include <iostream>
+#include <limits>
 
 namespace common
 {
@@ -16,29 +22,52 @@ namespace common
         void set_on_connected(std::function<void()> a_on_connected) override;
         void set_on_disconnected(std::function<void()> a_on_disconnected) override;
         void set_on_message(std::function<void(const std::string&)> a_on_message) override;
+        void set_on_chunk(std::function<void(const char *, std::size_t, std::uint64_t, std::uint32_t)> a_on_chunk) override;
+        bool request(const std::string& a_payload, std::function<void(request_status_e, const std::string&)> a_on_response, std::chrono::milliseconds a_timeout) override;
 
       private:
+        // outbound queue of one connection; replaced on every connect so a
+        // write still failing on the old one cannot touch the new
+        struct writer_t
+        {
+          send_lanes lanes{65536};
+          std::vector<boost::asio::const_buffer> buffers;
+        };
+
         void do_connect() override;
+        void do_write(const std::shared_ptr<writer_t>& a_writer);
+        void reconnect();
+        void drop_oversized();
+        void on_frame(const char *a_data, std::size_t a_len);
+        void on_read();
         void init_read_function();
         void do_receive_completion_eol();
         void do_receive_read_until_eol();
         void do_receive_async_read_some_eol();
+        void do_receive_length_prefixed();
+        void do_receive_chunked_eol();
 
       private:
         boost::asio::io_service& m_io_service;
         std::shared_ptr<boost::asio::io_service::strand> m_strand;
         std::shared_ptr<boost::asio::ip::tcp::endpoint> m_ep;
         std::shared_ptr<boost::asio::ip::tcp::socket> m_sock;
-        bool m_is_connected;
+        std::atomic<bool> m_is_connected;
+        std::shared_ptr<writer_t> m_writer;
         pbuf_t m_buffer;
-        std::shared_ptr<boost::asio::streambuf> m_streambuf = std::make_shared<boost::asio::streambuf>();
+        std::shared_ptr<boost::asio::streambuf> m_streambuf;
         std::string m_buffer_str;
+        length_prefixed_framing m_length_prefixed_framing;
+        chunked_eol_framing m_chunked_eol_framing;
         std::shared_ptr<tcp_client_params_t> m_params;
+        request_table m_requests;
+        bool m_is_quick_ack;
 
         std::function<void()> m_do_receive_func;
         std::function<void()> m_on_connected_func;
         std::function<void()> m_on_disconnected_func;
         std::function<void(const std::string&)> m_on_message_func;
+        std::function<void(const char *, std::size_t, std::uint64_t, std::uint32_t)> m_on_chunk_func;
     };
 
     client::client(tcp_client_params_t& a_params, boost::asio::io_service& a_io_service)
@@ -48,7 +77,11 @@ namespace common
      , m_sock(std::make_shared<boost::asio::ip::tcp::socket>(a_io_service))
      , m_is_connected(false)
      , m_buffer(std::make_unique<buf_t>())
+     , m_streambuf(std::make_shared<boost::asio::streambuf>(a_params.max_frame_size != 0 ? a_params.max_frame_size + 1 : std::numeric_limits<std::size_t>::max()))
+     , m_length_prefixed_framing(a_params.max_frame_size)
      , m_params(std::make_shared<tcp_client_params_t>(a_params))
+     , m_requests(a_params.correlation, a_params.max_in_flight, a_io_service, a_params.use_strand ? m_strand : nullptr)
+     , m_is_quick_ack(resolve_socket_options(a_params.socket_options).quick_ack > 0)
     {
       init_read_function();
     }
@@ -60,14 +93,9 @@ namespace common
 
     void client::send_message(const std::string& a_data)
     {
-      if(m_is_connected)
-      {
-        auto async_write_handler = [](const boost::system::error_code& /*err*/, size_t /*bytes*/)
-        {
-        };
-      
-        m_sock->async_write_some(boost::asio::buffer(a_data.c_str(), a_data.length()), m_strand->wrap(async_write_handler));
-      }
+      auto writer = std::atomic_load(&m_writer);
+      if(m_is_connected && writer != nullptr && writer->lanes.push(send_priority_e::normal, a_data.c_str(), a_data.length(), 0))
+        do_write(writer);
     }
 
     void client::set_on_connected(std::function<void()> a_on_connected)
@@ -85,12 +113,38 @@ namespace common
       m_on_message_func = a_on_message;
     }
 
+    void client::set_on_chunk(std::function<void(const char *, std::size_t, std::uint64_t, std::uint32_t)> a_on_chunk)
+    {
+      m_on_chunk_func = a_on_chunk;
+    }
+
+    bool client::request(const std::string& a_payload, std::function<void(request_status_e, const std::string&)> a_on_response, std::chrono::milliseconds a_timeout)
+    {
+      // the id is raw binary; a '\n' byte in it would split an eol frame
+      if(!m_is_connected || m_params->do_read_type != read_func_type_e::length_prefixed)
+        return false;
+
+      std::string frame = a_payload;
+      if(!m_requests.add(frame, std::move(a_on_response), a_timeout))
+        return false;
+      send_message(frame);
+      return true;
+    }
+
     void client::do_connect()
     {
+      // set before connecting, so the buffer sizes count in the SYN
+      if(!m_sock->is_open())
+      {
+        m_sock->open(m_ep->protocol());
+        apply_socket_options(*m_sock, m_params->socket_options);
+      }
+
       m_sock->async_connect(*m_ep, m_strand->wrap([this](const boost::system::error_code& a_ec)
       {
         if(!a_ec)
         {
+          std::atomic_store(&m_writer, std::make_shared<writer_t>());
           m_is_connected = true;
           m_sock->set_option(boost::asio::ip::tcp::socket::reuse_address(true));
 
@@ -110,6 +164,60 @@ namespace common
       }));
     }
 
+    void client::do_write(const std::shared_ptr<writer_t>& a_writer)
+    {
+      if(!a_writer->lanes.next_batch(a_writer->buffers))
+        return;
+
+      boost::asio::async_write(*m_sock, a_writer->buffers, m_strand->wrap([this, a_writer](const boost::system::error_code& a_ec, std::size_t /*a_len*/)
+      {
+        if(a_ec)
+          a_writer->lanes.close();
+        a_writer->lanes.pop_batch(a_writer->buffers.size(), [](std::uint32_t /*a_seq*/)
+        {
+        });
+        do_write(a_writer);
+      }));
+    }
+
+    void client::reconnect()
+    {
+      m_is_connected = false;
+      if(auto writer = std::atomic_load(&m_writer))
+        writer->lanes.close();
+      m_requests.fail_all(request_status_e::disconnected);
+      do_connect();
+    }
+
+    // the server sent a frame over max_frame_size: drop what was buffered
+    // and start over on a fresh connection
+    void client::drop_oversized()
+    {
+      boost::system::error_code ec;
+      m_sock->close(ec);
+      m_buffer_str.clear();
+      m_streambuf = std::make_shared<boost::asio::streambuf>(m_streambuf->max_size());
+      m_length_prefixed_framing = length_prefixed_framing(m_params->max_frame_size);
+      reconnect();
+    }
+
+    // a response to an outstanding request() goes to its callback, anything
+    // else to on_message
+    void client::on_frame(const char *a_data, std::size_t a_len)
+    {
+      if(m_requests.complete(a_data, a_len))
+        return;
+
+      if(m_on_message_func != nullptr)
+        m_on_message_func({a_data, a_len});
+    }
+
+    void client::on_read()
+    {
+      if(m_is_quick_ack)
+        rearm_quick_ack(m_sock->native_handle());
+    }
+
     void client::init_read_function()
     {
       switch (m_params->do_read_type)
@@ -123,6 +231,12 @@ namespace common
         case read_func_type_e::async_read_some_eol:
           m_do_receive_func = std::bind(&client::do_receive_async_read_some_eol, this);
           break;
+        case read_func_type_e::length_prefixed:
+          m_do_receive_func = std::bind(&client::do_receive_length_prefixed, this);
+          break;
+        case read_func_type_e::chunked_eol:
+          m_do_receive_func = std::bind(&client::do_receive_chunked_eol, this);
+          break;
         default:
           m_do_receive_func = std::bind(&client::do_receive_async_read_some_eol, this);
           break;
@@ -155,16 +269,12 @@ namespace common
 
         if (!a_ec)
         {
-          if(m_on_message_func != nullptr)
-            m_on_message_func({m_buffer->data(), a_len});
-
+          on_read();
+          on_frame(m_buffer->data(), a_len);
           do_receive_completion_eol();
         }
         else
-        {
-          m_is_connected = false;
-          do_connect();
-        }
+          reconnect();
       };
 
       if(m_params->use_strand)
@@ -185,20 +295,19 @@ namespace common
 
         if (!a_ec)
         {
+          on_read();
           std::istream is(m_streambuf.get());
           std::string cmd;
           std::getline(is, cmd);
 
-          if(m_on_message_func != nullptr)
-            m_on_message_func(cmd);
+          on_frame(cmd.data(), cmd.size());
 
           do_receive_read_until_eol();
         }
+        else if(a_ec == boost::asio::error::not_found)
+          drop_oversized();
         else
-        {
-          m_is_connected = false;
-          do_connect();
-        }
+          reconnect();
       };
       if(m_params->use_strand)
         boost::asio::async_read_until(*m_sock, *m_streambuf, '\n', m_strand->wrap(async_read_handler));
@@ -219,6 +328,7 @@ namespace common
 
         if (!a_ec)
         {
+          on_read();
           m_buffer_str += {m_buffer->data(), a_len};
 
           while(true)
@@ -227,20 +337,21 @@ namespace common
             if (term_pos != std::string::npos)
             {
               std::string cmd(m_buffer_str.begin(), m_buffer_str.begin() + term_pos);
-              if (m_on_message_func != nullptr)
-                m_on_message_func({m_buffer->data(), a_len});
+              on_frame(cmd.data(), cmd.size());
               m_buffer_str.erase(m_buffer_str.begin(), m_buffer_str.begin() + term_pos + 1);
             }
             else
               break;
           }
+          if(m_params->max_frame_size != 0 && m_buffer_str.size() > m_params->max_frame_size)
+          {
+            drop_oversized();
+            return;
+          }
           do_receive_async_read_some_eol();
         }
         else
-        {
-          m_is_connected = false;
-          do_connect();
-        }
+          reconnect();
       };
 
       if(m_params->use_strand)
@@ -248,6 +359,75 @@ namespace common
       else
         m_sock->async_read_some(boost::asio::buffer(m_buffer->data(), BUF_LENGTH), async_read_handler);
     }
+
+    void client::do_receive_length_prefixed()
+    {
+      auto async_read_handler = [this](const boost::system::error_code& a_ec, std::size_t a_len)
+      {
+        if(a_len == 0)
+        {
+          if(m_on_disconnected_func != nullptr)
+            m_on_disconnected_func();
+        }
+
+        if (!a_ec)
+        {
+          on_read();
+          m_length_prefixed_framing.on_read(a_len);
+          const char *data;
+          std::size_t len;
+          while(m_length_prefixed_framing.next_frame(data, len))
+            on_frame(data, len);
+          if(m_length_prefixed_framing.is_oversized())
+          {
+            drop_oversized();
+            return;
+          }
+          do_receive_length_prefixed();
+        }
+        else
+          reconnect();
+      };
+
+      if(m_params->use_strand)
+        m_length_prefixed_framing.async_read(*m_sock, m_strand->wrap(async_read_handler));
+      else
+        m_length_prefixed_framing.async_read(*m_sock, async_read_handler);
+    }
+
+    void client::do_receive_chunked_eol()
+    {
+      auto async_read_handler = [this](const boost::system::error_code& a_ec, std::size_t a_len)
+      {
+        if(a_len == 0)
+        {
+          if(m_on_disconnected_func != nullptr)
+            m_on_disconnected_func();
+        }
+
+        if (!a_ec)
+        {
+          on_read();
+          m_chunked_eol_framing.on_read(a_len);
+          const char *data;
+          std::size_t len;
+          while(m_chunked_eol_framing.next_frame(data, len))
+          {
+            const chunk_t& chunk = m_chunked_eol_framing.chunk();
+            if (m_on_chunk_func != nullptr)
+              m_on_chunk_func(data, len, chunk.offset, chunk.flags);
+          }
+          do_receive_chunked_eol();
+        }
+        else
+          reconnect();
+      };
+
+      if(m_params->use_strand)
+        m_chunked_eol_framing.async_read(*m_sock, m_strand->wrap(async_read_handler));
+      else
+        m_chunked_eol_framing.async_read(*m_sock, async_read_handler);
+    }
   } //namespace tcp
 } //namespace common
 
@@ -1,146 +1,232 @@
-#include "../../communications.h"
-#include <unordered_map>
-#include <iostream>
+#include "../basic_server.h"
 
 namespace common
 {
   namespace tcp
   {
-    class server
+    // iserver on top of basic_server; the handler forwards to the virtual
+    // callbacks, which call the std::function set by the user. Sessions and
+    // posted handlers keep basic_server alive after the iserver::ref is
+    // dropped, so the handler holds the wrapper weakly and drops what
+    // arrives once it has gone.
+    template<typename Framing, typename Executor>
+    class server final
      : public iserver
-     , public std::enable_shared_from_this<iserver>
+     , public std::enable_shared_from_this<server<Framing, Executor>>
     {
       public:
-        server(tcp_server_params_t& a_params, boost::asio::io_service& a_io_service);
+        static iserver::ref create(tcp_server_params_t& a_params, boost::asio::io_service& a_io_service);
         void run() override;
+        void stop() override;
         void remove_client(const int a_client_id) override;
         void set_on_connected(std::function<void(const int)> a_on_connected) override;
         void set_on_disconnected(std::function<void(const int)> a_on_disconnected) override;
         void set_on_message(std::function<void(const int, const char *, std::size_t)> a_on_message) override;
+        void set_on_chunk(std::function<void(const int, const char *, std::size_t, std::uint64_t, std::uint32_t)> a_on_chunk) override;
+        void set_on_writable(std::function<void(const int)> a_on_writable) override;
         void on_connected(const int a_client_id) override;
         void on_disconnected(const int a_client_id) override;
         void on_message(const int a_client_id, const char *a_data, std::size_t a_len) override;
+        void on_chunk(const int a_client_id, const char *a_data, std::size_t a_len, std::uint64_t a_offset, std::uint32_t a_flags) override;
+        void on_writable(const int a_client_id) override;
         void send_message(const int a_client_id, const std::string &a_message) override;
-        void send_data(const int a_client_id, const char *a_data, std::size_t a_len) override;
-        void send_data_for_all(const char *a_data, std::size_t a_len) override;
+        void send_data(const int a_client_id, const char *a_data, std::size_t a_len, send_priority_e a_priority = send_priority_e::normal) override;
+        void send_data_for_all(const char *a_data, std::size_t a_len, send_priority_e a_priority = send_priority_e::normal) override;
+        void send_encoded(const int a_client_id, std::size_t a_len, const std::function<void(char *)>& a_fill, send_priority_e a_priority = send_priority_e::normal) override;
         std::size_t clients_count() override;
+        tcp_lane_depths_t lane_depths(const int a_client_id) override;
 
       private:
         void do_accept() override;
 
       private:
-        boost::asio::io_service& m_io_service;
-        std::shared_ptr<boost::asio::io_service::strand> m_strand;
-        std::shared_ptr<boost::asio::ip::tcp::socket> m_listener;
-        std::shared_ptr<boost::asio::ip::tcp::acceptor> m_acceptor;
-        std::unordered_map<int, iclient_session::ref> m_clients;
-        tcp_server_params_t& m_params;
+        struct forward_handler
+        {
+          std::weak_ptr<server> m_server;
+
+          void on_connected(const int a_client_id)
+          {
+            if(auto owner = m_server.lock())
+              owner->on_connected(a_client_id);
+          }
+
+          void on_disconnected(const int a_client_id)
+          {
+            if(auto owner = m_server.lock())
+              owner->on_disconnected(a_client_id);
+          }
+
+          void on_message(const int a_client_id, const char *a_data, std::size_t a_len)
+          {
+            if(auto owner = m_server.lock())
+              owner->on_message(a_client_id, a_data, a_len);
+          }
+
+          void on_chunk(const int a_client_id, const char *a_data, std::size_t a_len, std::uint64_t a_offset, std::uint32_t a_flags)
+          {
+            if(auto owner = m_server.lock())
+              owner->on_chunk(a_client_id, a_data, a_len, a_offset, a_flags);
+          }
+
+          void on_writable(const int a_client_id)
+          {
+            if(auto owner = m_server.lock())
+              owner->on_writable(a_client_id);
+          }
+        };
+
+        std::shared_ptr<basic_server<Framing, Executor, forward_handler>> m_impl;
 
         std::function<void(const int)> m_on_connected_func;
         std::function<void(const int)> m_on_disconnected_func;
         std::function<void(const int, const char *, std::size_t)> m_on_message_func;
+        std::function<void(const int, const char *, std::size_t, std::uint64_t, std::uint32_t)> m_on_chunk_func;
+        std::function<void(const int)> m_on_writable_func;
     };
 
-    server::server(tcp_server_params_t& a_params, boost::asio::io_service& a_io_service)
-     : m_io_service(a_io_service)
-     , m_strand(std::make_shared<boost::asio::io_service::strand>(a_io_service))
-     , m_listener(std::make_shared<boost::asio::ip::tcp::socket>(a_io_service))
-     , m_acceptor(std::make_shared<boost::asio::ip::tcp::acceptor>(a_io_service, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::from_string(a_params.ip), a_params.port)))
-     , m_params(a_params)
+    // the weak reference only exists once the wrapper is owned
+    template<typename Framing, typename Executor>
+    iserver::ref server<Framing, Executor>::create(tcp_server_params_t& a_params, boost::asio::io_service& a_io_service)
     {
+      auto wrapper = std::make_shared<server>();
+      wrapper->m_impl = std::make_shared<basic_server<Framing, Executor, forward_handler>>(a_params, a_io_service, forward_handler{wrapper});
+      return wrapper;
     }
 
-    void server::run()
+    template<typename Framing, typename Executor>
+    void server<Framing, Executor>::run()
     {
       do_accept();
     }
 
-    void server::remove_client(const int a_client_id)
+    template<typename Framing, typename Executor>
+    void server<Framing, Executor>::stop()
     {
-      const auto& found_it = m_clients.find(a_client_id);
-      if(found_it != m_clients.end())
-      {
-        //std::cout << "client removed" << std::endl;
-        //found_it->second->shutdown();
-        m_clients.erase(found_it);
-        on_disconnected(a_client_id);
-      }
+      m_impl->stop();
+    }
+
+    template<typename Framing, typename Executor>
+    void server<Framing, Executor>::remove_client(const int a_client_id)
+    {
+      m_impl->remove_client(a_client_id);
     }
 
-    void server::set_on_connected(std::function<void(const int)> a_on_connected)
+    template<typename Framing, typename Executor>
+    void server<Framing, Executor>::set_on_connected(std::function<void(const int)> a_on_connected)
     {
       m_on_connected_func = a_on_connected;
     }
 
-    void server::set_on_disconnected(std::function<void(const int)> a_on_disconnected)
+    template<typename Framing, typename Executor>
+    void server<Framing, Executor>::set_on_disconnected(std::function<void(const int)> a_on_disconnected)
     {
       m_on_disconnected_func = a_on_disconnected;
     }
 
-    void server::set_on_message(std::function<void(const int, const char *, std::size_t)> a_on_message)
+    template<typename Framing, typename Executor>
+    void server<Framing, Executor>::set_on_message(std::function<void(const int, const char *, std::size_t)> a_on_message)
     {
       m_on_message_func = a_on_message;
     }
 
-    void server::on_connected(const int a_client_id)
+    template<typename Framing, typename Executor>
+    void server<Framing, Executor>::set_on_chunk(std::function<void(const int, const char *, std::size_t, std::uint64_t, std::uint32_t)> a_on_chunk)
+    {
+      m_on_chunk_func = a_on_chunk;
+    }
+
+    template<typename Framing, typename Executor>
+    void server<Framing, Executor>::set_on_writable(std::function<void(const int)> a_on_writable)
+    {
+      m_on_writable_func = a_on_writable;
+    }
+
+    template<typename Framing, typename Executor>
+    void server<Framing, Executor>::on_connected(const int a_client_id)
     {
       if(m_on_connected_func != nullptr)
         m_on_connected_func(a_client_id);
     }
 
-    void server::on_disconnected(const int a_client_id)
+    template<typename Framing, typename Executor>
+    void server<Framing, Executor>::on_disconnected(const int a_client_id)
     {
       if(m_on_disconnected_func != nullptr)
         m_on_disconnected_func(a_client_id);
     }
-    
-    void server::on_message(const int a_client_id, const char *a_data, std::size_t a_len)
+
+    template<typename Framing, typename Executor>
+    void server<Framing, Executor>::on_message(const int a_client_id, const char *a_data, std::size_t a_len)
     {
       if(m_on_message_func != nullptr)
         m_on_message_func(a_client_id, a_data, a_len);
     }
 
-    void server::send_message(const int a_client_id, const std::string &a_message)
+    template<typename Framing, typename Executor>
+    void server<Framing, Executor>::on_chunk(const int a_client_id, const char *a_data, std::size_t a_len, std::uint64_t a_offset, std::uint32_t a_flags)
     {
-      const auto& found_it = m_clients.find(a_client_id);
-      if(found_it != m_clients.end())
-        found_it->second->send_message(a_message);
+      if(m_on_chunk_func != nullptr)
+        m_on_chunk_func(a_client_id, a_data, a_len, a_offset, a_flags);
     }
 
-    void server::send_data(const int a_client_id, const char *a_data, std::size_t a_len)
+    template<typename Framing, typename Executor>
+    void server<Framing, Executor>::on_writable(const int a_client_id)
     {
-      const auto& found_it = m_clients.find(a_client_id);
-      if(found_it != m_clients.end())
-        found_it->second->send_data(a_data, a_len);
+      if(m_on_writable_func != nullptr)
+        m_on_writable_func(a_client_id);
     }
 
-    void server::send_data_for_all(const char *a_data, std::size_t a_len)
+    template<typename Framing, typename Executor>
+    void server<Framing, Executor>::send_message(const int a_client_id, const std::string &a_message)
     {
-      for(auto& cl : m_clients)
-        cl.second->send_data(a_data, a_len);
+      m_impl->send_data(a_client_id, a_message.c_str(), a_message.size());
     }
 
-    std::size_t server::clients_count()
+    template<typename Framing, typename Executor>
+    void server<Framing, Executor>::send_data(const int a_client_id, const char *a_data, std::size_t a_len, send_priority_e a_priority)
     {
-      return m_clients.size();
+      m_impl->send_data(a_client_id, a_data, a_len, a_priority);
     }
 
-    void server::do_accept()
+    template<typename Framing, typename Executor>
+    void server<Framing, Executor>::send_data_for_all(const char *a_data, std::size_t a_len, send_priority_e a_priority)
     {
-      m_acceptor->async_accept(*m_listener, [this](boost::system::error_code a_ec)
-      {
-        if(!a_ec)
-        {
-          int client_id = m_listener->native_handle();
-          auto new_client = common::tcp::create_client_session(*m_listener, m_io_service, *m_strand, shared_from_this(), m_params);
-          m_clients.insert(std::make_pair(client_id, new_client));
-          new_client->start();
-          on_connected(client_id);
-        }
-        do_accept();
-      });
+      m_impl->send_data_for_all(a_data, a_len, a_priority);
     }
 
+    template<typename Framing, typename Executor>
+    void server<Framing, Executor>::send_encoded(const int a_client_id, std::size_t a_len, const std::function<void(char *)>& a_fill, send_priority_e a_priority)
+    {
+      m_impl->send_encoded(a_client_id, a_len, a_fill, a_priority);
+    }
+
+    template<typename Framing, typename Executor>
+    std::size_t server<Framing, Executor>::clients_count()
+    {
+      return m_impl->clients_count();
+    }
+
+    template<typename Framing, typename Executor>
+    tcp_lane_depths_t server<Framing, Executor>::lane_depths(const int a_client_id)
+    {
+      return m_impl->lane_depths(a_client_id);
+    }
+
+    template<typename Framing, typename Executor>
+    void server<Framing, Executor>::do_accept()
+    {
+      m_impl->run();
+    }
+
+    template<typename Framing>
+    iserver::ref make_server(tcp_server_params_t& a_params, boost::asio::io_service& a_io_service)
+    {
+      if(a_params.dispatch_shards > 0)
+        return server<Framing, sharded_executor>::create(a_params, a_io_service);
+      if(a_params.use_strand)
+        return server<Framing, strand_executor>::create(a_params, a_io_service);
+      return server<Framing, inline_executor>::create(a_params, a_io_service);
+    }
   } //namespace tcp
 } //namespace common
 
@@ -150,7 +236,20 @@ namespace common
   {
     iserver::ref create_server(tcp_server_params_t& a_params, boost::asio::io_service& a_io_service)
     {
-      return std::make_shared<server>(a_params, a_io_service);
+      switch (a_params.do_read_type)
+      {
+        case read_func_type_e::completion_eol:
+          return make_server<completion_eol_framing>(a_params, a_io_service);
+        case read_func_type_e::read_until_eol:
+          return make_server<read_until_eol_framing>(a_params, a_io_service);
+        case read_func_type_e::length_prefixed:
+          return make_server<length_prefixed_framing>(a_params, a_io_service);
+        case read_func_type_e::chunked_eol:
+          return make_server<chunked_eol_framing>(a_params, a_io_service);
+        case read_func_type_e::async_read_some_eol:
+        default:
+          return make_server<read_some_eol_framing>(a_params, a_io_service);
+      }
     }
   } //namespace tcp
 } //namespace common
@@ -0,0 +1,215 @@
+#pragma once
+
+#include "../communacations_types.h"
+#include "../packet_field.h"
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace common
+{
+  namespace tcp
+  {
+    // In-flight requests of one client connection, in a table allocated up
+    // front. A correlation id is a slot index plus a per-slot generation
+    // above it, so a late response to a request that timed out does not
+    // match the next request in the same slot. All deadlines share one
+    // timer, armed for the earliest; on expiry the table is scanned.
+    // Thread-safe; callbacks run outside the lock. With a_strand the timeout
+    // callbacks run on it, so they are serialized with responses completed
+    // from the same strand.
+    class request_table
+    {
+      public:
+        using callback_t = std::function<void(request_status_e, const std::string&)>;
+
+        request_table(const packet_field_t& a_field, std::size_t a_max_in_flight, boost::asio::io_service& a_io_service, std::shared_ptr<boost::asio::io_service::strand> a_strand = nullptr)
+          : m_field(a_field)
+          , m_timer(a_io_service)
+          , m_strand(a_strand)
+        {
+          std::uint64_t id_mask = m_field.width >= sizeof(std::uint64_t) ? ~0ull : (1ull << (8 * m_field.width)) - 1;
+          std::size_t slots = 1;
+          while(slots < a_max_in_flight && slots - 1 < id_mask)
+            slots <<= 1;
+          m_id_mask = id_mask;
+          m_index_mask = slots - 1;
+          m_max_in_flight = std::min(a_max_in_flight, slots);
+          m_slots.resize(slots);
+          m_free.reserve(slots);
+          for(std::size_t i = slots; i > 0; --i)
+            m_free.push_back(static_cast<std::uint32_t>(i - 1));
+        }
+
+        ~request_table()
+        {
+          boost::system::error_code ec;
+          m_timer.cancel(ec);
+        }
+
+        // Stamps a fresh id into a_frame and registers a_callback. False if
+        // the window is full or the frame is too short for the id.
+        bool add(std::string& a_frame, callback_t a_callback, std::chrono::milliseconds a_timeout)
+        {
+          auto deadline = std::chrono::steady_clock::now() + a_timeout;
+          std::lock_guard<std::mutex> lock(m_mutex);
+          if(m_in_flight.load(std::memory_order_relaxed) >= m_max_in_flight || m_free.empty())
+            return false;
+
+          std::uint32_t index = m_free.back();
+          slot_t& slot = m_slots[index];
+          std::uint64_t id = ((slot.generation++ * (m_index_mask + 1)) | index) & m_id_mask;
+          if(!write_packet_field(m_field, &a_frame[0], a_frame.size(), id))
+            return false;
+
+          m_free.pop_back();
+          slot.id = id;
+          slot.is_used = true;
+          slot.deadline = deadline;
+          slot.callback = std::move(a_callback);
+          m_in_flight.store(m_in_flight.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+
+          if(!m_is_armed || deadline < m_armed_at)
+            arm(deadline);
+          return true;
+        }
+
+        // Completes the request a_data answers; false if it answers none.
+        bool complete(const char *a_data, std::size_t a_len)
+        {
+          if(m_in_flight.load(std::memory_order_acquire) == 0)
+            return false;
+
+          std::uint64_t id;
+          if(!read_packet_field(m_field, a_data, a_len, id))
+            return false;
+
+          callback_t callback;
+          {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            slot_t& slot = m_slots[id & m_index_mask];
+            if(!slot.is_used || slot.id != id)
+              return false;
+            callback = release(id & m_index_mask);
+          }
+          if(callback != nullptr)
+            callback(request_status_e::ok, std::string(a_data, a_len));
+          return true;
+        }
+
+        void fail_all(request_status_e a_status)
+        {
+          std::vector<callback_t> callbacks;
+          {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for(std::size_t i = 0; i < m_slots.size(); ++i)
+            {
+              if(m_slots[i].is_used)
+                callbacks.push_back(release(i));
+            }
+          }
+          for(auto& callback : callbacks)
+          {
+            if(callback != nullptr)
+              callback(a_status, std::string());
+          }
+        }
+
+        std::size_t in_flight() const
+        {
+          return m_in_flight.load(std::memory_order_relaxed);
+        }
+
+      private:
+        struct slot_t
+        {
+          std::uint64_t id = 0;
+          std::uint64_t generation = 0;
+          bool is_used = false;
+          std::chrono::steady_clock::time_point deadline;
+          callback_t callback;
+        };
+
+        callback_t release(std::size_t a_index)
+        {
+          slot_t& slot = m_slots[a_index];
+          slot.is_used = false;
+          m_free.push_back(static_cast<std::uint32_t>(a_index));
+          m_in_flight.store(m_in_flight.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+          callback_t callback = std::move(slot.callback);
+          slot.callback = nullptr;
+          return callback;
+        }
+
+        // under m_mutex
+        void arm(std::chrono::steady_clock::time_point a_deadline)
+        {
+          m_is_armed = true;
+          m_armed_at = a_deadline;
+          m_timer.expires_at(a_deadline);
+          auto on_timer = [this](const boost::system::error_code& a_ec)
+          {
+            if(!a_ec)
+              expire();
+          };
+          if(m_strand != nullptr)
+            m_timer.async_wait(m_strand->wrap(on_timer));
+          else
+            m_timer.async_wait(on_timer);
+        }
+
+        void expire()
+        {
+          std::vector<callback_t> callbacks;
+          {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_is_armed = false;
+            auto now = std::chrono::steady_clock::now();
+            bool has_next = false;
+            std::chrono::steady_clock::time_point next;
+            for(std::size_t i = 0; i < m_slots.size(); ++i)
+            {
+              slot_t& slot = m_slots[i];
+              if(!slot.is_used)
+                continue;
+              if(slot.deadline <= now)
+                callbacks.push_back(release(i));
+              else if(!has_next || slot.deadline < next)
+              {
+                has_next = true;
+                next = slot.deadline;
+              }
+            }
+            if(has_next)
+              arm(next);
+          }
+          for(auto& callback : callbacks)
+          {
+            if(callback != nullptr)
+              callback(request_status_e::timeout, std::string());
+          }
+        }
+
+      private:
+        const packet_field_t m_field;
+        boost::asio::steady_timer m_timer;
+        std::shared_ptr<boost::asio::io_service::strand> m_strand;
+        std::mutex m_mutex;
+        std::vector<slot_t> m_slots;
+        std::vector<std::uint32_t> m_free;
+        std::uint64_t m_id_mask = 0;
+        std::uint64_t m_index_mask = 0;
+        std::size_t m_max_in_flight = 0;
+        std::atomic<std::size_t> m_in_flight{0};
+        std::chrono::steady_clock::time_point m_armed_at;
+        bool m_is_armed = false;
+    };
+  } //namespace tcp
+} //namespace common
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "../communacations_types.h"
+#include <boost/asio.hpp>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace common
+{
+  namespace tcp
+  {
+    // Outbound queues of one session, one per send_priority_e. Each write
+    // takes frames from the highest non-empty lane only, so a control frame
+    // waits for at most the write already in flight, never for queued bulk
+    // data. A write gathers up to max_batch_bytes of one lane (always at
+    // least one frame). push() and depths() may be called from any thread.
+    class send_lanes
+    {
+      public:
+        explicit send_lanes(std::size_t a_max_batch_bytes)
+          : m_max_batch_bytes(a_max_batch_bytes)
+        {
+        }
+
+        // Queues a copy of the frame. Returns true if no write is in flight
+        // and the caller has to start one.
+        bool push(send_priority_e a_priority, const char *a_data, std::size_t a_len, std::uint32_t a_seq)
+        {
+          return push_with(a_priority, a_len, a_seq, [a_data, a_len](char *a_out)
+          {
+            memcpy(a_out, a_data, a_len);
+          });
+        }
+
+        // Same as push(), but a_fill(out) writes the a_len bytes of the
+        // frame straight into the queued buffer.
+        template<typename Fill>
+        bool push_with(send_priority_e a_priority, std::size_t a_len, std::uint32_t a_seq, Fill&& a_fill)
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          if(m_is_closed)
+            return false;
+
+          auto& lane = m_lanes[static_cast<std::size_t>(a_priority)];
+          lane.frames.push_back(frame_t{std::string(a_len, '\0'), a_seq});
+          a_fill(&lane.frames.back().data[0]);
+          lane.bytes += a_len;
+          if(m_is_writing)
+            return false;
+          m_is_writing = true;
+          return true;
+        }
+
+        // Fills a_buffers with the next batch. Returns false, and ends the
+        // write cycle, once every lane is empty.
+        bool next_batch(std::vector<boost::asio::const_buffer>& a_buffers)
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          a_buffers.clear();
+          if(m_is_closed)
+          {
+            for(auto& lane : m_lanes)
+            {
+              lane.frames.clear();
+              lane.bytes = 0;
+            }
+            m_is_writing = false;
+            return false;
+          }
+
+          for(std::size_t i = 0; i < m_lanes.size(); ++i)
+          {
+            auto& lane = m_lanes[i];
+            if(lane.frames.empty())
+              continue;
+
+            std::size_t bytes = 0;
+            for(const auto& frame : lane.frames)
+            {
+              if(!a_buffers.empty() && bytes + frame.data.size() > m_max_batch_bytes)
+                break;
+              a_buffers.push_back(boost::asio::buffer(frame.data));
+              bytes += frame.data.size();
+            }
+            m_batch_lane = i;
+            return true;
+          }
+          m_is_writing = false;
+          return false;
+        }
+
+        // Drops the frames of the batch just written, calling a_on_frame(seq)
+        // for each of them.
+        template<typename OnFrame>
+        void pop_batch(std::size_t a_count, OnFrame&& a_on_frame)
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          auto& lane = m_lanes[m_batch_lane];
+          for(std::size_t i = 0; i < a_count && !lane.frames.empty(); ++i)
+          {
+            a_on_frame(lane.frames.front().seq);
+            lane.bytes -= lane.frames.front().data.size();
+            lane.frames.pop_front();
+          }
+        }
+
+        // Ignores further pushes; whatever is queued is discarded by the
+        // next next_batch(), once no write can still be using it.
+        void close()
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          m_is_closed = true;
+        }
+
+        bool is_closed()
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          return m_is_closed;
+        }
+
+        tcp_lane_depths_t depths()
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          tcp_lane_depths_t depths;
+          for(std::size_t i = 0; i < m_lanes.size(); ++i)
+          {
+            depths[i].messages = m_lanes[i].frames.size();
+            depths[i].bytes = m_lanes[i].bytes;
+          }
+          return depths;
+        }
+
+      private:
+        struct frame_t
+        {
+          std::string data;
+          std::uint32_t seq;
+        };
+
+        struct lane_t
+        {
+          std::deque<frame_t> frames;
+          std::size_t bytes = 0;
+        };
+
+        const std::size_t m_max_batch_bytes;
+        std::mutex m_mutex;
+        std::array<lane_t, SEND_PRIORITY_COUNT> m_lanes;
+        std::size_t m_batch_lane = 0;
+        bool m_is_writing = false;
+        bool m_is_closed = false;
+    };
+  } //namespace tcp
+} //namespace common
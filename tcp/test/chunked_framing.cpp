@@ -0,0 +1,200 @@
+#include "../framing.h"
+#include "../../shm/impl/record_framing.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Splits a stream of '\n' terminated lines, empty and longer than a read
+// among them, at every read size from 1 byte up and runs it through
+// chunked_eol_framing, then as shm records through record_framing. Checks
+// that the chunks put every line back together, that each carries its
+// running offset in the line and CHUNK_BEGIN / CHUNK_END where the line
+// begins and ends, that a line breaks into one chunk per read it touches,
+// with an empty CHUNK_END chunk when its '\n' arrives alone, and that the
+// unterminated tail is never ended. Exits non-zero on the first mismatch.
+//
+//   communications_chunked_framing_test_app
+
+namespace
+{
+  using namespace common;
+
+  const std::size_t line_lengths[] = {5, 0, 1, 2, 0, 0, 31, 64, 65, 1, 200, 0, 3, 513, 7};
+  const std::string tail = "unterminated";
+
+  struct stream_t
+  {
+    std::string bytes;
+    std::vector<std::string> lines;
+    // where each line starts in bytes; its '\n' follows it
+    std::vector<std::size_t> starts;
+  };
+
+  stream_t make_stream()
+  {
+    stream_t stream;
+    for(std::size_t length : line_lengths)
+    {
+      std::string line;
+      for(std::size_t i = 0; i < length; i++)
+        line += static_cast<char>('a' + (stream.lines.size() + i) % 26);
+      stream.starts.push_back(stream.bytes.size());
+      stream.bytes += line + "\n";
+      stream.lines.push_back(line);
+    }
+    stream.bytes += tail;
+    return stream;
+  }
+
+  class checker
+  {
+    public:
+      checker(const stream_t& a_stream, std::size_t a_read_size)
+        : m_stream(a_stream)
+        , m_read_size(a_read_size)
+      {
+      }
+
+      void on_chunk(const char *a_data, std::size_t a_len, std::uint64_t a_offset, std::uint32_t a_flags)
+      {
+        if((a_flags & CHUNK_BEGIN) != 0)
+        {
+          if(m_is_in_line || a_offset != 0)
+            m_errors++;
+          m_is_in_line = true;
+          m_line.clear();
+          m_chunks = 0;
+        }
+        else if(!m_is_in_line || a_offset != m_line.size())
+        {
+          m_errors++;
+        }
+        // only the closing chunk of a line may be empty
+        if(a_len == 0 && (a_flags & CHUNK_END) == 0)
+          m_errors++;
+        if(a_len == 0 && a_flags == CHUNK_END)
+          m_empty_ends++;
+
+        m_line.append(a_data, a_len);
+        m_chunks++;
+        if((a_flags & CHUNK_END) != 0)
+          on_line();
+      }
+
+      void on_message()
+      {
+        m_errors++;
+      }
+
+      bool check(const char *a_path)
+      {
+        // the tail is begun but never ended
+        if(!m_is_in_line || m_line != tail)
+          m_errors++;
+        if(m_next != m_stream.lines.size() || m_errors != 0)
+        {
+          printf("%s, read size %zu: %zu of %zu lines, %zu wrong\n", a_path, m_read_size, m_next, m_stream.lines.size(), m_errors);
+          return false;
+        }
+        return true;
+      }
+
+      std::size_t empty_ends() const
+      {
+        return m_empty_ends;
+      }
+
+    private:
+      void on_line()
+      {
+        m_is_in_line = false;
+        if(m_next >= m_stream.lines.size())
+        {
+          m_errors++;
+          return;
+        }
+
+        // one chunk for every read holding a byte of the line or its '\n'
+        const std::size_t start = m_stream.starts[m_next];
+        const std::size_t eol = start + m_stream.lines[m_next].size();
+        const std::size_t expected_chunks = eol / m_read_size - start / m_read_size + 1;
+        if(m_line != m_stream.lines[m_next] || m_chunks != expected_chunks)
+          m_errors++;
+        m_next++;
+      }
+
+    private:
+      const stream_t& m_stream;
+      const std::size_t m_read_size;
+      std::string m_line;
+      bool m_is_in_line = false;
+      std::size_t m_chunks = 0;
+      std::size_t m_next = 0;
+      std::size_t m_errors = 0;
+      std::size_t m_empty_ends = 0;
+  };
+
+  bool check_tcp(const stream_t& a_stream, std::size_t a_read_size, std::size_t& a_empty_ends)
+  {
+    tcp::chunked_eol_framing framing;
+    checker check(a_stream, a_read_size);
+    for(std::size_t pos = 0; pos < a_stream.bytes.size(); pos += a_read_size)
+    {
+      framing.on_data(a_stream.bytes.data() + pos, std::min(a_read_size, a_stream.bytes.size() - pos));
+      const char *data;
+      std::size_t len;
+      while(framing.next_frame(data, len))
+        check.on_chunk(data, len, framing.chunk().offset, framing.chunk().flags);
+    }
+    a_empty_ends += check.empty_ends();
+    return check.check("tcp");
+  }
+
+  bool check_shm(const stream_t& a_stream, std::size_t a_read_size, std::size_t& a_empty_ends)
+  {
+    shm::record_framing framing(read_func_type_e::chunked_eol, 0);
+    checker check(a_stream, a_read_size);
+    for(std::size_t pos = 0; pos < a_stream.bytes.size(); pos += a_read_size)
+    {
+      bool is_open = framing.on_record(a_stream.bytes.data() + pos, std::min(a_read_size, a_stream.bytes.size() - pos),
+        [&check](const char * /*a_data*/, std::size_t /*a_len*/)
+        {
+          check.on_message();
+        },
+        [&check](const char *a_data, std::size_t a_len, std::uint64_t a_offset, std::uint32_t a_flags)
+        {
+          check.on_chunk(a_data, a_len, a_offset, a_flags);
+        });
+      if(!is_open)
+      {
+        printf("shm, read size %zu: record refused\n", a_read_size);
+        return false;
+      }
+    }
+    a_empty_ends += check.empty_ends();
+    return check.check("shm");
+  }
+}
+
+int main()
+{
+  const stream_t stream = make_stream();
+
+  bool is_ok = true;
+  std::size_t tcp_empty_ends = 0;
+  std::size_t shm_empty_ends = 0;
+  for(std::size_t read_size = 1; read_size <= stream.bytes.size(); read_size++)
+  {
+    is_ok = check_tcp(stream, read_size, tcp_empty_ends) && is_ok;
+    is_ok = check_shm(stream, read_size, shm_empty_ends) && is_ok;
+  }
+  if(tcp_empty_ends == 0 || shm_empty_ends == 0)
+  {
+    printf("no '\\n' ever arrived alone\n");
+    is_ok = false;
+  }
+
+  printf("%zu lines, %zu bytes, empty end chunks tcp %zu shm %zu: %s\n", stream.lines.size(), stream.bytes.size(),
+         tcp_empty_ends, shm_empty_ends, is_ok ? "ok" : "FAILED");
+  return is_ok ? 0 : 1;
+}
@@ -0,0 +1,244 @@
+#include "../../communications.h"
+#include "../coro_session.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Compares the callback server (create_server) with the coroutine server
+// (coro_server) on loopback: every client pipelines newline-terminated
+// messages and the server either
+//   recv   only counts them
+//   echo   replies to each message with one send call: send_data() on the
+//          callback path, co_await write() on the coroutine path
+//   batch  coroutine only: send() per message and one write per read, as
+//          read_frame() flushes before it waits on the socket
+// reporting messages per second for each path.
+//
+//   communications_tcp_bench [--count=N] [--clients=N] [--size=BYTES]
+//                            [--threads=N] [--port=N]
+
+namespace
+{
+  using namespace common;
+  using namespace common::tcp;
+  using bench_clock = std::chrono::steady_clock;
+
+  struct bench_options_t
+  {
+    std::size_t count = 200000;
+    std::size_t clients = 4;
+    std::size_t size = 32;
+    std::size_t threads = 1;
+    std::uint16_t port = 38000;
+  };
+
+  enum class bench_path_e
+  {
+    callback,
+    coroutine
+  };
+
+  enum class bench_mode_e
+  {
+    recv,
+    echo,
+    batch
+  };
+
+  struct bench_case_t
+  {
+    bench_path_e path;
+    bench_mode_e mode;
+  };
+
+  const char *mode_name(bench_mode_e a_mode)
+  {
+    switch(a_mode)
+    {
+      case bench_mode_e::echo:
+        return "echo";
+      case bench_mode_e::batch:
+        return "batch";
+      case bench_mode_e::recv:
+      default:
+        return "recv";
+    }
+  }
+
+  // Sends a_count messages and, when echoing, reads back the same number of
+  // bytes on a second thread.
+  void run_client(const bench_options_t& a_options, std::uint16_t a_port, bool a_echo)
+  {
+    boost::asio::io_service io_service;
+    boost::asio::ip::tcp::socket sock(io_service);
+    sock.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address::from_string("127.0.0.1"), a_port));
+    sock.set_option(boost::asio::ip::tcp::no_delay(true));
+
+    std::string message(a_options.size > 1 ? a_options.size - 1 : 0, 'x');
+    message += '\n';
+    const std::size_t total = message.size() * a_options.count;
+
+    std::thread reader;
+    if(a_echo)
+    {
+      reader = std::thread([&sock, total]{
+        std::vector<char> buf(65536);
+        std::size_t received = 0;
+        boost::system::error_code ec;
+        while(received < total && !ec)
+          received += sock.read_some(boost::asio::buffer(buf), ec);
+      });
+    }
+
+    // batch messages into large writes so the client is not the bottleneck
+    const std::size_t per_write = std::max<std::size_t>(1, 65536 / message.size());
+    std::string batch;
+    for(std::size_t i = 0; i < per_write; i++)
+      batch += message;
+    for(std::size_t sent = 0; sent < a_options.count; sent += per_write)
+    {
+      std::size_t n = std::min(per_write, a_options.count - sent);
+      boost::asio::write(sock, boost::asio::buffer(batch.data(), n * message.size()));
+    }
+
+    if(reader.joinable())
+      reader.join();
+    boost::system::error_code ec;
+    sock.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+  }
+
+  void run_case(const bench_options_t& a_options, const bench_case_t& a_case, std::uint16_t a_port)
+  {
+    boost::asio::io_service io_service;
+    auto work = std::make_shared<boost::asio::io_service::work>(io_service);
+
+    tcp_server_params_t params;
+    params.port = a_port;
+    params.do_read_type = read_func_type_e::async_read_some_eol;
+
+    std::atomic<std::uint64_t> received{0};
+    iserver::ref callback_server;
+    std::function<void()> stop_coro_server;
+    if(a_case.path == bench_path_e::callback)
+    {
+      callback_server = create_server(params, io_service);
+      iserver *raw = callback_server.get();
+      const bool echo = a_case.mode != bench_mode_e::recv;
+      callback_server->set_on_message([raw, echo, &received](const int a_client, const char *a_data, std::size_t a_len)
+      {
+        if(echo)
+        {
+          std::string reply(a_data, a_len);
+          reply += '\n';
+          raw->send_data(a_client, reply.data(), reply.size());
+        }
+        received.fetch_add(1, std::memory_order_relaxed);
+      });
+      callback_server->run();
+    }
+    else
+    {
+      const bench_mode_e mode = a_case.mode;
+      auto handler = [mode, &received](coro_session<read_some_eol_framing>& a_session) -> boost::asio::awaitable<void>
+      {
+        const char *data;
+        std::size_t len;
+        std::string reply;
+        while(co_await a_session.read_frame(data, len))
+        {
+          if(mode == bench_mode_e::echo)
+          {
+            reply.assign(data, len);
+            reply += '\n';
+            if(!co_await a_session.write(reply.data(), reply.size()))
+              break;
+          }
+          else if(mode == bench_mode_e::batch)
+          {
+            a_session.send(data, len);
+            a_session.send("\n", 1);
+          }
+          received.fetch_add(1, std::memory_order_relaxed);
+        }
+      };
+      auto server = make_coro_server<read_some_eol_framing>(params, io_service, handler);
+      server->run();
+      stop_coro_server = [server]{ server->stop(); };
+    }
+
+    std::vector<std::thread> tgroup;
+    for(std::size_t i = 0; i < a_options.threads; i++)
+    {
+      tgroup.emplace_back(std::thread([&io_service](){
+        io_service.run();
+      }));
+    }
+
+    const std::uint64_t expected = a_options.count * a_options.clients;
+    auto start = bench_clock::now();
+    std::vector<std::thread> clients;
+    for(std::size_t i = 0; i < a_options.clients; i++)
+      clients.emplace_back(run_client, std::cref(a_options), a_port, a_case.mode != bench_mode_e::recv);
+    for(auto& cl : clients)
+      cl.join();
+    while(received.load(std::memory_order_relaxed) < expected)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+    if(stop_coro_server)
+      stop_coro_server();
+    work.reset();
+    io_service.stop();
+    for(auto &thr: tgroup)
+      thr.join();
+
+    printf("%-10s %-5s %8zu %12.0f %10.1f\n", a_case.path == bench_path_e::callback ? "callback" : "coroutine", mode_name(a_case.mode),
+           a_options.clients, expected / seconds, expected * a_options.size / seconds / 1e6);
+  }
+
+  bool parse_option(const char *a_arg, const char *a_name, std::size_t& a_value)
+  {
+    std::size_t len = strlen(a_name);
+    if(strncmp(a_arg, a_name, len) != 0 || a_arg[len] != '=')
+      return false;
+    a_value = std::stoull(a_arg + len + 1);
+    return true;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  bench_options_t options;
+  for(int i = 1; i < argc; i++)
+  {
+    std::size_t port = options.port;
+    if(!parse_option(argv[i], "--count", options.count) &&
+       !parse_option(argv[i], "--clients", options.clients) &&
+       !parse_option(argv[i], "--size", options.size) &&
+       !parse_option(argv[i], "--threads", options.threads) &&
+       !parse_option(argv[i], "--port", port))
+    {
+      std::cerr << "unknown option " << argv[i] << std::endl;
+      return 1;
+    }
+    options.port = static_cast<std::uint16_t>(port);
+  }
+
+  printf("%zu clients x %zu messages of %zu bytes, %zu io threads\n",
+         options.clients, options.count, options.size, options.threads);
+  printf("%-10s %-5s %8s %12s %10s\n", "path", "mode", "clients", "msgs/s", "MB/s");
+
+  // a fresh port per case keeps stragglers of one run out of the next
+  std::uint16_t port = options.port;
+  for(auto mode : {bench_mode_e::recv, bench_mode_e::echo})
+    for(auto path : {bench_path_e::callback, bench_path_e::coroutine})
+      run_case(options, bench_case_t{path, mode}, port++);
+  run_case(options, bench_case_t{bench_path_e::coroutine, bench_mode_e::batch}, port++);
+
+  return 0;
+}
@@ -0,0 +1,239 @@
+#include "../../communications.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Compares the socket profiles of socket_options_t on loopback, with the
+// same profile on the server and the client:
+//   split   a request written as a header and a body in two sends, the
+//           pattern Nagle and delayed ACKs stall; round trip in us
+//   rtt     one request() in flight at a time; round trip in us
+//   window  up to --window requests in flight; requests per second
+//   stream  one-way 64 KiB frames; MB per second
+//
+//   communications_tcp_profile_bench [--split=N] [--rtts=N] [--requests=N]
+//                                    [--window=N] [--stream=MB] [--size=BYTES]
+//                                    [--port=N]
+
+namespace
+{
+  using namespace common;
+  using namespace common::tcp;
+  using bench_clock = std::chrono::steady_clock;
+
+  struct bench_options_t
+  {
+    std::size_t split = 200;
+    std::size_t rtts = 10000;
+    std::size_t requests = 100000;
+    std::size_t window = 64;
+    std::size_t stream = 256;
+    std::size_t size = 64;
+    std::uint16_t port = 38100;
+  };
+
+  // [u32 length][u8 kind][3 bytes padding][u64 correlation id][filler]
+  const std::size_t KIND_OFFSET = 4;
+  const std::size_t ID_OFFSET = 8;
+  const std::size_t HEADER_SIZE = 16;
+  const char KIND_ECHO = 'E';
+  const char KIND_SINK = 'S';
+
+  std::string make_frame(std::size_t a_size, char a_kind)
+  {
+    std::string frame(std::max(a_size, HEADER_SIZE), 'x');
+    std::uint32_t len = static_cast<std::uint32_t>(frame.size());
+    memcpy(&frame[0], &len, sizeof(len));
+    frame[KIND_OFFSET] = a_kind;
+    // never matches an outstanding request, so the echo goes to on_message
+    std::uint64_t id = ~0ull;
+    memcpy(&frame[ID_OFFSET], &id, sizeof(id));
+    return frame;
+  }
+
+  const char *profile_name(socket_profile_e a_profile)
+  {
+    switch(a_profile)
+    {
+      case socket_profile_e::low_latency:
+        return "low_latency";
+      case socket_profile_e::bulk:
+        return "bulk";
+      case socket_profile_e::system_default:
+      default:
+        return "default";
+    }
+  }
+
+  double percentile(std::vector<double>& a_samples, double a_fraction)
+  {
+    if(a_samples.empty())
+      return 0;
+    std::sort(a_samples.begin(), a_samples.end());
+    std::size_t index = static_cast<std::size_t>(a_fraction * (a_samples.size() - 1));
+    return a_samples[index];
+  }
+
+  template<typename Condition>
+  bool wait_for(Condition a_condition, std::chrono::seconds a_timeout = std::chrono::seconds(30))
+  {
+    auto deadline = bench_clock::now() + a_timeout;
+    while(!a_condition())
+    {
+      if(bench_clock::now() > deadline)
+        return false;
+      std::this_thread::yield();
+    }
+    return true;
+  }
+
+  double elapsed_us(bench_clock::time_point a_start)
+  {
+    return std::chrono::duration<double, std::micro>(bench_clock::now() - a_start).count();
+  }
+
+  void run_profile(const bench_options_t& a_options, socket_profile_e a_profile, std::uint16_t a_port)
+  {
+    boost::asio::io_service io_service;
+    auto work = std::make_shared<boost::asio::io_service::work>(io_service);
+
+    tcp_server_params_t server_params;
+    server_params.port = a_port;
+    server_params.do_read_type = read_func_type_e::length_prefixed;
+    server_params.socket_options.profile = a_profile;
+    auto server = create_server(server_params, io_service);
+    iserver *raw = server.get();
+    std::atomic<std::uint64_t> sunk{0};
+    server->set_on_message([raw, &sunk](const int a_client, const char *a_data, std::size_t a_len)
+    {
+      if(a_len > KIND_OFFSET && a_data[KIND_OFFSET] == KIND_ECHO)
+        raw->send_data(a_client, a_data, a_len);
+      else
+        sunk.store(sunk.load(std::memory_order_relaxed) + a_len, std::memory_order_relaxed);
+    });
+    server->run();
+
+    std::thread io_thread([&io_service](){
+      io_service.run();
+    });
+
+    tcp_client_params_t client_params;
+    client_params.port = a_port;
+    client_params.do_read_type = read_func_type_e::length_prefixed;
+    client_params.use_strand = false;
+    client_params.correlation.offset = ID_OFFSET;
+    client_params.correlation.width = 8;
+    client_params.correlation.byte_order = byte_order_e::little_endian;
+    client_params.max_in_flight = a_options.window;
+    client_params.socket_options.profile = a_profile;
+    auto client = create_client(client_params, io_service);
+    std::atomic<bool> is_connected{false};
+    std::atomic<std::uint64_t> echoed{0};
+    client->set_on_connected([&is_connected]{ is_connected = true; });
+    client->set_on_message([&echoed](const std::string&){ echoed.fetch_add(1, std::memory_order_relaxed); });
+    client->run();
+    wait_for([&is_connected]{ return is_connected.load(); });
+
+    const std::string frame = make_frame(a_options.size, KIND_ECHO);
+
+    std::vector<double> split;
+    for(std::size_t i = 0; i < a_options.split; i++)
+    {
+      auto start = bench_clock::now();
+      client->send_message(frame.substr(0, HEADER_SIZE / 2));
+      client->send_message(frame.substr(HEADER_SIZE / 2));
+      if(!wait_for([&echoed, i]{ return echoed.load(std::memory_order_relaxed) > i; }))
+        break;
+      split.push_back(elapsed_us(start));
+    }
+
+    std::vector<double> rtts;
+    for(std::size_t i = 0; i < a_options.rtts; i++)
+    {
+      std::atomic<bool> is_done{false};
+      auto start = bench_clock::now();
+      if(!client->request(frame, [&is_done](request_status_e, const std::string&){ is_done = true; }, std::chrono::milliseconds(1000)))
+        break;
+      wait_for([&is_done]{ return is_done.load(); });
+      rtts.push_back(elapsed_us(start));
+    }
+
+    std::atomic<std::uint64_t> completed{0};
+    auto window_start = bench_clock::now();
+    for(std::size_t sent = 0; sent < a_options.requests; )
+    {
+      if(client->request(frame, [&completed](request_status_e, const std::string&){ completed.fetch_add(1, std::memory_order_relaxed); }, std::chrono::milliseconds(1000)))
+        sent++;
+      else
+        std::this_thread::yield();
+    }
+    wait_for([&completed, &a_options]{ return completed.load() >= a_options.requests; });
+    double window_seconds = elapsed_us(window_start) / 1e6;
+
+    // keep a few MB queued ahead of the server rather than the whole stream
+    const std::string chunk = make_frame(65536, KIND_SINK);
+    const std::uint64_t total = a_options.stream * 1024 * 1024 / chunk.size() * chunk.size();
+    auto stream_start = bench_clock::now();
+    for(std::uint64_t queued = 0; queued < total; queued += chunk.size())
+    {
+      wait_for([&sunk, queued]{ return queued < sunk.load(std::memory_order_relaxed) + 4 * 1024 * 1024; });
+      client->send_message(chunk);
+    }
+    wait_for([&sunk, total]{ return sunk.load(std::memory_order_relaxed) >= total; });
+    double stream_seconds = elapsed_us(stream_start) / 1e6;
+
+    work.reset();
+    io_service.stop();
+    io_thread.join();
+
+    printf("%-12s %9.1f %9.1f %9.1f %9.1f %12.0f %11.1f\n", profile_name(a_profile),
+           percentile(split, 0.5), percentile(split, 0.99), percentile(rtts, 0.5), percentile(rtts, 0.99),
+           a_options.requests / window_seconds, total / stream_seconds / 1e6);
+  }
+
+  bool parse_option(const char *a_arg, const char *a_name, std::size_t& a_value)
+  {
+    std::size_t len = strlen(a_name);
+    if(strncmp(a_arg, a_name, len) != 0 || a_arg[len] != '=')
+      return false;
+    a_value = std::stoull(a_arg + len + 1);
+    return true;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  bench_options_t options;
+  for(int i = 1; i < argc; i++)
+  {
+    std::size_t port = options.port;
+    if(!parse_option(argv[i], "--split", options.split) &&
+       !parse_option(argv[i], "--rtts", options.rtts) &&
+       !parse_option(argv[i], "--requests", options.requests) &&
+       !parse_option(argv[i], "--window", options.window) &&
+       !parse_option(argv[i], "--stream", options.stream) &&
+       !parse_option(argv[i], "--size", options.size) &&
+       !parse_option(argv[i], "--port", port))
+    {
+      std::cerr << "unknown option " << argv[i] << std::endl;
+      return 1;
+    }
+    options.port = static_cast<std::uint16_t>(port);
+  }
+
+  printf("%zu byte requests, window %zu, %zu MB stream\n", std::max(options.size, HEADER_SIZE), options.window, options.stream);
+  printf("%-12s %9s %9s %9s %9s %12s %11s\n", "profile", "split p50", "split p99", "rtt p50", "rtt p99", "window req/s", "stream MB/s");
+
+  // a fresh port per profile keeps stragglers of one run out of the next
+  std::uint16_t port = options.port;
+  for(auto profile : {socket_profile_e::system_default, socket_profile_e::low_latency, socket_profile_e::bulk})
+    run_profile(options, profile, port++);
+
+  return 0;
+}
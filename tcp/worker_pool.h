@@ -0,0 +1,180 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace common
+{
+  namespace tcp
+  {
+    // Fixed set of worker threads, each draining its own multi-producer
+    // queue. post(key, task) always runs tasks of the same key on the same
+    // shard, in the order they were posted. Producers never take a lock
+    // unless the worker is asleep.
+    class worker_pool
+    {
+      public:
+        explicit worker_pool(std::size_t a_shards)
+        {
+          if(a_shards == 0)
+            a_shards = 1;
+          for(std::size_t i = 0; i < a_shards; ++i)
+            m_shards.push_back(std::make_shared<shard>());
+          for(auto& sh : m_shards)
+          {
+            // the thread keeps its shard alive in case it has to be detached
+            std::shared_ptr<shard> current = sh;
+            sh->thread = std::thread([current]{ current->run(); });
+          }
+        }
+
+        worker_pool(const worker_pool&) = delete;
+        worker_pool& operator=(const worker_pool&) = delete;
+
+        ~worker_pool()
+        {
+          for(auto& sh : m_shards)
+            sh->stop();
+          for(auto& sh : m_shards)
+          {
+            // the last reference may go away inside a task
+            if(sh->thread.get_id() == std::this_thread::get_id())
+              sh->thread.detach();
+            else
+              sh->thread.join();
+          }
+        }
+
+        std::size_t shards() const
+        {
+          return m_shards.size();
+        }
+
+        void post(std::size_t a_key, std::function<void()> a_task)
+        {
+          m_shards[a_key % m_shards.size()]->push(std::move(a_task));
+        }
+
+      private:
+        struct node_t
+        {
+          std::atomic<node_t *> next{nullptr};
+          std::function<void()> task;
+        };
+
+        // Intrusive MPSC queue (Vyukov): producers exchange the head, the
+        // worker follows next pointers from a stub node at the tail.
+        class shard
+        {
+          public:
+            shard()
+              : m_head(new node_t)
+              , m_tail(m_head.load(std::memory_order_relaxed))
+            {
+            }
+
+            ~shard()
+            {
+              while(m_tail != nullptr)
+              {
+                node_t *next = m_tail->next.load(std::memory_order_relaxed);
+                delete m_tail;
+                m_tail = next;
+              }
+            }
+
+            void push(std::function<void()> a_task)
+            {
+              node_t *node = new node_t;
+              node->task = std::move(a_task);
+              node_t *prev = m_head.exchange(node, std::memory_order_seq_cst);
+              prev->next.store(node, std::memory_order_release);
+
+              if(m_is_waiting.load(std::memory_order_seq_cst))
+              {
+                {
+                  std::lock_guard<std::mutex> lock(m_mutex);
+                }
+                m_cv.notify_one();
+              }
+            }
+
+            void stop()
+            {
+              {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_is_stopped = true;
+              }
+              m_cv.notify_one();
+            }
+
+            void run()
+            {
+              const int spins = 1000;
+              int idle = 0;
+              for(;;)
+              {
+                if(pop_and_run())
+                {
+                  idle = 0;
+                  continue;
+                }
+                if(++idle < spins)
+                {
+                  std::this_thread::yield();
+                  continue;
+                }
+
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_is_waiting.store(true, std::memory_order_seq_cst);
+                m_cv.wait(lock, [this]{ return m_is_stopped || !is_empty(); });
+                m_is_waiting.store(false, std::memory_order_relaxed);
+                if(m_is_stopped)
+                  return;
+                idle = 0;
+              }
+            }
+
+          public:
+            std::thread thread;
+
+          private:
+            bool is_empty()
+            {
+              // a producer between exchange and store counts as non-empty
+              return m_head.load(std::memory_order_seq_cst) == m_tail;
+            }
+
+            bool pop_and_run()
+            {
+              node_t *next = m_tail->next.load(std::memory_order_acquire);
+              if(next == nullptr)
+                return false;
+
+              // next becomes the new stub once its task is taken
+              std::function<void()> task = std::move(next->task);
+              delete m_tail;
+              m_tail = next;
+              task();
+              return true;
+            }
+
+          private:
+            std::atomic<node_t *> m_head;
+            node_t *m_tail;
+            std::mutex m_mutex;
+            std::condition_variable m_cv;
+            std::atomic<bool> m_is_waiting{false};
+            bool m_is_stopped = false;
+        };
+
+      private:
+        std::vector<std::shared_ptr<shard>> m_shards;
+    };
+  } //namespace tcp
+} //namespace common
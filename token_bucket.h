@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace common
+{
+  // Refills at a_rate tokens per second up to a_burst. consume() may drive
+  // the balance negative: the caller has already done the work and waits
+  // out delay() before doing more. A rate of 0 never limits.
+  class token_bucket
+  {
+    public:
+      token_bucket(double a_rate, double a_burst)
+        : m_rate(a_rate)
+        , m_burst(a_burst > 0 ? a_burst : 1)
+        , m_tokens(m_burst)
+        , m_last_refill(std::chrono::steady_clock::now())
+      {
+      }
+
+      bool is_limited() const
+      {
+        return m_rate > 0;
+      }
+
+      void consume(double a_tokens)
+      {
+        if(!is_limited())
+          return;
+        refill();
+        m_tokens -= a_tokens;
+      }
+
+      std::chrono::nanoseconds delay()
+      {
+        if(!is_limited())
+          return std::chrono::nanoseconds(0);
+        refill();
+        if(m_tokens >= 0)
+          return std::chrono::nanoseconds(0);
+        return std::chrono::nanoseconds(static_cast<std::int64_t>(-m_tokens / m_rate * 1e9) + 1);
+      }
+
+    private:
+      void refill()
+      {
+        auto now = std::chrono::steady_clock::now();
+        m_tokens += std::chrono::duration<double>(now - m_last_refill).count() * m_rate;
+        if(m_tokens > m_burst)
+          m_tokens = m_burst;
+        m_last_refill = now;
+      }
+
+    private:
+      const double m_rate;
+      const double m_burst;
+      double m_tokens;
+      std::chrono::steady_clock::time_point m_last_refill;
+  };
+} //namespace common
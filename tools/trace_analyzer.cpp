@@ -0,0 +1,156 @@
+#include "../trace.h"
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Prints per-stage latency distributions from a file written by
+// common::trace::dump().
+//
+//   communications_trace_analyzer <trace file>
+
+namespace
+{
+  using common::trace::record_t;
+  using common::trace::stage_e;
+
+  const std::size_t stage_count = static_cast<std::size_t>(stage_e::count);
+  const std::uint64_t no_tick = 0;
+
+  struct message_t
+  {
+    std::uint64_t ticks[stage_count] = {};
+  };
+
+  class distribution
+  {
+    public:
+      explicit distribution(const char *a_name)
+        : m_name(a_name)
+      {
+      }
+
+      void add(std::uint64_t a_from, std::uint64_t a_to, double a_ticks_per_ns)
+      {
+        if(a_from != no_tick && a_to != no_tick && a_to >= a_from)
+          m_samples.push_back((a_to - a_from) / a_ticks_per_ns);
+      }
+
+      void print()
+      {
+        if(m_samples.empty())
+        {
+          printf("%-32s %10s\n", m_name, "-");
+          return;
+        }
+
+        std::sort(m_samples.begin(), m_samples.end());
+        auto percentile = [this](double a_p)
+        {
+          return m_samples[static_cast<std::size_t>(a_p * (m_samples.size() - 1))];
+        };
+        printf("%-32s %10zu %10.0f %10.0f %10.0f %10.0f %12.0f\n", m_name, m_samples.size(),
+               percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), m_samples.back());
+      }
+
+    private:
+      const char *m_name;
+      std::vector<double> m_samples;
+  };
+}
+
+int main(int argc, char** argv)
+{
+  if(argc != 2)
+  {
+    fprintf(stderr, "usage: %s <trace file>\n", argv[0]);
+    return 1;
+  }
+
+  FILE *file = fopen(argv[1], "rb");
+  if(file == nullptr)
+  {
+    perror(argv[1]);
+    return 1;
+  }
+
+  common::trace::file_header_t header;
+  if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, common::trace::file_magic, sizeof(header.magic)) != 0 || header.version != common::trace::file_version)
+  {
+    fprintf(stderr, "%s: not a trace file\n", argv[1]);
+    fclose(file);
+    return 1;
+  }
+
+  std::vector<record_t> records(header.records);
+  if(!records.empty() && fread(records.data(), sizeof(record_t), records.size(), file) != records.size())
+  {
+    fprintf(stderr, "%s: truncated\n", argv[1]);
+    fclose(file);
+    return 1;
+  }
+  fclose(file);
+
+  // received messages and writes are keyed by (session, generation, seq);
+  // reads by (session, generation, first seq, tick) so a message finds the
+  // read that produced it
+  using message_key = std::tuple<std::uint32_t, std::uint32_t, std::uint32_t>;
+  std::map<message_key, message_t> received;
+  std::map<message_key, message_t> written;
+  std::vector<std::tuple<std::uint32_t, std::uint32_t, std::uint32_t, std::uint64_t>> reads;
+  for(const auto& rec : records)
+  {
+    auto stage = static_cast<stage_e>(rec.stage);
+    auto key = std::make_tuple(rec.session, rec.generation, rec.seq);
+    if(stage == stage_e::read_complete)
+      reads.emplace_back(rec.session, rec.generation, rec.seq, rec.tsc);
+    else if(stage == stage_e::write_enqueue || stage == stage_e::write_complete)
+      written[key].ticks[rec.stage] = rec.tsc;
+    else if(rec.stage < stage_count)
+      received[key].ticks[rec.stage] = rec.tsc;
+  }
+  std::sort(reads.begin(), reads.end());
+
+  for(auto& msg : received)
+  {
+    std::uint64_t extracted = msg.second.ticks[static_cast<std::size_t>(stage_e::frame_extracted)];
+    const std::uint32_t session = std::get<0>(msg.first);
+    const std::uint32_t generation = std::get<1>(msg.first);
+    auto it = std::upper_bound(reads.begin(), reads.end(), std::make_tuple(session, generation, std::get<2>(msg.first), extracted));
+    if(it != reads.begin() && std::get<0>(*(it - 1)) == session && std::get<1>(*(it - 1)) == generation)
+      msg.second.ticks[static_cast<std::size_t>(stage_e::read_complete)] = std::get<3>(*(it - 1));
+  }
+
+  distribution framing("read -> frame");
+  distribution dispatch("frame -> callback enter");
+  distribution callback("callback enter -> exit");
+  distribution end_to_end("read -> callback exit");
+  distribution write("write enqueue -> complete");
+
+  const double ticks_per_ns = header.ticks_per_ns > 0 ? header.ticks_per_ns : 1.0;
+  auto at = [](const message_t& a_msg, stage_e a_stage)
+  {
+    return a_msg.ticks[static_cast<std::size_t>(a_stage)];
+  };
+
+  for(const auto& msg : received)
+  {
+    framing.add(at(msg.second, stage_e::read_complete), at(msg.second, stage_e::frame_extracted), ticks_per_ns);
+    dispatch.add(at(msg.second, stage_e::frame_extracted), at(msg.second, stage_e::callback_enter), ticks_per_ns);
+    callback.add(at(msg.second, stage_e::callback_enter), at(msg.second, stage_e::callback_exit), ticks_per_ns);
+    end_to_end.add(at(msg.second, stage_e::read_complete), at(msg.second, stage_e::callback_exit), ticks_per_ns);
+  }
+  for(const auto& msg : written)
+    write.add(at(msg.second, stage_e::write_enqueue), at(msg.second, stage_e::write_complete), ticks_per_ns);
+
+  printf("%llu records from %u threads, %.3f ticks/ns\n", static_cast<unsigned long long>(header.records), header.threads, ticks_per_ns);
+  printf("%-32s %10s %10s %10s %10s %10s %12s\n", "stage (ns)", "count", "p50", "p90", "p99", "p99.9", "max");
+  framing.print();
+  dispatch.print();
+  callback.print();
+  end_to_end.print();
+  write.print();
+  return 0;
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+// Per-message latency tracing. Build with -DCOMMUNICATIONS_TRACING (cmake
+// -DCOMMUNICATIONS_TRACING=ON) to record a timestamp at each pipeline stage;
+// otherwise COMMUNICATIONS_TRACE() compiles to nothing. Every thread writes
+// to its own ring, so recording is a counter read and three stores.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace common
+{
+  namespace trace
+  {
+    enum class stage_e : std::uint16_t
+    {
+        read_complete,
+        frame_extracted,
+        callback_enter,
+        callback_exit,
+        write_enqueue,
+        write_complete,
+        count
+    };
+
+    // session is the connection's client id and generation tells apart
+    // connections that reuse a closed one's fd; seq is the message within
+    // it. For read_complete seq is that of the first message the read
+    // produces.
+    struct record_t
+    {
+      std::uint64_t tsc;
+      std::uint32_t session;
+      std::uint32_t seq;
+      std::uint16_t stage;
+      std::uint16_t thread;
+      std::uint32_t generation;
+    };
+
+    struct file_header_t
+    {
+      char magic[8];
+      std::uint32_t version;
+      std::uint32_t threads;
+      double ticks_per_ns;
+      std::uint64_t records;
+    };
+
+    const char file_magic[8] = {'C', 'O', 'M', 'M', 'T', 'R', 'C', '1'};
+    const std::uint32_t file_version = 3;
+    const std::size_t ring_records = 1 << 16;
+
+    inline std::uint64_t now_ticks()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+      return __rdtsc();
+#else
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    inline std::uint64_t now_ns()
+    {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    inline std::uint32_t next_generation()
+    {
+      static std::atomic<std::uint32_t> s_generation{0};
+      return s_generation.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    // Written by its owning thread only; dump() copies it from any thread
+    // and drops whatever the writer overwrote during the copy.
+    class ring
+    {
+      public:
+        explicit ring(std::uint16_t a_thread)
+          : m_thread(a_thread)
+          , m_records(new record_t[ring_records])
+        {
+        }
+
+        void record(stage_e a_stage, std::uint32_t a_session, std::uint32_t a_generation, std::uint32_t a_seq)
+        {
+          std::uint64_t head = m_head.load(std::memory_order_relaxed);
+          record_t& rec = m_records[head & (ring_records - 1)];
+          rec.tsc = now_ticks();
+          rec.session = a_session;
+          rec.seq = a_seq;
+          rec.stage = static_cast<std::uint16_t>(a_stage);
+          rec.thread = m_thread;
+          rec.generation = a_generation;
+          m_head.store(head + 1, std::memory_order_release);
+        }
+
+        void copy_to(std::vector<record_t>& a_out) const
+        {
+          std::uint64_t head = m_head.load(std::memory_order_acquire);
+          std::uint64_t first = head > ring_records ? head - ring_records : 0;
+          std::size_t start = a_out.size();
+          for(std::uint64_t i = first; i < head; i++)
+            a_out.push_back(m_records[i & (ring_records - 1)]);
+
+          // records the writer lapped while we were copying are torn
+          std::uint64_t lapped = m_head.load(std::memory_order_acquire);
+          std::uint64_t valid_from = lapped > ring_records ? lapped - ring_records : 0;
+          if(valid_from > first)
+          {
+            std::size_t torn = static_cast<std::size_t>(valid_from - first);
+            if(torn > head - first)
+              torn = static_cast<std::size_t>(head - first);
+            a_out.erase(a_out.begin() + start, a_out.begin() + start + torn);
+          }
+        }
+
+      private:
+        const std::uint16_t m_thread;
+        std::unique_ptr<record_t[]> m_records;
+        std::atomic<std::uint64_t> m_head{0};
+    };
+
+    class registry
+    {
+      public:
+        static registry& instance()
+        {
+          static registry s_registry;
+          return s_registry;
+        }
+
+        ring *thread_ring()
+        {
+          thread_local ring *t_ring = nullptr;
+          if(t_ring == nullptr)
+          {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_rings.emplace_back(new ring(static_cast<std::uint16_t>(m_rings.size())));
+            t_ring = m_rings.back().get();
+          }
+          return t_ring;
+        }
+
+        // Writes every thread's records to a_path; returns false if the file
+        // can't be written.
+        bool dump(const std::string& a_path)
+        {
+          std::vector<record_t> records;
+          std::size_t threads;
+          {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            threads = m_rings.size();
+            for(const auto& r : m_rings)
+              r->copy_to(records);
+          }
+
+          file_header_t header;
+          memcpy(header.magic, file_magic, sizeof(file_magic));
+          header.version = file_version;
+          header.threads = static_cast<std::uint32_t>(threads);
+          header.ticks_per_ns = ticks_per_ns();
+          header.records = records.size();
+
+          FILE *file = fopen(a_path.c_str(), "wb");
+          if(file == nullptr)
+            return false;
+          bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                    (records.empty() || fwrite(records.data(), sizeof(record_t), records.size(), file) == records.size());
+          return fclose(file) == 0 && ok;
+        }
+
+      private:
+        registry()
+          : m_start_ticks(now_ticks())
+          , m_start_ns(now_ns())
+        {
+        }
+
+        double ticks_per_ns() const
+        {
+          std::uint64_t ns = now_ns() - m_start_ns;
+          return ns > 0 ? static_cast<double>(now_ticks() - m_start_ticks) / ns : 1.0;
+        }
+
+      private:
+        std::mutex m_mutex;
+        std::vector<std::unique_ptr<ring>> m_rings;
+        const std::uint64_t m_start_ticks;
+        const std::uint64_t m_start_ns;
+    };
+
+    inline void record(stage_e a_stage, std::uint32_t a_session, std::uint32_t a_generation, std::uint32_t a_seq)
+    {
+      registry::instance().thread_ring()->record(a_stage, a_session, a_generation, a_seq);
+    }
+
+    inline bool dump(const std::string& a_path)
+    {
+      return registry::instance().dump(a_path);
+    }
+  } //namespace trace
+} //namespace common
+
+#ifdef COMMUNICATIONS_TRACING
+#define COMMUNICATIONS_TRACE(stage, session, generation, seq) ::common::trace::record(::common::trace::stage_e::stage, static_cast<std::uint32_t>(session), static_cast<std::uint32_t>(generation), static_cast<std::uint32_t>(seq))
+#else
+#define COMMUNICATIONS_TRACE(stage, session, generation, seq) ((void)0)
+#endif
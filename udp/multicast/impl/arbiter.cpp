@@ -0,0 +1,315 @@
+#include "../../../communications.h"
+#include "../../../packet_field.h"
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      // Both lines are received on one strand, so the sequence state below is
+      // only ever touched by one thread at a time and needs no locking.
+      class arbiter
+        : public iarbiter
+      {
+        public:
+          arbiter(udp_multicast_arbiter_params_t& a_params, boost::asio::io_service& a_io_service);
+          void run() override;
+          void stop() override;
+          void set_on_data(std::function<void(std::uint64_t a_seq, const char *a_data, std::size_t a_len)> a_on_data) override;
+          void set_on_gap(std::function<void(std::uint64_t a_first, std::uint64_t a_last)> a_on_gap) override;
+          udp_multicast_arbiter_stats_t stats() override;
+
+        private:
+          enum class line_e
+          {
+              a,
+              b
+          };
+
+          // A line that jumps back by more than reset_threshold starts a new
+          // epoch; arbitration follows the newest epoch either line is on.
+          struct line_state_t
+          {
+            std::uint64_t last_seq = 0;
+            std::uint64_t epoch = 0;
+            bool has_seq = false;
+          };
+
+          struct gap_t
+          {
+            std::uint64_t first;
+            std::uint64_t last;
+            std::chrono::steady_clock::time_point deadline;
+          };
+
+          struct counters_t
+          {
+            std::atomic<std::uint64_t> received_a{0};
+            std::atomic<std::uint64_t> received_b{0};
+            std::atomic<std::uint64_t> delivered_a{0};
+            std::atomic<std::uint64_t> delivered_b{0};
+            std::atomic<std::uint64_t> duplicates{0};
+            std::atomic<std::uint64_t> gaps{0};
+            std::atomic<std::uint64_t> recovered{0};
+            std::atomic<std::uint64_t> lost{0};
+            std::atomic<std::uint64_t> malformed{0};
+            std::atomic<std::uint64_t> resets{0};
+          };
+
+          void on_line_data(line_e a_line, const char *a_data, std::size_t a_len);
+          bool is_current_epoch(line_e a_line, std::uint64_t a_seq);
+          void report_gaps(std::chrono::steady_clock::time_point a_until);
+          bool fill_gap(std::uint64_t a_seq);
+          void deliver(line_e a_line, std::uint64_t a_seq, const char *a_data, std::size_t a_len);
+          void arm_gap_timer();
+          static void increment(std::atomic<std::uint64_t>& a_counter, std::uint64_t a_value = 1);
+
+        private:
+          std::shared_ptr<udp_multicast_arbiter_params_t> m_params;
+          std::shared_ptr<boost::asio::io_service::strand> m_strand;
+          std::shared_ptr<boost::asio::steady_timer> m_gap_timer;
+          iclient::ref m_line_a;
+          iclient::ref m_line_b;
+          std::function<void(std::uint64_t a_seq, const char *a_data, std::size_t a_len)> m_on_data_func;
+          std::function<void(std::uint64_t a_first, std::uint64_t a_last)> m_on_gap_func;
+          std::deque<gap_t> m_gaps;
+          line_state_t m_lines[2];
+          std::uint64_t m_epoch{0};
+          std::uint64_t m_next_seq{0};
+          bool m_has_seq{false};
+          bool m_gap_timer_armed{false};
+          bool m_is_run{true};
+          counters_t m_counters;
+      };
+
+      arbiter::arbiter(udp_multicast_arbiter_params_t& a_params, boost::asio::io_service& a_io_service)
+        : m_params(std::make_shared<udp_multicast_arbiter_params_t>(a_params))
+        , m_strand(std::make_shared<boost::asio::io_service::strand>(a_io_service))
+        , m_gap_timer(std::make_shared<boost::asio::steady_timer>(a_io_service))
+      {
+        m_params->line_a.use_strand = true;
+        m_params->line_b.use_strand = true;
+        m_line_a = create_client(m_params->line_a, m_strand);
+        m_line_b = create_client(m_params->line_b, m_strand);
+
+        m_line_a->set_on_data([this](const char *a_data, std::size_t a_len)
+        {
+          on_line_data(line_e::a, a_data, a_len);
+        });
+        m_line_b->set_on_data([this](const char *a_data, std::size_t a_len)
+        {
+          on_line_data(line_e::b, a_data, a_len);
+        });
+      }
+
+      void arbiter::run()
+      {
+        m_line_a->run();
+        m_line_b->run();
+      }
+
+      void arbiter::stop()
+      {
+        m_line_a->stop();
+        m_line_b->stop();
+        m_strand->post([this]
+        {
+          m_is_run = false;
+          m_gap_timer->cancel();
+        });
+      }
+
+      void arbiter::set_on_data(std::function<void(std::uint64_t a_seq, const char *a_data, std::size_t a_len)> a_on_data)
+      {
+        m_on_data_func = a_on_data;
+      }
+
+      void arbiter::set_on_gap(std::function<void(std::uint64_t a_first, std::uint64_t a_last)> a_on_gap)
+      {
+        m_on_gap_func = a_on_gap;
+      }
+
+      udp_multicast_arbiter_stats_t arbiter::stats()
+      {
+        udp_multicast_arbiter_stats_t stats;
+        stats.received_a = m_counters.received_a.load(std::memory_order_relaxed);
+        stats.received_b = m_counters.received_b.load(std::memory_order_relaxed);
+        stats.delivered_a = m_counters.delivered_a.load(std::memory_order_relaxed);
+        stats.delivered_b = m_counters.delivered_b.load(std::memory_order_relaxed);
+        stats.duplicates = m_counters.duplicates.load(std::memory_order_relaxed);
+        stats.gaps = m_counters.gaps.load(std::memory_order_relaxed);
+        stats.recovered = m_counters.recovered.load(std::memory_order_relaxed);
+        stats.lost = m_counters.lost.load(std::memory_order_relaxed);
+        stats.malformed = m_counters.malformed.load(std::memory_order_relaxed);
+        stats.resets = m_counters.resets.load(std::memory_order_relaxed);
+        return stats;
+      }
+
+      void arbiter::on_line_data(line_e a_line, const char *a_data, std::size_t a_len)
+      {
+        if(!m_is_run)
+          return;
+
+        increment(a_line == line_e::a ? m_counters.received_a : m_counters.received_b);
+
+        std::uint64_t seq;
+        if(!read_packet_field(m_params->sequence, a_data, a_len, seq))
+        {
+          increment(m_counters.malformed);
+          return;
+        }
+
+        if(!is_current_epoch(a_line, seq))
+        {
+          increment(m_counters.duplicates);
+          return;
+        }
+
+        if(!m_has_seq)
+        {
+          m_has_seq = true;
+          m_next_seq = seq;
+        }
+
+        if(seq == m_next_seq)
+        {
+          m_next_seq++;
+          deliver(a_line, seq, a_data, a_len);
+        }
+        else if(seq > m_next_seq)
+        {
+          m_gaps.push_back({m_next_seq, seq - 1, std::chrono::steady_clock::now() + std::chrono::milliseconds(m_params->gap_timeout_ms)});
+          increment(m_counters.gaps);
+          arm_gap_timer();
+
+          m_next_seq = seq + 1;
+          deliver(a_line, seq, a_data, a_len);
+        }
+        else if(fill_gap(seq))
+        {
+          increment(m_counters.recovered);
+          deliver(a_line, seq, a_data, a_len);
+        }
+        else
+          increment(m_counters.duplicates);
+      }
+
+      bool arbiter::is_current_epoch(line_e a_line, std::uint64_t a_seq)
+      {
+        line_state_t& line = m_lines[a_line == line_e::a ? 0 : 1];
+        if(!line.has_seq)
+        {
+          line.has_seq = true;
+          line.epoch = m_epoch;
+        }
+        else if(m_params->reset_threshold != 0 && a_seq < line.last_seq && line.last_seq - a_seq > m_params->reset_threshold)
+          line.epoch++;
+        line.last_seq = a_seq;
+
+        // The other line restarted first and this one still carries the old
+        // sequence; nothing on it can be told apart from the new one.
+        if(line.epoch < m_epoch)
+          return false;
+
+        if(line.epoch > m_epoch)
+        {
+          // Gaps in the old sequence can no longer be filled.
+          m_epoch = line.epoch;
+          report_gaps(std::chrono::steady_clock::time_point::max());
+          m_has_seq = false;
+          increment(m_counters.resets);
+        }
+        return true;
+      }
+
+      bool arbiter::fill_gap(std::uint64_t a_seq)
+      {
+        for(auto it = m_gaps.begin(); it != m_gaps.end(); ++it)
+        {
+          if(a_seq < it->first || a_seq > it->last)
+            continue;
+
+          if(it->first == it->last)
+            m_gaps.erase(it);
+          else if(a_seq == it->first)
+            it->first++;
+          else if(a_seq == it->last)
+            it->last--;
+          else
+          {
+            gap_t tail{a_seq + 1, it->last, it->deadline};
+            it->last = a_seq - 1;
+            m_gaps.insert(it + 1, tail);
+          }
+          return true;
+        }
+        return false;
+      }
+
+      void arbiter::deliver(line_e a_line, std::uint64_t a_seq, const char *a_data, std::size_t a_len)
+      {
+        increment(a_line == line_e::a ? m_counters.delivered_a : m_counters.delivered_b);
+
+        if(m_on_data_func != nullptr)
+          m_on_data_func(a_seq, a_data, a_len);
+      }
+
+      void arbiter::arm_gap_timer()
+      {
+        if(m_gap_timer_armed || m_gaps.empty())
+          return;
+
+        m_gap_timer_armed = true;
+        m_gap_timer->expires_at(m_gaps.front().deadline);
+        m_gap_timer->async_wait(m_strand->wrap([this](const boost::system::error_code& a_ec)
+        {
+          m_gap_timer_armed = false;
+          if(a_ec || !m_is_run)
+            return;
+
+          report_gaps(std::chrono::steady_clock::now());
+          arm_gap_timer();
+        }));
+      }
+
+      void arbiter::report_gaps(std::chrono::steady_clock::time_point a_until)
+      {
+        // Gaps are appended in arrival order and a split keeps its parent's
+        // deadline, so the deque stays sorted by deadline.
+        while(!m_gaps.empty() && m_gaps.front().deadline <= a_until)
+        {
+          gap_t gap = m_gaps.front();
+          m_gaps.pop_front();
+          increment(m_counters.lost, gap.last - gap.first + 1);
+
+          if(m_on_gap_func != nullptr)
+            m_on_gap_func(gap.first, gap.last);
+        }
+      }
+
+      void arbiter::increment(std::atomic<std::uint64_t>& a_counter, std::uint64_t a_value)
+      {
+        a_counter.store(a_counter.load(std::memory_order_relaxed) + a_value, std::memory_order_relaxed);
+      }
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      iarbiter::ref create_arbiter(udp_multicast_arbiter_params_t& a_params, boost::asio::io_service& a_io_service)
+      {
+        return std::make_shared<common::udp::multicast::arbiter>(a_params, a_io_service);
+      }
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
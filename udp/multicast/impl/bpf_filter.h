@@ -0,0 +1,343 @@
+#pragma once
+
+#include "../../../communacations_types.h"
+#include "../../../packet_field.h"
+#include <boost/system/system_error.hpp>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <linux/filter.h>
+#include <sys/socket.h>
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      using bpf_program_t = std::vector<struct sock_filter>;
+
+      const std::uint32_t bpf_accept = 0xffffffff;
+      const std::size_t udp_header_size = 8;
+      const std::size_t max_ip_header_size = 60;
+      const std::size_t bpf_fallthrough = std::numeric_limits<std::size_t>::max();
+
+      inline struct sock_filter bpf_stmt(std::uint16_t a_code, std::uint32_t a_k)
+      {
+        struct sock_filter insn = {a_code, 0, 0, a_k};
+        return insn;
+      }
+
+      // Emits classic BPF with symbolic jump targets. Conditional jumps only
+      // reach 255 instructions, so long jumps go through BPF_JA.
+      class bpf_builder
+      {
+        public:
+          std::size_t label()
+          {
+            m_labels.push_back(bpf_fallthrough);
+            return m_labels.size() - 1;
+          }
+
+          void bind(std::size_t a_label)
+          {
+            m_labels[a_label] = m_program.size();
+          }
+
+          void stmt(std::uint16_t a_code, std::uint32_t a_k)
+          {
+            m_program.push_back(bpf_stmt(a_code, a_k));
+            m_fixups.push_back({bpf_fallthrough, bpf_fallthrough, false});
+          }
+
+          void jump(std::uint16_t a_code, std::uint32_t a_k, std::size_t a_true, std::size_t a_false)
+          {
+            m_program.push_back(bpf_stmt(BPF_JMP | a_code | BPF_K, a_k));
+            m_fixups.push_back({a_true, a_false, false});
+          }
+
+          void jump_always(std::size_t a_label)
+          {
+            m_program.push_back(bpf_stmt(BPF_JMP | BPF_JA, 0));
+            m_fixups.push_back({a_label, bpf_fallthrough, true});
+          }
+
+          bpf_program_t build() const
+          {
+            bpf_program_t program = m_program;
+            for(std::size_t i = 0; i < program.size(); i++)
+            {
+              const fixup_t& fixup = m_fixups[i];
+              if(fixup.is_ja)
+                program[i].k = static_cast<std::uint32_t>(offset(i, fixup.jt));
+              else
+              {
+                program[i].jt = short_offset(i, fixup.jt);
+                program[i].jf = short_offset(i, fixup.jf);
+              }
+            }
+
+            if(program.size() > BPF_MAXINSNS)
+              throw std::length_error("bpf program too long");
+            return program;
+          }
+
+        private:
+          struct fixup_t
+          {
+            std::size_t jt;
+            std::size_t jf;
+            bool is_ja;
+          };
+
+          std::size_t offset(std::size_t a_from, std::size_t a_label) const
+          {
+            if(a_label == bpf_fallthrough)
+              return 0;
+            return m_labels[a_label] - a_from - 1;
+          }
+
+          std::uint8_t short_offset(std::size_t a_from, std::size_t a_label) const
+          {
+            std::size_t result = offset(a_from, a_label);
+            if(result > 255)
+              throw std::length_error("bpf conditional jump out of range");
+            return static_cast<std::uint8_t>(result);
+          }
+
+        private:
+          bpf_program_t m_program;
+          std::vector<fixup_t> m_fixups;
+          std::vector<std::size_t> m_labels;
+      };
+
+      // Falls through for IPv4/UDP packets from a_source_ip to
+      // a_group_ip:a_port and leaves the IP header length in X; everything
+      // else is dropped. Packet data must start at the IP header, which is
+      // what an AF_PACKET/SOCK_DGRAM socket sees.
+      inline void emit_source_group_match(bpf_builder& a_builder, const std::string& a_source_ip, const std::string& a_group_ip, std::uint16_t a_port)
+      {
+        auto drop = a_builder.label();
+        auto match = a_builder.label();
+
+        a_builder.stmt(BPF_LD | BPF_B | BPF_ABS, 9);
+        a_builder.jump(BPF_JEQ, IPPROTO_UDP, bpf_fallthrough, drop);
+        a_builder.stmt(BPF_LD | BPF_W | BPF_ABS, 12);
+        a_builder.jump(BPF_JEQ, ntohl(inet_addr(a_source_ip.c_str())), bpf_fallthrough, drop);
+        a_builder.stmt(BPF_LD | BPF_W | BPF_ABS, 16);
+        a_builder.jump(BPF_JEQ, ntohl(inet_addr(a_group_ip.c_str())), bpf_fallthrough, drop);
+        a_builder.stmt(BPF_LD | BPF_H | BPF_ABS, 6);
+        a_builder.jump(BPF_JSET, 0x1fff, drop, bpf_fallthrough);
+        a_builder.stmt(BPF_LDX | BPF_B | BPF_MSH, 0);
+        a_builder.stmt(BPF_LD | BPF_H | BPF_IND, 2);
+        a_builder.jump(BPF_JEQ, a_port, match, bpf_fallthrough);
+        a_builder.bind(drop);
+        a_builder.stmt(BPF_RET | BPF_K, 0);
+        a_builder.bind(match);
+      }
+
+      enum class bpf_payload_base_e
+      {
+          udp_header,       // packet data starts at the UDP header (UDP socket)
+          ip_header_in_x    // X holds the IP header length (packet socket)
+      };
+
+      inline std::uint32_t bpf_field_value(const packet_field_t& a_field, std::uint64_t a_value)
+      {
+        std::uint32_t value = static_cast<std::uint32_t>(a_value);
+        if(a_field.byte_order == byte_order_e::little_endian)
+        {
+          if(a_field.width == 2)
+            value = ((value & 0xff) << 8) | ((value >> 8) & 0xff);
+          else if(a_field.width == 4)
+            value = __builtin_bswap32(value);
+        }
+        return value;
+      }
+
+      // Every filter must match for a datagram to be accepted. A rejected
+      // datagram is dropped in the kernel, except that with a_sample_rate N
+      // one in N (on average, via SKF_AD_RANDOM) is passed up cut to
+      // a_snap_len bytes so user space can tell which filter rejected it.
+      inline void emit_payload_filters(bpf_builder& a_builder, const std::vector<udp_multicast_filter_t>& a_filters, bpf_payload_base_e a_base, std::uint32_t a_sample_rate, std::uint32_t a_snap_len)
+      {
+        for(const auto& filter : a_filters)
+        {
+          if(filter.values.empty() && filter.ranges.empty())
+            continue;
+
+          std::uint16_t size;
+          switch(filter.field.width)
+          {
+            case 1:
+              size = BPF_B;
+              break;
+            case 2:
+              size = BPF_H;
+              break;
+            case 4:
+              size = BPF_W;
+              break;
+            default:
+              throw std::invalid_argument("bpf filter field width must be 1, 2 or 4");
+          }
+          if(!filter.ranges.empty() && filter.field.byte_order == byte_order_e::little_endian && filter.field.width > 1)
+            throw std::invalid_argument("bpf filter ranges need a big-endian field");
+
+          auto match = a_builder.label();
+          std::uint32_t k = static_cast<std::uint32_t>(udp_header_size + filter.field.offset);
+          a_builder.stmt(BPF_LD | size | (a_base == bpf_payload_base_e::udp_header ? BPF_ABS : BPF_IND), k);
+
+          for(auto value : filter.values)
+          {
+            auto next = a_builder.label();
+            a_builder.jump(BPF_JEQ, bpf_field_value(filter.field, value), bpf_fallthrough, next);
+            a_builder.jump_always(match);
+            a_builder.bind(next);
+          }
+
+          for(const auto& range : filter.ranges)
+          {
+            auto next = a_builder.label();
+            a_builder.jump(BPF_JGE, static_cast<std::uint32_t>(range.first), bpf_fallthrough, next);
+            a_builder.jump(BPF_JGT, static_cast<std::uint32_t>(range.second), next, bpf_fallthrough);
+            a_builder.jump_always(match);
+            a_builder.bind(next);
+          }
+
+          if(a_sample_rate > 0)
+          {
+            auto drop = a_builder.label();
+            a_builder.stmt(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_RANDOM);
+            a_builder.stmt(BPF_ALU | BPF_MOD | BPF_K, a_sample_rate);
+            a_builder.jump(BPF_JEQ, 0, bpf_fallthrough, drop);
+            a_builder.stmt(BPF_RET | BPF_K, a_snap_len);
+            a_builder.bind(drop);
+          }
+          a_builder.stmt(BPF_RET | BPF_K, 0);
+          a_builder.bind(match);
+        }
+      }
+
+      inline std::size_t payload_filters_span(const std::vector<udp_multicast_filter_t>& a_filters)
+      {
+        std::size_t span = 0;
+        for(const auto& filter : a_filters)
+        {
+          if(filter.field.offset + filter.field.width > span)
+            span = filter.field.offset + filter.field.width;
+        }
+        return span;
+      }
+
+      // Program for a UDP socket: the payload filters alone.
+      inline bpf_program_t compile_socket_filter(const std::vector<udp_multicast_filter_t>& a_filters, std::uint32_t a_sample_rate)
+      {
+        bpf_builder builder;
+        std::uint32_t snap_len = static_cast<std::uint32_t>(udp_header_size + payload_filters_span(a_filters));
+        emit_payload_filters(builder, a_filters, bpf_payload_base_e::udp_header, a_sample_rate, snap_len);
+        builder.stmt(BPF_RET | BPF_K, bpf_accept);
+        return builder.build();
+      }
+
+      // Program for an AF_PACKET/SOCK_DGRAM socket: flow match, then the
+      // payload filters.
+      inline bpf_program_t compile_packet_filter(const std::string& a_source_ip, const std::string& a_group_ip, std::uint16_t a_port, const std::vector<udp_multicast_filter_t>& a_filters, std::uint32_t a_sample_rate)
+      {
+        bpf_builder builder;
+        std::uint32_t snap_len = static_cast<std::uint32_t>(max_ip_header_size + udp_header_size + payload_filters_span(a_filters));
+        emit_source_group_match(builder, a_source_ip, a_group_ip, a_port);
+        emit_payload_filters(builder, a_filters, bpf_payload_base_e::ip_header_in_x, a_sample_rate, snap_len);
+        builder.stmt(BPF_RET | BPF_K, bpf_accept);
+        return builder.build();
+      }
+
+      inline bpf_program_t drop_all_filter()
+      {
+        return bpf_program_t{bpf_stmt(BPF_RET | BPF_K, 0)};
+      }
+
+      inline void attach_filter(int a_fd, const bpf_program_t& a_program)
+      {
+        struct sock_fprog prog;
+        prog.len = static_cast<unsigned short>(a_program.size());
+        prog.filter = const_cast<struct sock_filter *>(a_program.data());
+        if(setsockopt(a_fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) != 0)
+          throw boost::system::system_error(errno, boost::system::system_category(), "SO_ATTACH_FILTER");
+      }
+
+      // User-space side of the kernel filter. With sampling on, anything the
+      // kernel passed up that fails a filter is a sampled reject: it is
+      // charged (times the sample rate) to the first filter it fails and
+      // must not be delivered.
+      class payload_filter
+      {
+        public:
+          payload_filter(const std::vector<udp_multicast_filter_t>& a_filters, std::uint32_t a_sample_rate)
+            : m_filters(a_filters)
+            , m_sample_rate(a_sample_rate)
+            , m_dropped(new std::atomic<std::uint64_t>[a_filters.size()])
+          {
+            for(std::size_t i = 0; i < m_filters.size(); i++)
+              m_dropped[i].store(0, std::memory_order_relaxed);
+          }
+
+          bool accept(const char *a_data, std::size_t a_len)
+          {
+            if(m_sample_rate == 0)
+              return true;
+
+            for(std::size_t i = 0; i < m_filters.size(); i++)
+            {
+              if(!matches(m_filters[i], a_data, a_len))
+              {
+                m_dropped[i].store(m_dropped[i].load(std::memory_order_relaxed) + m_sample_rate, std::memory_order_relaxed);
+                return false;
+              }
+            }
+            return true;
+          }
+
+          std::vector<std::uint64_t> dropped() const
+          {
+            std::vector<std::uint64_t> result(m_filters.size());
+            for(std::size_t i = 0; i < m_filters.size(); i++)
+              result[i] = m_dropped[i].load(std::memory_order_relaxed);
+            return result;
+          }
+
+        private:
+          static bool matches(const udp_multicast_filter_t& a_filter, const char *a_data, std::size_t a_len)
+          {
+            if(a_filter.values.empty() && a_filter.ranges.empty())
+              return true;
+
+            std::uint64_t value;
+            if(!read_packet_field(a_filter.field, a_data, a_len, value))
+              return false;
+
+            for(auto expected : a_filter.values)
+            {
+              if(value == expected)
+                return true;
+            }
+            for(const auto& range : a_filter.ranges)
+            {
+              if(value >= range.first && value <= range.second)
+                return true;
+            }
+            return false;
+          }
+
+        private:
+          std::vector<udp_multicast_filter_t> m_filters;
+          std::uint32_t m_sample_rate;
+          std::unique_ptr<std::atomic<std::uint64_t>[]> m_dropped;
+      };
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <boost/system/system_error.hpp>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      // On-disk layout: a fixed header followed by 8-byte aligned records, each
+      // a capture_record_t immediately followed by its payload.
+      const char capture_magic[8] = {'M', 'C', 'A', 'S', 'T', 'C', 'A', 'P'};
+      const std::uint32_t capture_version = 1;
+
+      struct capture_file_header_t
+      {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t reserved;
+        std::uint64_t data_end;
+        std::uint64_t records;
+      };
+
+      struct capture_record_t
+      {
+        std::uint64_t timestamp_ns;
+        std::uint32_t length;
+        std::uint32_t reserved;
+      };
+
+      inline std::size_t capture_record_size(std::size_t a_len)
+      {
+        return (sizeof(capture_record_t) + a_len + 7) & ~static_cast<std::size_t>(7);
+      }
+
+      inline void throw_capture_error(const char *a_what)
+      {
+        throw boost::system::system_error(errno, boost::system::system_category(), a_what);
+      }
+
+      class capture_writer
+      {
+        public:
+          capture_writer(const std::string& a_path, std::size_t a_grow_size)
+            : m_grow_size(a_grow_size < sizeof(capture_file_header_t) ? sizeof(capture_file_header_t) : a_grow_size)
+          {
+            m_fd = open(a_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if(m_fd < 0)
+              throw_capture_error("capture_writer open");
+
+            remap(m_grow_size);
+            capture_file_header_t *hdr = header();
+            memcpy(hdr->magic, capture_magic, sizeof(capture_magic));
+            hdr->version = capture_version;
+            hdr->reserved = 0;
+            hdr->data_end = sizeof(capture_file_header_t);
+            hdr->records = 0;
+          }
+
+          ~capture_writer()
+          {
+            std::size_t used = header()->data_end;
+            munmap(m_data, m_size);
+            // if the trim fails the file keeps its zero padding and data_end
+            // in the header still tells the reader where the records stop
+            int trimmed = ftruncate(m_fd, used);
+            (void)trimmed;
+            close(m_fd);
+          }
+
+          capture_writer(const capture_writer&) = delete;
+          capture_writer& operator=(const capture_writer&) = delete;
+
+          void append(std::uint64_t a_timestamp_ns, const char *a_data, std::size_t a_len)
+          {
+            std::size_t offset = header()->data_end;
+            std::size_t record_size = capture_record_size(a_len);
+            if(offset + record_size > m_size)
+              remap(m_size + (record_size > m_grow_size ? record_size : m_grow_size));
+
+            capture_record_t record{a_timestamp_ns, static_cast<std::uint32_t>(a_len), 0};
+            memcpy(m_data + offset, &record, sizeof(record));
+            memcpy(m_data + offset + sizeof(record), a_data, a_len);
+
+            header()->records++;
+            header()->data_end = offset + record_size;
+          }
+
+          std::uint64_t records()
+          {
+            return header()->records;
+          }
+
+        private:
+          capture_file_header_t *header()
+          {
+            return reinterpret_cast<capture_file_header_t *>(m_data);
+          }
+
+          void remap(std::size_t a_size)
+          {
+            if(ftruncate(m_fd, a_size) != 0)
+              throw_capture_error("capture_writer ftruncate");
+
+            void *data = (m_data == nullptr)
+                         ? mmap(nullptr, a_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0)
+                         : mremap(m_data, m_size, a_size, MREMAP_MAYMOVE);
+            if(data == MAP_FAILED)
+              throw_capture_error("capture_writer mmap");
+
+            m_data = static_cast<char *>(data);
+            m_size = a_size;
+          }
+
+        private:
+          const std::size_t m_grow_size;
+          int m_fd = -1;
+          char *m_data = nullptr;
+          std::size_t m_size = 0;
+      };
+
+      class capture_reader
+      {
+        public:
+          explicit capture_reader(const std::string& a_path)
+          {
+            int fd = open(a_path.c_str(), O_RDONLY);
+            if(fd < 0)
+              throw_capture_error("capture_reader open");
+
+            struct stat st;
+            if(fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(capture_file_header_t))
+            {
+              close(fd);
+              throw boost::system::system_error(EINVAL, boost::system::system_category(), "capture_reader truncated file");
+            }
+
+            m_size = st.st_size;
+            void *data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd);
+            if(data == MAP_FAILED)
+              throw_capture_error("capture_reader mmap");
+            m_data = static_cast<const char *>(data);
+            madvise(data, m_size, MADV_SEQUENTIAL);
+
+            const capture_file_header_t *hdr = reinterpret_cast<const capture_file_header_t *>(m_data);
+            if(memcmp(hdr->magic, capture_magic, sizeof(capture_magic)) != 0 || hdr->version != capture_version)
+            {
+              munmap(const_cast<char *>(m_data), m_size);
+              throw boost::system::system_error(EINVAL, boost::system::system_category(), "capture_reader bad header");
+            }
+            m_end = hdr->data_end < m_size ? hdr->data_end : m_size;
+            rewind();
+          }
+
+          ~capture_reader()
+          {
+            munmap(const_cast<char *>(m_data), m_size);
+          }
+
+          capture_reader(const capture_reader&) = delete;
+          capture_reader& operator=(const capture_reader&) = delete;
+
+          void rewind()
+          {
+            m_offset = sizeof(capture_file_header_t);
+          }
+
+          // Returns false at the end of the file; a_data points into the mapping.
+          bool next(std::uint64_t& a_timestamp_ns, const char *&a_data, std::size_t& a_len)
+          {
+            if(m_offset + sizeof(capture_record_t) > m_end)
+              return false;
+
+            capture_record_t record;
+            memcpy(&record, m_data + m_offset, sizeof(record));
+            if(m_offset + capture_record_size(record.length) > m_end)
+              return false;
+
+            a_timestamp_ns = record.timestamp_ns;
+            a_data = m_data + m_offset + sizeof(record);
+            a_len = record.length;
+            m_offset += capture_record_size(record.length);
+            return true;
+          }
+
+          bool peek_timestamp(std::uint64_t& a_timestamp_ns)
+          {
+            if(m_offset + sizeof(capture_record_t) > m_end)
+              return false;
+
+            memcpy(&a_timestamp_ns, m_data + m_offset, sizeof(a_timestamp_ns));
+            return true;
+          }
+
+        private:
+          const char *m_data = nullptr;
+          std::size_t m_size = 0;
+          std::size_t m_end = 0;
+          std::size_t m_offset = 0;
+      };
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
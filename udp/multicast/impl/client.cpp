@@ -1,4 +1,8 @@
 #include "../../../communications.h"
+#include "bpf_filter.h"
+#include "packet_client.h"
+#include "socket_options.h"
+#include <atomic>
 #include <functional>
 #include <iostream>
 
@@ -9,119 +13,59 @@ namespace common
     namespace multicast
     {
       using boost::asio::ip::udp;
-      using group_source_req_t = struct group_source_req;
-
-      struct mcast_join_source_group
-      {
-          mcast_join_source_group()
-            : m_data()
-          {}
-
-          mcast_join_source_group(std::string &source_ip, std::string &group_ip, int port, std::string &interface_name)
-            : mcast_join_source_group()
-          {
-            int ifname_number = if_nametoindex(interface_name.c_str());
-
-            struct sockaddr_in group_addr;
-            group_addr.sin_addr.s_addr = inet_addr(group_ip.c_str());
-            group_addr.sin_port = htons(port);
-            group_addr.sin_family = AF_INET;
-
-            struct sockaddr_in source_addr;
-            source_addr.sin_addr.s_addr = inet_addr(source_ip.c_str());
-            source_addr.sin_port = htons(port);
-            source_addr.sin_family = AF_INET;
-
-            memcpy(&(m_data.gsr_source), (struct sockaddr_storage *) &source_addr, sizeof(struct sockaddr_in));
-            memcpy(&(m_data.gsr_group), (struct sockaddr_storage *) &group_addr, sizeof(struct sockaddr_in));
-
-            m_data.gsr_interface = ifname_number;
-          }
-
-          template<typename Protocol>
-          int level(const Protocol&) const
-          {
-            return IPPROTO_IP;
-          }
-
-          template<typename Protocol>
-          int name(const Protocol&) const
-          {
-            return MCAST_JOIN_SOURCE_GROUP;
-          }
-
-          template<typename Protocol>
-          group_source_req_t* data(const Protocol&)
-          {
-            return &m_data;
-          }
-
-          template<typename Protocol>
-          const group_source_req_t* data(const Protocol&) const
-          {
-            return &m_data;
-          }
-
-          template<typename Protocol>
-          std::size_t size(const Protocol&) const
-          {
-            return sizeof(m_data);
-          }
-
-          template<typename Protocol>
-          void resize(const Protocol&, std::size_t s)
-          {
-            if (s != sizeof(m_data))
-            {
-              std::length_error ex("mcast_join_source_group socket option resize");
-              boost::asio::detail::throw_exception(ex);
-            }
-          }
-
-        private:
-          group_source_req_t m_data;
-      };
-
-      using so_timestamp = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_TIMESTAMP>;
-      using so_recvttl = boost::asio::detail::socket_option::boolean<IPPROTO_IP, IP_RECVTTL>;
-
-      const int buff_size =	16384;
-      using buf_array_t = std::array<char, buff_size>;
 
       class client
         : public iclient
       {
         public:
-          client(udp_multicast_params_t& a_params, boost::asio::io_service& a_io_service);
+          client(udp_multicast_params_t& a_params, std::shared_ptr<boost::asio::io_service::strand> a_strand);
           void run() override;
           void stop() override;
           void set_on_data(std::function<void(const char *a_data, std::size_t a_len)> a_on_data) override;
+          void set_on_packet(std::function<void(packet_handle a_packet)> a_on_packet) override;
+          udp_multicast_client_stats_t stats() override;
 
         protected:
           void do_receive() override;
 
+        private:
+          void do_receive_pooled();
+          void count_packet(std::size_t a_len);
+          static void increment(std::atomic<std::uint64_t>& a_counter, std::uint64_t a_value);
+
         private:
           std::shared_ptr<udp_multicast_params_t> m_params;
           std::shared_ptr<boost::asio::io_service::strand> m_strand;
           std::shared_ptr<boost::asio::ip::udp::socket> m_sock;
-          std::shared_ptr<boost::asio::ip::udp::endpoint> m_ep;
+          boost::asio::ip::udp::endpoint m_sender_ep;
           std::unique_ptr<buf_array_t> m_buffer = std::make_unique<buf_array_t>();
+          std::shared_ptr<packet_pool> m_pool;
+          std::unique_ptr<payload_filter> m_filter;
+          packet_handle m_pending;
           std::function<void(const char *a_data, std::size_t a_len)> m_on_data_func;
+          std::function<void(packet_handle a_packet)> m_on_packet_func;
+          std::atomic<std::uint64_t> m_packets{0};
+          std::atomic<std::uint64_t> m_bytes{0};
+          std::atomic<std::uint64_t> m_pool_exhausted{0};
+          std::atomic<std::uint64_t> m_truncated{0};
           bool m_is_run{true};
       };
 
-      client::client(udp_multicast_params_t& a_params, boost::asio::io_service& a_io_service)
+      client::client(udp_multicast_params_t& a_params, std::shared_ptr<boost::asio::io_service::strand> a_strand)
         : m_params(std::make_shared<udp_multicast_params_t>(a_params))
-        , m_strand(std::make_shared<boost::asio::io_service::strand>(a_io_service))
+        , m_strand(a_strand)
         , m_sock(std::make_shared<boost::asio::ip::udp::socket>(m_strand->get_io_service()))
-        , m_ep(std::make_shared<boost::asio::ip::udp::endpoint>(boost::asio::ip::address::from_string(a_params.group_ip.c_str()), a_params.port))
       {
-        m_sock->open(m_ep->protocol());
-        m_sock->set_option(boost::asio::ip::udp::socket::reuse_address(true));
-        m_sock->set_option(so_recvttl(true));
-        m_sock->set_option(so_timestamp(true));
-        m_sock->bind(*m_ep);
-        m_sock->set_option(mcast_join_source_group(m_params->source_ip, m_params->group_ip, m_params->port, m_params->interface_name));
+        if(!m_params->filters.empty())
+        {
+          open_source_group_socket(*m_sock, *m_params, compile_socket_filter(m_params->filters, m_params->filter_drop_sample_rate));
+          m_filter = std::make_unique<payload_filter>(m_params->filters, m_params->filter_drop_sample_rate);
+        }
+        else
+          open_source_group_socket(*m_sock, *m_params);
+
+        if(m_params->pool_size > 0)
+          m_pool = packet_pool::create(m_params->pool_size, m_params->pool_buffer_size);
       }
 
       void client::run()
@@ -139,17 +83,42 @@ namespace common
         m_on_data_func = a_on_data;
       }
 
+      void client::set_on_packet(std::function<void(packet_handle a_packet)> a_on_packet)
+      {
+        m_on_packet_func = a_on_packet;
+      }
+
+      udp_multicast_client_stats_t client::stats()
+      {
+        udp_multicast_client_stats_t stats;
+        stats.packets = m_packets.load(std::memory_order_relaxed);
+        stats.bytes = m_bytes.load(std::memory_order_relaxed);
+        stats.pool_exhausted = m_pool_exhausted.load(std::memory_order_relaxed);
+        stats.truncated = m_truncated.load(std::memory_order_relaxed);
+        if(m_filter != nullptr)
+          stats.filter_dropped = m_filter->dropped();
+        return stats;
+      }
+
       void client::do_receive()
       {
-        boost::asio::ip::udp::endpoint ep;
+        if(m_pool != nullptr)
+        {
+          do_receive_pooled();
+          return;
+        }
 
         auto read_handler = [this](boost::system::error_code ec, std::size_t bytes_recvd)
         {
           if(!m_is_run)
             return;
 
-          if(!ec && bytes_recvd > 0)
+          // MSG_TRUNC reports the full length of a datagram the buffer cut short
+          if(!ec && bytes_recvd > buff_size)
+            increment(m_truncated, 1);
+          else if(!ec && bytes_recvd > 0 && (m_filter == nullptr || m_filter->accept(m_buffer.get()->data(), bytes_recvd)))
           {
+            count_packet(bytes_recvd);
             if(m_on_data_func != nullptr)
               m_on_data_func(m_buffer.get()->data(), bytes_recvd);
           }
@@ -157,9 +126,59 @@ namespace common
         };
 
         if(m_params->use_strand)
-          m_sock->async_receive_from(boost::asio::buffer(m_buffer.get()->data(), buff_size), ep, m_strand->wrap(read_handler));
+          m_sock->async_receive_from(boost::asio::buffer(m_buffer.get()->data(), buff_size), m_sender_ep, MSG_TRUNC, m_strand->wrap(read_handler));
         else
-          m_sock->async_receive_from(boost::asio::buffer(m_buffer.get()->data(), buff_size), ep, read_handler);
+          m_sock->async_receive_from(boost::asio::buffer(m_buffer.get()->data(), buff_size), m_sender_ep, MSG_TRUNC, read_handler);
+      }
+
+      void client::do_receive_pooled()
+      {
+        // Only one receive is outstanding at a time, so the buffer being
+        // filled can live in m_pending. When the pool is dry the datagram is
+        // read into m_buffer and dropped.
+        m_pending = m_pool->acquire();
+        bool is_exhausted = !m_pending;
+        if(is_exhausted)
+          increment(m_pool_exhausted, 1);
+
+        auto read_handler = [this, is_exhausted](boost::system::error_code ec, std::size_t bytes_recvd)
+        {
+          if(!m_is_run)
+            return;
+
+          // pool_buffer_size is usually well under the 16 KB of the unpooled
+          // buffer; a longer datagram is counted rather than cut short
+          if(!ec && !is_exhausted && bytes_recvd > m_pending.capacity())
+            increment(m_truncated, 1);
+          else if(!ec && bytes_recvd > 0 && !is_exhausted && (m_filter == nullptr || m_filter->accept(m_pending.data(), bytes_recvd)))
+          {
+            count_packet(bytes_recvd);
+            m_pending.resize(bytes_recvd);
+            if(m_on_packet_func != nullptr)
+              m_on_packet_func(std::move(m_pending));
+            else if(m_on_data_func != nullptr)
+              m_on_data_func(m_pending.data(), bytes_recvd);
+          }
+          m_pending.reset();
+          do_receive();
+        };
+
+        auto buffer = is_exhausted ? boost::asio::buffer(m_buffer.get()->data(), buff_size) : boost::asio::buffer(m_pending.data(), m_pending.capacity());
+        if(m_params->use_strand)
+          m_sock->async_receive_from(buffer, m_sender_ep, MSG_TRUNC, m_strand->wrap(read_handler));
+        else
+          m_sock->async_receive_from(buffer, m_sender_ep, MSG_TRUNC, read_handler);
+      }
+
+      void client::count_packet(std::size_t a_len)
+      {
+        increment(m_packets, 1);
+        increment(m_bytes, a_len);
+      }
+
+      void client::increment(std::atomic<std::uint64_t>& a_counter, std::uint64_t a_value)
+      {
+        a_counter.store(a_counter.load(std::memory_order_relaxed) + a_value, std::memory_order_relaxed);
       }
 
       iclient::ref create_client(const std::string& a_group_ip, const std::string& a_source_ip, const int a_port, const std::string& a_interface, boost::asio::io_service::strand& a_strand);
@@ -175,7 +194,14 @@ namespace common
     {
       iclient::ref create_client(udp_multicast_params_t& a_params, boost::asio::io_service& a_io_service)
       {
-        return std::make_shared<common::udp::multicast::client>(a_params, a_io_service);
+        return create_client(a_params, std::make_shared<boost::asio::io_service::strand>(a_io_service));
+      }
+
+      iclient::ref create_client(udp_multicast_params_t& a_params, std::shared_ptr<boost::asio::io_service::strand> a_strand)
+      {
+        if(a_params.backend == udp_multicast_backend_e::packet_mmap)
+          return create_packet_client(a_params, a_strand);
+        return std::make_shared<common::udp::multicast::client>(a_params, a_strand);
       }
     } //namespace multicast
   } //namespace udp
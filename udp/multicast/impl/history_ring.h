@@ -0,0 +1,144 @@
+#pragma once
+
+#include <boost/system/system_error.hpp>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      // The most recent datagrams by sequence number, in a fixed-size memory
+      // mapping: a file when a path is given, anonymous memory otherwise.
+      // Records are appended round the ring, 8-byte aligned and never split
+      // across its end, and overwrite the oldest. An index of a_slots
+      // entries addressed by seq % a_slots finds them again. Positions are
+      // counted from the start of the stream, so whether an entry's record
+      // has since been overwritten is a single comparison with the head.
+      class history_ring
+      {
+        public:
+          history_ring(const std::string& a_path, std::size_t a_size, std::size_t a_slots)
+            : m_size(a_size & ~static_cast<std::size_t>(7))
+            , m_slots(a_slots == 0 ? 1 : a_slots)
+          {
+            int flags = MAP_SHARED;
+            if(a_path.empty())
+              flags |= MAP_ANONYMOUS;
+            else
+            {
+              m_fd = open(a_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+              if(m_fd < 0)
+                throw_error("history_ring open");
+              if(ftruncate(m_fd, m_size) != 0)
+                throw_error("history_ring ftruncate");
+            }
+
+            void *data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, flags, m_fd, 0);
+            if(data == MAP_FAILED)
+              throw_error("history_ring mmap");
+            m_data = static_cast<char *>(data);
+          }
+
+          ~history_ring()
+          {
+            munmap(m_data, m_size);
+            if(m_fd >= 0)
+              close(m_fd);
+          }
+
+          history_ring(const history_ring&) = delete;
+          history_ring& operator=(const history_ring&) = delete;
+
+          // false if the datagram cannot fit in the ring at all
+          bool append(std::uint64_t a_seq, const char *a_data, std::size_t a_len)
+          {
+            std::size_t size = record_size(a_len);
+            if(size > m_size)
+              return false;
+
+            std::size_t offset = m_head % m_size;
+            if(offset + size > m_size)
+            {
+              m_head += m_size - offset;
+              offset = 0;
+            }
+
+            record_t record{a_seq, static_cast<std::uint32_t>(a_len), 0};
+            memcpy(m_data + offset, &record, sizeof(record));
+            memcpy(m_data + offset + sizeof(record), a_data, a_len);
+            m_index[a_seq % m_slots] = {a_seq, m_head, true};
+            m_head += size;
+
+            if(!m_has_seq || a_seq > m_newest)
+              m_newest = a_seq;
+            m_has_seq = true;
+            return true;
+          }
+
+          bool find(std::uint64_t a_seq, const char *&a_data, std::size_t& a_len) const
+          {
+            const slot_t& slot = m_index[a_seq % m_slots];
+            if(!slot.is_used || slot.seq != a_seq || m_head > slot.pos + m_size)
+              return false;
+
+            const char *rec = m_data + slot.pos % m_size;
+            record_t record;
+            memcpy(&record, rec, sizeof(record));
+            a_data = rec + sizeof(record);
+            a_len = record.length;
+            return true;
+          }
+
+          // true once a_seq has been stored, whether or not it is still held
+          bool has_seen(std::uint64_t a_seq) const
+          {
+            return m_has_seq && a_seq <= m_newest;
+          }
+
+        private:
+          struct record_t
+          {
+            std::uint64_t seq;
+            std::uint32_t length;
+            std::uint32_t reserved;
+          };
+
+          struct slot_t
+          {
+            std::uint64_t seq = 0;
+            std::uint64_t pos = 0;
+            bool is_used = false;
+          };
+
+          static std::size_t record_size(std::size_t a_len)
+          {
+            return (sizeof(record_t) + a_len + 7) & ~static_cast<std::size_t>(7);
+          }
+
+          static void throw_error(const char *a_what)
+          {
+            throw boost::system::system_error(errno, boost::system::system_category(), a_what);
+          }
+
+        private:
+          int m_fd = -1;
+          char *m_data = nullptr;
+          std::size_t m_size;
+          std::size_t m_slots;
+          std::vector<slot_t> m_index = std::vector<slot_t>(m_slots);
+          std::uint64_t m_head = 0;
+          std::uint64_t m_newest = 0;
+          bool m_has_seq = false;
+      };
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
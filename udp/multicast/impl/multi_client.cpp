@@ -0,0 +1,350 @@
+#include "../../../communications.h"
+#include "socket_options.h"
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      const int recv_batch_size = 32;
+      const int poll_timeout_ms = 100;
+
+      // Receives any number of (source, group, port) subscriptions from one
+      // thread. Groups sharing a port share a socket (up to the kernel's
+      // per-socket membership limit) and are told apart by IP_PKTINFO and
+      // the sender address: a datagram goes to the subscription naming its
+      // source, else to the one for any source on its group and port.
+      class multi_client
+        : public imulti_client
+      {
+        public:
+          explicit multi_client(udp_multicast_multi_params_t& a_params);
+          ~multi_client() override;
+          void run() override;
+          void stop() override;
+          void set_on_data(std::size_t a_group, std::function<void(const char *a_data, std::size_t a_len)> a_on_data) override;
+          udp_multicast_group_stats_t stats(std::size_t a_group) override;
+          std::uint64_t unmatched_count() override;
+
+        private:
+          struct counters_t
+          {
+            std::atomic<std::uint64_t> packets{0};
+            std::atomic<std::uint64_t> bytes{0};
+          };
+
+          // source_addr is 0 for any source
+          struct subscription_t
+          {
+            std::uint32_t source_addr;
+            std::size_t index;
+          };
+
+          struct batch_t
+          {
+            std::array<buf_array_t, recv_batch_size> buffers;
+            std::array<std::array<char, CMSG_SPACE(sizeof(struct in_pktinfo))>, recv_batch_size> controls;
+            std::array<struct sockaddr_in, recv_batch_size> sources;
+            std::array<struct iovec, recv_batch_size> iovecs;
+            std::array<struct mmsghdr, recv_batch_size> msgs;
+          };
+
+          void open_sockets();
+          std::shared_ptr<boost::asio::ip::udp::socket> open_socket(std::uint16_t a_port);
+          void receive_loop();
+          void drain(std::size_t a_sock_index);
+          void dispatch(std::uint16_t a_port, const struct msghdr& a_msg, std::size_t a_len);
+          static std::uint64_t group_key(std::uint32_t a_group_addr, std::uint16_t a_port);
+          static std::size_t max_memberships();
+
+        private:
+          std::shared_ptr<udp_multicast_multi_params_t> m_params;
+          boost::asio::io_service m_io_service;
+          std::vector<std::shared_ptr<boost::asio::ip::udp::socket>> m_socks;
+          std::vector<std::uint16_t> m_sock_ports;
+          std::unordered_map<std::uint64_t, std::vector<subscription_t>> m_groups;
+          std::vector<std::function<void(const char *a_data, std::size_t a_len)>> m_on_data_funcs;
+          std::unique_ptr<counters_t[]> m_counters;
+          std::atomic<std::uint64_t> m_unmatched{0};
+          std::unique_ptr<batch_t> m_batch = std::make_unique<batch_t>();
+          std::thread m_thread;
+          std::atomic<bool> m_is_run{false};
+      };
+
+      multi_client::multi_client(udp_multicast_multi_params_t& a_params)
+        : m_params(std::make_shared<udp_multicast_multi_params_t>(a_params))
+        , m_on_data_funcs(a_params.groups.size())
+        , m_counters(new counters_t[a_params.groups.size()])
+      {
+        for(std::size_t i = 0; i < m_params->groups.size(); i++)
+        {
+          const auto& group = m_params->groups[i];
+          const std::uint32_t source_addr = group.source_ip.empty() ? 0 : inet_addr(group.source_ip.c_str());
+          auto& subscriptions = m_groups[group_key(inet_addr(group.group_ip.c_str()), group.port)];
+          for(const auto& subscription : subscriptions)
+          {
+            if(subscription.source_addr == source_addr)
+              throw std::invalid_argument("multicast subscription " + group.source_ip + " " + group.group_ip + ":" + std::to_string(group.port) + " listed twice");
+          }
+          subscriptions.push_back(subscription_t{source_addr, i});
+        }
+
+        for(int i = 0; i < recv_batch_size; i++)
+        {
+          m_batch->iovecs[i].iov_base = m_batch->buffers[i].data();
+          m_batch->iovecs[i].iov_len = buff_size;
+        }
+
+        open_sockets();
+      }
+
+      multi_client::~multi_client()
+      {
+        stop();
+      }
+
+      void multi_client::run()
+      {
+        if(m_is_run.exchange(true))
+          return;
+
+        m_thread = std::thread([this]{
+          if(m_params->cpu_core >= 0)
+          {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            CPU_SET(m_params->cpu_core, &cpu_set);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+          }
+          receive_loop();
+        });
+      }
+
+      void multi_client::stop()
+      {
+        m_is_run = false;
+        if(m_thread.joinable() && m_thread.get_id() != std::this_thread::get_id())
+          m_thread.join();
+      }
+
+      void multi_client::set_on_data(std::size_t a_group, std::function<void(const char *a_data, std::size_t a_len)> a_on_data)
+      {
+        if(a_group < m_on_data_funcs.size())
+          m_on_data_funcs[a_group] = a_on_data;
+      }
+
+      udp_multicast_group_stats_t multi_client::stats(std::size_t a_group)
+      {
+        udp_multicast_group_stats_t stats;
+        if(a_group < m_on_data_funcs.size())
+        {
+          stats.packets = m_counters[a_group].packets.load(std::memory_order_relaxed);
+          stats.bytes = m_counters[a_group].bytes.load(std::memory_order_relaxed);
+        }
+        return stats;
+      }
+
+      std::uint64_t multi_client::unmatched_count()
+      {
+        return m_unmatched.load(std::memory_order_relaxed);
+      }
+
+      void multi_client::open_sockets()
+      {
+        // With IP_MULTICAST_ALL disabled a socket only sees the groups it has
+        // joined itself, so splitting one port over several sockets does not
+        // duplicate datagrams.
+        std::map<std::uint16_t, std::vector<std::size_t>> groups_by_port;
+        for(std::size_t i = 0; i < m_params->groups.size(); i++)
+          groups_by_port[m_params->groups[i].port].push_back(i);
+
+        // An any-source membership already brings every source of its group,
+        // so the group's source-specific entries are not joined as well
+        // (another socket would receive their datagrams a second time).
+        std::unordered_map<std::uint64_t, bool> is_any_source;
+        for(const auto& group : m_params->groups)
+        {
+          if(group.source_ip.empty())
+            is_any_source[group_key(inet_addr(group.group_ip.c_str()), group.port)] = true;
+        }
+
+        const std::size_t memberships = max_memberships();
+        for(auto& port_groups : groups_by_port)
+        {
+          std::shared_ptr<boost::asio::ip::udp::socket> sock;
+          std::size_t joined = 0;
+          for(auto index : port_groups.second)
+          {
+            auto group = m_params->groups[index];
+            if(!group.source_ip.empty() && is_any_source.count(group_key(inet_addr(group.group_ip.c_str()), group.port)) != 0)
+              continue;
+
+            if(sock == nullptr || joined == memberships)
+            {
+              sock = open_socket(port_groups.first);
+              joined = 0;
+            }
+
+            if(group.source_ip.empty())
+              sock->set_option(mcast_join_group(group.group_ip, group.port, m_params->interface_name));
+            else
+              sock->set_option(mcast_join_source_group(group.source_ip, group.group_ip, group.port, m_params->interface_name));
+            joined++;
+          }
+        }
+      }
+
+      std::shared_ptr<boost::asio::ip::udp::socket> multi_client::open_socket(std::uint16_t a_port)
+      {
+        boost::asio::ip::udp::endpoint ep(boost::asio::ip::address_v4::any(), a_port);
+        auto sock = std::make_shared<boost::asio::ip::udp::socket>(m_io_service);
+        sock->open(ep.protocol());
+        sock->set_option(boost::asio::ip::udp::socket::reuse_address(true));
+        sock->set_option(so_multicast_all(false));
+        sock->set_option(so_pktinfo(true));
+        apply_socket_options(*sock, m_params->socket_options);
+        sock->bind(ep);
+
+        m_socks.push_back(sock);
+        m_sock_ports.push_back(a_port);
+        return sock;
+      }
+
+      void multi_client::receive_loop()
+      {
+        std::vector<struct pollfd> fds(m_socks.size());
+        for(std::size_t i = 0; i < m_socks.size(); i++)
+        {
+          fds[i].fd = m_socks[i]->native_handle();
+          fds[i].events = POLLIN;
+        }
+
+        while(m_is_run)
+        {
+          int ready = poll(fds.data(), fds.size(), poll_timeout_ms);
+          if(ready <= 0)
+            continue;
+
+          for(std::size_t i = 0; i < fds.size(); i++)
+          {
+            if(fds[i].revents & POLLIN)
+              drain(i);
+          }
+        }
+      }
+
+      void multi_client::drain(std::size_t a_sock_index)
+      {
+        int fd = m_socks[a_sock_index]->native_handle();
+        while(true)
+        {
+          for(int i = 0; i < recv_batch_size; i++)
+          {
+            struct msghdr& hdr = m_batch->msgs[i].msg_hdr;
+            hdr.msg_name = &m_batch->sources[i];
+            hdr.msg_namelen = sizeof(m_batch->sources[i]);
+            hdr.msg_iov = &m_batch->iovecs[i];
+            hdr.msg_iovlen = 1;
+            hdr.msg_control = m_batch->controls[i].data();
+            hdr.msg_controllen = m_batch->controls[i].size();
+            hdr.msg_flags = 0;
+          }
+
+          int received = recvmmsg(fd, m_batch->msgs.data(), recv_batch_size, MSG_DONTWAIT, nullptr);
+          if(received <= 0)
+            return;
+
+          for(int i = 0; i < received; i++)
+            dispatch(m_sock_ports[a_sock_index], m_batch->msgs[i].msg_hdr, m_batch->msgs[i].msg_len);
+
+          if(received < recv_batch_size)
+            return;
+        }
+      }
+
+      void multi_client::dispatch(std::uint16_t a_port, const struct msghdr& a_msg, std::size_t a_len)
+      {
+        for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&a_msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(const_cast<struct msghdr *>(&a_msg), cmsg))
+        {
+          if(cmsg->cmsg_level != IPPROTO_IP || cmsg->cmsg_type != IP_PKTINFO)
+            continue;
+
+          struct in_pktinfo pktinfo;
+          memcpy(&pktinfo, CMSG_DATA(cmsg), sizeof(pktinfo));
+
+          auto found_it = m_groups.find(group_key(pktinfo.ipi_addr.s_addr, a_port));
+          if(found_it == m_groups.end())
+            break;
+
+          const std::uint32_t source_addr = static_cast<const struct sockaddr_in *>(a_msg.msg_name)->sin_addr.s_addr;
+          const subscription_t *matched = nullptr;
+          for(const auto& subscription : found_it->second)
+          {
+            if(subscription.source_addr == source_addr)
+            {
+              matched = &subscription;
+              break;
+            }
+            if(subscription.source_addr == 0)
+              matched = &subscription;
+          }
+          if(matched == nullptr)
+            break;
+
+          auto& counters = m_counters[matched->index];
+          counters.packets.store(counters.packets.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+          counters.bytes.store(counters.bytes.load(std::memory_order_relaxed) + a_len, std::memory_order_relaxed);
+
+          auto& on_data = m_on_data_funcs[matched->index];
+          if(on_data != nullptr)
+            on_data(static_cast<const char *>(a_msg.msg_iov->iov_base), a_len);
+          return;
+        }
+
+        m_unmatched.store(m_unmatched.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      }
+
+      std::uint64_t multi_client::group_key(std::uint32_t a_group_addr, std::uint16_t a_port)
+      {
+        return (static_cast<std::uint64_t>(a_group_addr) << 16) | a_port;
+      }
+
+      std::size_t multi_client::max_memberships()
+      {
+        std::size_t memberships = 20;
+        std::ifstream proc("/proc/sys/net/ipv4/igmp_max_memberships");
+        if(proc)
+          proc >> memberships;
+        return memberships > 0 ? memberships : 1;
+      }
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      imulti_client::ref create_multi_client(udp_multicast_multi_params_t& a_params)
+      {
+        return std::make_shared<common::udp::multicast::multi_client>(a_params);
+      }
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
@@ -0,0 +1,292 @@
+#include "packet_client.h"
+#include "bpf_filter.h"
+#include "socket_options.h"
+#include <atomic>
+#include <functional>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <sys/mman.h>
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      const unsigned int packet_frame_size = 2048;
+
+      // Receives the configured (source, group, port) from an AF_PACKET
+      // TPACKET_V3 block ring and hands the UDP payload to on_data straight
+      // from the mapped block. A regular socket still joins the group, so the
+      // kernel and NIC accept the traffic, but it has a drop-all filter so
+      // nothing queues on it.
+      class packet_client
+        : public iclient
+      {
+        public:
+          packet_client(udp_multicast_params_t& a_params, std::shared_ptr<boost::asio::io_service::strand> a_strand);
+          ~packet_client() override;
+          void run() override;
+          void stop() override;
+          void set_on_data(std::function<void(const char *a_data, std::size_t a_len)> a_on_data) override;
+          void set_on_packet(std::function<void(packet_handle a_packet)> a_on_packet) override;
+          udp_multicast_client_stats_t stats() override;
+
+        protected:
+          void do_receive() override;
+
+        private:
+          void open_ring();
+          void drain_blocks();
+          void walk_block(struct tpacket_block_desc *a_block);
+          void deliver(const char *a_data, std::size_t a_len);
+          static void increment(std::atomic<std::uint64_t>& a_counter, std::uint64_t a_value);
+
+        private:
+          std::shared_ptr<udp_multicast_params_t> m_params;
+          std::shared_ptr<boost::asio::io_service::strand> m_strand;
+          std::shared_ptr<boost::asio::ip::udp::socket> m_join_sock;
+          std::shared_ptr<boost::asio::posix::stream_descriptor> m_packet_sock;
+          char *m_ring = nullptr;
+          std::size_t m_ring_size = 0;
+          std::size_t m_block_count = 0;
+          std::size_t m_block_size = 0;
+          std::size_t m_current_block = 0;
+          std::uint32_t m_source;
+          std::uint32_t m_group;
+          std::shared_ptr<packet_pool> m_pool;
+          std::unique_ptr<payload_filter> m_filter;
+          std::function<void(const char *a_data, std::size_t a_len)> m_on_data_func;
+          std::function<void(packet_handle a_packet)> m_on_packet_func;
+          std::atomic<std::uint64_t> m_packets{0};
+          std::atomic<std::uint64_t> m_bytes{0};
+          std::atomic<std::uint64_t> m_pool_exhausted{0};
+          std::atomic<std::uint64_t> m_truncated{0};
+          bool m_is_run{true};
+      };
+
+      packet_client::packet_client(udp_multicast_params_t& a_params, std::shared_ptr<boost::asio::io_service::strand> a_strand)
+        : m_params(std::make_shared<udp_multicast_params_t>(a_params))
+        , m_strand(a_strand)
+        , m_join_sock(std::make_shared<boost::asio::ip::udp::socket>(m_strand->get_io_service()))
+        , m_packet_sock(std::make_shared<boost::asio::posix::stream_descriptor>(m_strand->get_io_service()))
+        , m_source(inet_addr(a_params.source_ip.c_str()))
+        , m_group(inet_addr(a_params.group_ip.c_str()))
+      {
+        open_source_group_socket(*m_join_sock, *m_params, drop_all_filter());
+
+        if(!m_params->filters.empty())
+          m_filter = std::make_unique<payload_filter>(m_params->filters, m_params->filter_drop_sample_rate);
+
+        open_ring();
+
+        if(m_params->pool_size > 0)
+          m_pool = packet_pool::create(m_params->pool_size, m_params->pool_buffer_size);
+      }
+
+      packet_client::~packet_client()
+      {
+        if(m_ring != nullptr)
+          munmap(m_ring, m_ring_size);
+      }
+
+      void packet_client::run()
+      {
+        do_receive();
+      }
+
+      void packet_client::stop()
+      {
+        m_is_run = false;
+      }
+
+      void packet_client::set_on_data(std::function<void(const char *a_data, std::size_t a_len)> a_on_data)
+      {
+        m_on_data_func = a_on_data;
+      }
+
+      void packet_client::set_on_packet(std::function<void(packet_handle a_packet)> a_on_packet)
+      {
+        m_on_packet_func = a_on_packet;
+      }
+
+      udp_multicast_client_stats_t packet_client::stats()
+      {
+        udp_multicast_client_stats_t stats;
+        stats.packets = m_packets.load(std::memory_order_relaxed);
+        stats.bytes = m_bytes.load(std::memory_order_relaxed);
+        stats.pool_exhausted = m_pool_exhausted.load(std::memory_order_relaxed);
+        stats.truncated = m_truncated.load(std::memory_order_relaxed);
+        if(m_filter != nullptr)
+          stats.filter_dropped = m_filter->dropped();
+        return stats;
+      }
+
+      void packet_client::open_ring()
+      {
+        int fd = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP));
+        if(fd < 0)
+          throw boost::system::system_error(errno, boost::system::system_category(), "packet_client socket");
+        m_packet_sock->assign(fd);
+
+        int version = TPACKET_V3;
+        if(setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0)
+          throw boost::system::system_error(errno, boost::system::system_category(), "packet_client PACKET_VERSION");
+
+#ifdef PACKET_IGNORE_OUTGOING
+        int ignore_outgoing = 1;
+        setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignore_outgoing, sizeof(ignore_outgoing));
+#endif
+
+        attach_filter(fd, compile_packet_filter(m_params->source_ip, m_params->group_ip, m_params->port, m_params->filters, m_params->filter_drop_sample_rate));
+
+        long page_size = sysconf(_SC_PAGESIZE);
+        m_block_size = (m_params->packet_block_size + page_size - 1) / page_size * page_size;
+        m_block_count = m_params->packet_block_count == 0 ? 1 : m_params->packet_block_count;
+
+        struct tpacket_req3 req;
+        memset(&req, 0, sizeof(req));
+        req.tp_block_size = m_block_size;
+        req.tp_block_nr = m_block_count;
+        req.tp_frame_size = packet_frame_size;
+        req.tp_frame_nr = m_block_size / packet_frame_size * m_block_count;
+        req.tp_retire_blk_tov = m_params->packet_block_timeout_ms;
+        if(setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) != 0)
+          throw boost::system::system_error(errno, boost::system::system_category(), "packet_client PACKET_RX_RING");
+
+        m_ring_size = m_block_size * m_block_count;
+        void *ring = mmap(nullptr, m_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(ring == MAP_FAILED)
+          throw boost::system::system_error(errno, boost::system::system_category(), "packet_client mmap");
+        m_ring = static_cast<char *>(ring);
+
+        struct sockaddr_ll addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sll_family = AF_PACKET;
+        addr.sll_protocol = htons(ETH_P_IP);
+        addr.sll_ifindex = if_nametoindex(m_params->interface_name.c_str());
+        if(bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0)
+          throw boost::system::system_error(errno, boost::system::system_category(), "packet_client bind");
+      }
+
+      void packet_client::do_receive()
+      {
+        auto wait_handler = [this](boost::system::error_code ec, std::size_t /*bytes*/)
+        {
+          if(!m_is_run)
+            return;
+
+          if(!ec)
+            drain_blocks();
+          do_receive();
+        };
+
+        if(m_params->use_strand)
+          m_packet_sock->async_read_some(boost::asio::null_buffers(), m_strand->wrap(wait_handler));
+        else
+          m_packet_sock->async_read_some(boost::asio::null_buffers(), wait_handler);
+      }
+
+      void packet_client::drain_blocks()
+      {
+        while(true)
+        {
+          auto block = reinterpret_cast<struct tpacket_block_desc *>(m_ring + m_current_block * m_block_size);
+          if((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0)
+            return;
+
+          walk_block(block);
+
+          __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+          m_current_block = (m_current_block + 1) % m_block_count;
+        }
+      }
+
+      void packet_client::walk_block(struct tpacket_block_desc *a_block)
+      {
+        auto pkt = reinterpret_cast<struct tpacket3_hdr *>(reinterpret_cast<char *>(a_block) + a_block->hdr.bh1.offset_to_first_pkt);
+        for(std::uint32_t i = 0; i < a_block->hdr.bh1.num_pkts; i++)
+        {
+          auto ll = reinterpret_cast<const struct sockaddr_ll *>(reinterpret_cast<char *>(pkt) + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+          const char *ip_data = reinterpret_cast<char *>(pkt) + pkt->tp_net;
+          std::size_t ip_len = pkt->tp_snaplen;
+
+          // the BPF program already matched source, group and port; this only
+          // guards the header walk against short or looped-back frames
+          if(ll->sll_pkttype != PACKET_OUTGOING && ip_len >= sizeof(struct iphdr))
+          {
+            auto ip = reinterpret_cast<const struct iphdr *>(ip_data);
+            std::size_t ip_header_len = ip->ihl * 4;
+            if(ip->saddr == m_source && ip->daddr == m_group && ip_len >= ip_header_len + sizeof(struct udphdr))
+            {
+              auto udp = reinterpret_cast<const struct udphdr *>(ip_data + ip_header_len);
+              std::size_t udp_len = ntohs(udp->len);
+              const char *payload = ip_data + ip_header_len + sizeof(struct udphdr);
+              if(udp_len >= sizeof(struct udphdr) && ip_header_len + udp_len <= ip_len)
+              {
+                if(m_filter == nullptr || m_filter->accept(payload, udp_len - sizeof(struct udphdr)))
+                  deliver(payload, udp_len - sizeof(struct udphdr));
+              }
+              else if(m_filter != nullptr)
+              {
+                // a frame cut short by the filter is a sampled reject
+                m_filter->accept(payload, ip_len - ip_header_len - sizeof(struct udphdr));
+              }
+            }
+          }
+
+          pkt = reinterpret_cast<struct tpacket3_hdr *>(reinterpret_cast<char *>(pkt) + pkt->tp_next_offset);
+        }
+      }
+
+      void packet_client::deliver(const char *a_data, std::size_t a_len)
+      {
+        increment(m_packets, 1);
+        increment(m_bytes, a_len);
+
+        // the block goes back to the kernel after the walk, so a packet that
+        // is handed out as a handle has to be copied into the pool
+        if(m_on_packet_func != nullptr && m_pool != nullptr)
+        {
+          packet_handle packet = m_pool->acquire();
+          if(!packet)
+          {
+            increment(m_pool_exhausted, 1);
+            return;
+          }
+          if(a_len > packet.capacity())
+          {
+            increment(m_truncated, 1);
+            return;
+          }
+          memcpy(packet.data(), a_data, a_len);
+          packet.resize(a_len);
+          m_on_packet_func(std::move(packet));
+        }
+        else if(m_on_data_func != nullptr)
+          m_on_data_func(a_data, a_len);
+      }
+
+      void packet_client::increment(std::atomic<std::uint64_t>& a_counter, std::uint64_t a_value)
+      {
+        a_counter.store(a_counter.load(std::memory_order_relaxed) + a_value, std::memory_order_relaxed);
+      }
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      iclient::ref create_packet_client(udp_multicast_params_t& a_params, std::shared_ptr<boost::asio::io_service::strand> a_strand)
+      {
+        return std::make_shared<common::udp::multicast::packet_client>(a_params, a_strand);
+      }
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "../../../communications.h"
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      iclient::ref create_packet_client(udp_multicast_params_t& a_params, std::shared_ptr<boost::asio::io_service::strand> a_strand);
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
@@ -0,0 +1,290 @@
+#include "../../../communications.h"
+#include "../../../socket_profile.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <net/if.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      const std::size_t gso_max_segments = 64;
+      const std::size_t gso_max_payload = 65000;
+
+      // Datagrams are copied back to back into one batch buffer and flushed
+      // with a single sendmmsg. With GSO, runs of equally sized datagrams are
+      // handed to the kernel as one message and split there. A publisher is
+      // meant to be driven from one thread.
+      class publisher
+        : public ipublisher
+      {
+        public:
+          publisher(udp_multicast_publisher_params_t& a_params, boost::asio::io_service& a_io_service);
+          ~publisher() override;
+          void send(const char *a_data, std::size_t a_len) override;
+          void flush() override;
+          udp_multicast_publisher_stats_t stats() override;
+
+        private:
+          using control_t = std::array<char, CMSG_SPACE(sizeof(std::uint16_t))>;
+
+          void configure_socket();
+          std::size_t build_messages();
+          void send_messages(std::size_t a_count);
+          void pace(std::size_t a_packets);
+          static void increment(std::atomic<std::uint64_t>& a_counter, std::uint64_t a_value);
+
+        private:
+          std::shared_ptr<udp_multicast_publisher_params_t> m_params;
+          std::shared_ptr<boost::asio::ip::udp::socket> m_sock;
+          std::vector<char> m_buffer;
+          std::vector<std::size_t> m_lengths;
+          std::vector<struct mmsghdr> m_msgs;
+          std::vector<struct iovec> m_iovecs;
+          std::vector<control_t> m_controls;
+          std::vector<std::size_t> m_msg_packets;
+          std::size_t m_count{0};
+          std::size_t m_used{0};
+          double m_tokens{0};
+          std::chrono::steady_clock::time_point m_last_refill;
+          std::atomic<std::uint64_t> m_packets{0};
+          std::atomic<std::uint64_t> m_bytes{0};
+          std::atomic<std::uint64_t> m_send_calls{0};
+          std::atomic<std::uint64_t> m_errors{0};
+      };
+
+      publisher::publisher(udp_multicast_publisher_params_t& a_params, boost::asio::io_service& a_io_service)
+        : m_params(std::make_shared<udp_multicast_publisher_params_t>(a_params))
+        , m_sock(std::make_shared<boost::asio::ip::udp::socket>(a_io_service))
+        , m_last_refill(std::chrono::steady_clock::now())
+      {
+        if(m_params->batch_size == 0)
+          m_params->batch_size = 1;
+        if(m_params->gso_segment_size > m_params->max_datagram_size)
+          m_params->gso_segment_size = m_params->max_datagram_size;
+
+        m_buffer.resize(m_params->batch_size * m_params->max_datagram_size);
+        m_lengths.resize(m_params->batch_size);
+        m_msgs.resize(m_params->batch_size);
+        m_iovecs.resize(m_params->batch_size);
+        m_controls.resize(m_params->batch_size);
+        m_msg_packets.resize(m_params->batch_size);
+        m_tokens = static_cast<double>(m_params->batch_size);
+
+        configure_socket();
+      }
+
+      publisher::~publisher()
+      {
+        flush();
+      }
+
+      void publisher::send(const char *a_data, std::size_t a_len)
+      {
+        if(a_len > m_params->max_datagram_size)
+        {
+          flush();
+          pace(1);
+          increment(m_send_calls, 1);
+          if(::send(m_sock->native_handle(), a_data, a_len, 0) < 0)
+            increment(m_errors, 1);
+          else
+          {
+            increment(m_packets, 1);
+            increment(m_bytes, a_len);
+          }
+          return;
+        }
+
+        memcpy(m_buffer.data() + m_used, a_data, a_len);
+        m_lengths[m_count++] = a_len;
+        m_used += a_len;
+
+        if(m_count == m_params->batch_size)
+          flush();
+      }
+
+      void publisher::flush()
+      {
+        if(m_count == 0)
+          return;
+
+        pace(m_count);
+        send_messages(build_messages());
+        m_count = 0;
+        m_used = 0;
+      }
+
+      udp_multicast_publisher_stats_t publisher::stats()
+      {
+        udp_multicast_publisher_stats_t stats;
+        stats.packets = m_packets.load(std::memory_order_relaxed);
+        stats.bytes = m_bytes.load(std::memory_order_relaxed);
+        stats.send_calls = m_send_calls.load(std::memory_order_relaxed);
+        stats.errors = m_errors.load(std::memory_order_relaxed);
+        return stats;
+      }
+
+      void publisher::configure_socket()
+      {
+        boost::asio::ip::udp::endpoint ep(boost::asio::ip::address::from_string(m_params->group_ip.c_str()), m_params->port);
+        m_sock->open(ep.protocol());
+        m_sock->set_option(boost::asio::ip::multicast::hops(m_params->ttl));
+        m_sock->set_option(boost::asio::ip::multicast::enable_loopback(m_params->loopback));
+
+        int fd = m_sock->native_handle();
+        if(!m_params->interface_name.empty())
+        {
+          struct ip_mreqn mreq;
+          memset(&mreq, 0, sizeof(mreq));
+          mreq.imr_ifindex = if_nametoindex(m_params->interface_name.c_str());
+          if(setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof(mreq)) != 0)
+            throw boost::system::system_error(errno, boost::system::system_category(), "publisher IP_MULTICAST_IF");
+        }
+
+        // dscp is an explicit IP_TOS on top of the profile
+        socket_options_t options = m_params->socket_options;
+        if(m_params->dscp != 0)
+          options.tos = m_params->dscp << 2;
+        apply_socket_options(*m_sock, options);
+
+        // kernels without UDP GSO reject the option; fall back to one
+        // message per datagram
+        if(m_params->gso_segment_size != 0)
+        {
+          int segment = 0;
+          if(setsockopt(fd, SOL_UDP, UDP_SEGMENT, &segment, sizeof(segment)) != 0)
+            m_params->gso_segment_size = 0;
+        }
+
+        // receivers joined with a source-specific group only accept the
+        // configured source address
+        if(!m_params->source_ip.empty())
+          m_sock->bind(boost::asio::ip::udp::endpoint(boost::asio::ip::address::from_string(m_params->source_ip.c_str()), 0));
+        m_sock->connect(ep);
+      }
+
+      std::size_t publisher::build_messages()
+      {
+        const std::size_t segment = m_params->gso_segment_size;
+        std::size_t msg_count = 0;
+        std::size_t offset = 0;
+        std::size_t i = 0;
+        while(i < m_count)
+        {
+          std::size_t first = i;
+          std::size_t start = offset;
+          offset += m_lengths[i++];
+
+          // a GSO run is a series of full segments, optionally closed by one
+          // shorter datagram
+          if(segment != 0 && m_lengths[first] == segment)
+          {
+            while(i < m_count && i - first < gso_max_segments && m_lengths[i] <= segment && offset - start + m_lengths[i] <= gso_max_payload)
+            {
+              bool is_last = m_lengths[i] < segment;
+              offset += m_lengths[i++];
+              if(is_last)
+                break;
+            }
+          }
+
+          struct msghdr& hdr = m_msgs[msg_count].msg_hdr;
+          memset(&hdr, 0, sizeof(hdr));
+          m_iovecs[msg_count].iov_base = m_buffer.data() + start;
+          m_iovecs[msg_count].iov_len = offset - start;
+          hdr.msg_iov = &m_iovecs[msg_count];
+          hdr.msg_iovlen = 1;
+          m_msg_packets[msg_count] = i - first;
+
+          if(i - first > 1)
+          {
+            hdr.msg_control = m_controls[msg_count].data();
+            hdr.msg_controllen = m_controls[msg_count].size();
+            struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(std::uint16_t));
+            std::uint16_t segment_size = static_cast<std::uint16_t>(segment);
+            memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+          }
+          msg_count++;
+        }
+        return msg_count;
+      }
+
+      void publisher::send_messages(std::size_t a_count)
+      {
+        std::size_t sent = 0;
+        while(sent < a_count)
+        {
+          increment(m_send_calls, 1);
+          int result = sendmmsg(m_sock->native_handle(), m_msgs.data() + sent, a_count - sent, 0);
+          if(result < 0)
+          {
+            if(errno == EINTR)
+              continue;
+
+            // the failing message is dropped, the rest of the batch is retried
+            increment(m_errors, 1);
+            result = 1;
+          }
+          else
+          {
+            for(int i = 0; i < result; i++)
+            {
+              increment(m_packets, m_msg_packets[sent + i]);
+              increment(m_bytes, m_iovecs[sent + i].iov_len);
+            }
+          }
+          sent += result;
+        }
+      }
+
+      void publisher::pace(std::size_t a_packets)
+      {
+        if(m_params->max_packets_per_sec == 0)
+          return;
+
+        const double rate = static_cast<double>(m_params->max_packets_per_sec);
+        const double burst = static_cast<double>(m_params->batch_size > a_packets ? m_params->batch_size : a_packets);
+        while(true)
+        {
+          auto now = std::chrono::steady_clock::now();
+          m_tokens += std::chrono::duration<double>(now - m_last_refill).count() * rate;
+          if(m_tokens > burst)
+            m_tokens = burst;
+          m_last_refill = now;
+
+          if(m_tokens >= a_packets)
+            break;
+        }
+        m_tokens -= a_packets;
+      }
+
+      void publisher::increment(std::atomic<std::uint64_t>& a_counter, std::uint64_t a_value)
+      {
+        a_counter.store(a_counter.load(std::memory_order_relaxed) + a_value, std::memory_order_relaxed);
+      }
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      ipublisher::ref create_publisher(udp_multicast_publisher_params_t& a_params, boost::asio::io_service& a_io_service)
+      {
+        return std::make_shared<common::udp::multicast::publisher>(a_params, a_io_service);
+      }
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
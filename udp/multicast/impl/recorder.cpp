@@ -0,0 +1,161 @@
+#include "../../../communications.h"
+#include "capture_file.h"
+#include "socket_options.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <sys/socket.h>
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      class recorder
+        : public irecorder
+      {
+        public:
+          recorder(udp_multicast_recorder_params_t& a_params, boost::asio::io_service& a_io_service);
+          void run() override;
+          void stop() override;
+          void set_on_data(std::function<void(const char *a_data, std::size_t a_len)> a_on_data) override;
+          std::uint64_t recorded_count() override;
+
+        protected:
+          void do_receive() override;
+
+        private:
+          void drain();
+          static std::uint64_t kernel_timestamp(struct msghdr& a_msg);
+
+        private:
+          std::shared_ptr<udp_multicast_recorder_params_t> m_params;
+          std::shared_ptr<boost::asio::io_service::strand> m_strand;
+          std::shared_ptr<boost::asio::ip::udp::socket> m_sock;
+          std::unique_ptr<buf_array_t> m_buffer = std::make_unique<buf_array_t>();
+          std::unique_ptr<capture_writer> m_writer;
+          std::function<void(const char *a_data, std::size_t a_len)> m_on_data_func;
+          std::atomic<std::uint64_t> m_recorded{0};
+          bool m_is_run{true};
+      };
+
+      recorder::recorder(udp_multicast_recorder_params_t& a_params, boost::asio::io_service& a_io_service)
+        : m_params(std::make_shared<udp_multicast_recorder_params_t>(a_params))
+        , m_strand(std::make_shared<boost::asio::io_service::strand>(a_io_service))
+        , m_sock(std::make_shared<boost::asio::ip::udp::socket>(a_io_service))
+        , m_writer(std::make_unique<capture_writer>(a_params.file_path, a_params.grow_size))
+      {
+        open_source_group_socket(*m_sock, m_params->multicast);
+        m_sock->set_option(so_timestampns(true));
+        m_sock->non_blocking(true);
+      }
+
+      void recorder::run()
+      {
+        do_receive();
+      }
+
+      void recorder::stop()
+      {
+        m_is_run = false;
+      }
+
+      void recorder::set_on_data(std::function<void(const char *a_data, std::size_t a_len)> a_on_data)
+      {
+        m_on_data_func = a_on_data;
+      }
+
+      std::uint64_t recorder::recorded_count()
+      {
+        return m_recorded.load(std::memory_order_relaxed);
+      }
+
+      void recorder::do_receive()
+      {
+        // wait for readiness only; the datagrams are read with recvmsg so the
+        // kernel receive timestamp comes along with them
+        auto wait_handler = [this](boost::system::error_code ec, std::size_t /*bytes*/)
+        {
+          if(!m_is_run)
+            return;
+
+          if(!ec)
+            drain();
+          do_receive();
+        };
+
+        if(m_params->multicast.use_strand)
+          m_sock->async_receive(boost::asio::null_buffers(), m_strand->wrap(wait_handler));
+        else
+          m_sock->async_receive(boost::asio::null_buffers(), wait_handler);
+      }
+
+      void recorder::drain()
+      {
+        alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(int))];
+        struct iovec iov;
+        iov.iov_base = m_buffer->data();
+        iov.iov_len = buff_size;
+
+        while(true)
+        {
+          struct msghdr msg;
+          memset(&msg, 0, sizeof(msg));
+          msg.msg_iov = &iov;
+          msg.msg_iovlen = 1;
+          msg.msg_control = control;
+          msg.msg_controllen = sizeof(control);
+
+          ssize_t len = recvmsg(m_sock->native_handle(), &msg, MSG_DONTWAIT);
+          if(len < 0)
+            return;
+
+          m_writer->append(kernel_timestamp(msg), m_buffer->data(), len);
+          m_recorded.store(m_recorded.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+          if(m_on_data_func != nullptr)
+            m_on_data_func(m_buffer->data(), len);
+        }
+      }
+
+      std::uint64_t recorder::kernel_timestamp(struct msghdr& a_msg)
+      {
+        for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(&a_msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&a_msg, cmsg))
+        {
+          if(cmsg->cmsg_level != SOL_SOCKET)
+            continue;
+
+          if(cmsg->cmsg_type == SCM_TIMESTAMPNS)
+          {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+          }
+          if(cmsg->cmsg_type == SCM_TIMESTAMP)
+          {
+            struct timeval tv;
+            memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+            return static_cast<std::uint64_t>(tv.tv_sec) * 1000000000ULL + tv.tv_usec * 1000ULL;
+          }
+        }
+
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+      }
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      irecorder::ref create_recorder(udp_multicast_recorder_params_t& a_params, boost::asio::io_service& a_io_service)
+      {
+        return std::make_shared<common::udp::multicast::recorder>(a_params, a_io_service);
+      }
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
@@ -0,0 +1,221 @@
+#include "../../../communications.h"
+#include "../../../packet_field.h"
+#include "../../../tcp/framing.h"
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      // Datagrams arrive on the multicast client's threads and writability
+      // and connection events on the tcp server's; all subscriber state is
+      // under m_mutex. A subscriber is either live (every update is queued
+      // to its session) or conflating (updates overwrite the pending value
+      // of their key). It turns conflating when its queue passes
+      // max_queued_bytes; on the next on_writable the pending set is sent,
+      // and once a drain finds nothing pending it is live again.
+      class relay
+        : public irelay
+      {
+        public:
+          relay(udp_multicast_relay_params_t& a_params, boost::asio::io_service& a_io_service);
+          void run() override;
+          void stop() override;
+          udp_multicast_relay_stats_t stats() override;
+
+        private:
+          struct subscriber_t
+          {
+            bool is_conflating = false;
+            std::unordered_map<std::uint64_t, std::size_t> index;
+            std::vector<std::string> pending;
+          };
+
+          struct counters_t
+          {
+            std::atomic<std::uint64_t> received{0};
+            std::atomic<std::uint64_t> forwarded{0};
+            std::atomic<std::uint64_t> conflated{0};
+            std::atomic<std::uint64_t> flushed{0};
+            std::atomic<std::uint64_t> malformed{0};
+          };
+
+          void on_data(const char *a_data, std::size_t a_len);
+          void on_writable(const int a_client_id);
+          bool is_behind(const int a_client_id);
+          void send_frame(const int a_client_id, const char *a_data, std::size_t a_len);
+          static void increment(std::atomic<std::uint64_t>& a_counter, std::uint64_t a_value = 1);
+
+        private:
+          std::shared_ptr<udp_multicast_relay_params_t> m_params;
+          iclient::ref m_client;
+          tcp::iserver::ref m_server;
+          std::mutex m_mutex;
+          std::unordered_map<int, subscriber_t> m_subscribers;
+          counters_t m_counters;
+      };
+
+      relay::relay(udp_multicast_relay_params_t& a_params, boost::asio::io_service& a_io_service)
+        : m_params(std::make_shared<udp_multicast_relay_params_t>(a_params))
+        , m_client(create_client(m_params->multicast, a_io_service))
+        , m_server(tcp::create_server(m_params->tcp, a_io_service))
+      {
+        m_client->set_on_data([this](const char *a_data, std::size_t a_len)
+        {
+          on_data(a_data, a_len);
+        });
+        m_server->set_on_connected([this](const int a_client_id)
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          m_subscribers[a_client_id] = subscriber_t();
+        });
+        m_server->set_on_disconnected([this](const int a_client_id)
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          m_subscribers.erase(a_client_id);
+        });
+        m_server->set_on_writable([this](const int a_client_id)
+        {
+          on_writable(a_client_id);
+        });
+      }
+
+      void relay::run()
+      {
+        m_server->run();
+        m_client->run();
+      }
+
+      void relay::stop()
+      {
+        m_client->stop();
+        m_server->stop();
+      }
+
+      udp_multicast_relay_stats_t relay::stats()
+      {
+        udp_multicast_relay_stats_t stats;
+        stats.received = m_counters.received.load(std::memory_order_relaxed);
+        stats.forwarded = m_counters.forwarded.load(std::memory_order_relaxed);
+        stats.conflated = m_counters.conflated.load(std::memory_order_relaxed);
+        stats.flushed = m_counters.flushed.load(std::memory_order_relaxed);
+        stats.malformed = m_counters.malformed.load(std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        stats.subscribers = m_subscribers.size();
+        for(const auto& sub : m_subscribers)
+        {
+          if(sub.second.is_conflating)
+            stats.conflating++;
+        }
+        return stats;
+      }
+
+      void relay::on_data(const char *a_data, std::size_t a_len)
+      {
+        increment(m_counters.received);
+        std::uint64_t key;
+        if(!read_packet_field(m_params->key, a_data, a_len, key))
+        {
+          increment(m_counters.malformed);
+          return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for(auto& entry : m_subscribers)
+        {
+          subscriber_t& sub = entry.second;
+          if(!sub.is_conflating)
+          {
+            if(!is_behind(entry.first))
+            {
+              send_frame(entry.first, a_data, a_len);
+              increment(m_counters.forwarded);
+              continue;
+            }
+            sub.is_conflating = true;
+          }
+
+          auto found_it = sub.index.find(key);
+          if(found_it != sub.index.end())
+          {
+            sub.pending[found_it->second].assign(a_data, a_len);
+            increment(m_counters.conflated);
+          }
+          else
+          {
+            sub.index.emplace(key, sub.pending.size());
+            sub.pending.emplace_back(a_data, a_len);
+          }
+        }
+      }
+
+      void relay::on_writable(const int a_client_id)
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto found_it = m_subscribers.find(a_client_id);
+        if(found_it == m_subscribers.end() || !found_it->second.is_conflating)
+          return;
+
+        subscriber_t& sub = found_it->second;
+        if(sub.pending.empty())
+        {
+          sub.is_conflating = false;
+          return;
+        }
+
+        for(const auto& update : sub.pending)
+          send_frame(a_client_id, update.data(), update.size());
+        increment(m_counters.flushed, sub.pending.size());
+        sub.pending.clear();
+        sub.index.clear();
+      }
+
+      bool relay::is_behind(const int a_client_id)
+      {
+        std::size_t queued = 0;
+        for(const auto& lane : m_server->lane_depths(a_client_id))
+          queued += lane.bytes;
+        return queued > m_params->max_queued_bytes;
+      }
+
+      void relay::send_frame(const int a_client_id, const char *a_data, std::size_t a_len)
+      {
+        const std::uint32_t frame_len = static_cast<std::uint32_t>(tcp::LENGTH_PREFIX_SIZE + a_len);
+        m_server->send_encoded(a_client_id, frame_len, [a_data, a_len, frame_len](char *a_out)
+        {
+          memcpy(a_out, &frame_len, sizeof(frame_len));
+          memcpy(a_out + tcp::LENGTH_PREFIX_SIZE, a_data, a_len);
+        });
+      }
+
+      // on_data runs on several threads at once, and received and malformed
+      // are bumped outside m_mutex
+      void relay::increment(std::atomic<std::uint64_t>& a_counter, std::uint64_t a_value)
+      {
+        a_counter.fetch_add(a_value, std::memory_order_relaxed);
+      }
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      irelay::ref create_relay(udp_multicast_relay_params_t& a_params, boost::asio::io_service& a_io_service)
+      {
+        return std::make_shared<relay>(a_params, a_io_service);
+      }
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
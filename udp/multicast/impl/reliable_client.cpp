@@ -0,0 +1,333 @@
+#include "../../../communications.h"
+#include "../../../packet_field.h"
+#include "retransmit_protocol.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      // Multicast datagrams, retransmissions (posted over from the tcp
+      // client) and the NAK timer all run on one strand, so the sequence
+      // state below needs no locking. Datagrams after a gap wait in
+      // m_pending until the gap is filled or given up.
+      class reliable_client
+        : public ireliable_client
+      {
+        public:
+          reliable_client(udp_multicast_reliable_params_t& a_params, boost::asio::io_service& a_io_service);
+          void run() override;
+          void stop() override;
+          void set_on_data(std::function<void(std::uint64_t a_seq, const char *a_data, std::size_t a_len)> a_on_data) override;
+          void set_on_gap(std::function<void(std::uint64_t a_first, std::uint64_t a_last)> a_on_gap) override;
+          udp_multicast_reliable_stats_t stats() override;
+
+        private:
+          struct counters_t
+          {
+            std::atomic<std::uint64_t> received{0};
+            std::atomic<std::uint64_t> delivered{0};
+            std::atomic<std::uint64_t> duplicates{0};
+            std::atomic<std::uint64_t> gaps{0};
+            std::atomic<std::uint64_t> naks{0};
+            std::atomic<std::uint64_t> recovered{0};
+            std::atomic<std::uint64_t> lost{0};
+            std::atomic<std::uint64_t> malformed{0};
+          };
+
+          void on_packet(const char *a_data, std::size_t a_len, bool a_is_retransmit);
+          void on_retransmit(const std::string& a_frame);
+          void drain();
+          void lose(std::uint64_t a_last);
+          void deliver(std::uint64_t a_seq, const char *a_data, std::size_t a_len);
+          void send_nak(std::uint64_t a_first, std::uint64_t a_last);
+          void send_naks();
+          void arm_nak_timer();
+          void on_nak_timeout();
+          static void increment(std::atomic<std::uint64_t>& a_counter, std::uint64_t a_value = 1);
+
+        private:
+          std::shared_ptr<udp_multicast_reliable_params_t> m_params;
+          std::shared_ptr<boost::asio::io_service::strand> m_strand;
+          std::shared_ptr<boost::asio::steady_timer> m_nak_timer;
+          iclient::ref m_multicast;
+          tcp::iclient::ref m_retransmit;
+          std::function<void(std::uint64_t a_seq, const char *a_data, std::size_t a_len)> m_on_data_func;
+          std::function<void(std::uint64_t a_first, std::uint64_t a_last)> m_on_gap_func;
+          std::map<std::uint64_t, std::string> m_pending;
+          std::uint64_t m_next_seq{0};
+          std::uint64_t m_unavailable_up_to{0};
+          std::uint64_t m_nak_head{0};
+          std::uint32_t m_nak_attempts{0};
+          bool m_has_seq{false};
+          bool m_has_unavailable{false};
+          bool m_nak_timer_armed{false};
+          bool m_is_run{true};
+          counters_t m_counters;
+      };
+
+      reliable_client::reliable_client(udp_multicast_reliable_params_t& a_params, boost::asio::io_service& a_io_service)
+        : m_params(std::make_shared<udp_multicast_reliable_params_t>(a_params))
+        , m_strand(std::make_shared<boost::asio::io_service::strand>(a_io_service))
+        , m_nak_timer(std::make_shared<boost::asio::steady_timer>(a_io_service))
+      {
+        m_params->multicast.use_strand = true;
+        m_params->retransmit.do_read_type = read_func_type_e::length_prefixed;
+        m_multicast = create_client(m_params->multicast, m_strand);
+        m_retransmit = tcp::create_client(m_params->retransmit, a_io_service);
+
+        m_multicast->set_on_data([this](const char *a_data, std::size_t a_len)
+        {
+          on_packet(a_data, a_len, false);
+        });
+        m_retransmit->set_on_message([this](const std::string& a_frame)
+        {
+          m_strand->post([this, a_frame]
+          {
+            on_retransmit(a_frame);
+          });
+        });
+      }
+
+      void reliable_client::run()
+      {
+        m_retransmit->run();
+        m_multicast->run();
+      }
+
+      void reliable_client::stop()
+      {
+        m_multicast->stop();
+        m_strand->post([this]
+        {
+          m_is_run = false;
+          m_nak_timer->cancel();
+        });
+      }
+
+      void reliable_client::set_on_data(std::function<void(std::uint64_t a_seq, const char *a_data, std::size_t a_len)> a_on_data)
+      {
+        m_on_data_func = a_on_data;
+      }
+
+      void reliable_client::set_on_gap(std::function<void(std::uint64_t a_first, std::uint64_t a_last)> a_on_gap)
+      {
+        m_on_gap_func = a_on_gap;
+      }
+
+      udp_multicast_reliable_stats_t reliable_client::stats()
+      {
+        udp_multicast_reliable_stats_t stats;
+        stats.received = m_counters.received.load(std::memory_order_relaxed);
+        stats.delivered = m_counters.delivered.load(std::memory_order_relaxed);
+        stats.duplicates = m_counters.duplicates.load(std::memory_order_relaxed);
+        stats.gaps = m_counters.gaps.load(std::memory_order_relaxed);
+        stats.naks = m_counters.naks.load(std::memory_order_relaxed);
+        stats.recovered = m_counters.recovered.load(std::memory_order_relaxed);
+        stats.lost = m_counters.lost.load(std::memory_order_relaxed);
+        stats.malformed = m_counters.malformed.load(std::memory_order_relaxed);
+        return stats;
+      }
+
+      void reliable_client::on_packet(const char *a_data, std::size_t a_len, bool a_is_retransmit)
+      {
+        if(!m_is_run)
+          return;
+
+        if(!a_is_retransmit)
+          increment(m_counters.received);
+
+        std::uint64_t seq;
+        if(!read_packet_field(m_params->sequence, a_data, a_len, seq))
+        {
+          increment(m_counters.malformed);
+          return;
+        }
+
+        if(!m_has_seq)
+        {
+          m_has_seq = true;
+          m_next_seq = seq;
+        }
+
+        if(seq < m_next_seq || m_pending.count(seq) != 0)
+        {
+          increment(m_counters.duplicates);
+          return;
+        }
+
+        if(a_is_retransmit)
+          increment(m_counters.recovered);
+
+        if(seq == m_next_seq)
+        {
+          deliver(seq, a_data, a_len);
+          m_next_seq++;
+          drain();
+          return;
+        }
+
+        // wraps to m_next_seq when nothing is pending
+        std::uint64_t highest = m_pending.empty() ? m_next_seq - 1 : m_pending.rbegin()->first;
+        if(seq > highest + 1)
+        {
+          increment(m_counters.gaps);
+          send_nak(highest + 1, seq - 1);
+        }
+        m_pending.emplace(seq, std::string(a_data, a_len));
+
+        if(m_pending.size() > m_params->max_pending)
+        {
+          lose(m_pending.begin()->first - 1);
+          drain();
+        }
+        arm_nak_timer();
+      }
+
+      void reliable_client::on_retransmit(const std::string& a_frame)
+      {
+        if(a_frame.size() < sizeof(codec::message_header_t))
+        {
+          increment(m_counters.malformed);
+          return;
+        }
+
+        std::uint16_t type = codec::message_type(a_frame.data());
+        if(type == RETRANSMIT_TYPE)
+          on_packet(a_frame.data() + sizeof(codec::message_header_t), a_frame.size() - sizeof(codec::message_header_t), true);
+        else if(type == nak_unavailable::type_id && a_frame.size() >= nak_unavailable::frame_size)
+        {
+          // the history drops the oldest first, so nothing missing up to
+          // the end of this range will ever come
+          nak_unavailable::view unavailable(a_frame.data());
+          m_unavailable_up_to = m_has_unavailable ? std::max(m_unavailable_up_to, unavailable.last()) : unavailable.last();
+          m_has_unavailable = true;
+          if(m_is_run)
+            drain();
+        }
+        else
+          increment(m_counters.malformed);
+      }
+
+      void reliable_client::drain()
+      {
+        while(!m_pending.empty())
+        {
+          auto head_it = m_pending.begin();
+          if(head_it->first == m_next_seq)
+          {
+            deliver(head_it->first, head_it->second.data(), head_it->second.size());
+            m_pending.erase(head_it);
+            m_next_seq++;
+          }
+          else if(m_has_unavailable && m_next_seq <= m_unavailable_up_to)
+            lose(std::min(m_unavailable_up_to, head_it->first - 1));
+          else
+            break;
+        }
+      }
+
+      void reliable_client::lose(std::uint64_t a_last)
+      {
+        increment(m_counters.lost, a_last - m_next_seq + 1);
+        if(m_on_gap_func != nullptr)
+          m_on_gap_func(m_next_seq, a_last);
+        m_next_seq = a_last + 1;
+      }
+
+      void reliable_client::deliver(std::uint64_t a_seq, const char *a_data, std::size_t a_len)
+      {
+        increment(m_counters.delivered);
+
+        if(m_on_data_func != nullptr)
+          m_on_data_func(a_seq, a_data, a_len);
+      }
+
+      void reliable_client::send_nak(std::uint64_t a_first, std::uint64_t a_last)
+      {
+        increment(m_counters.naks);
+        m_retransmit->send_message(codec::encode<nak_request>([a_first, a_last](nak_request::builder& a_builder)
+        {
+          a_builder.first(a_first).last(a_last);
+        }));
+      }
+
+      void reliable_client::send_naks()
+      {
+        std::uint64_t first = m_next_seq;
+        for(const auto& pending : m_pending)
+        {
+          if(pending.first > first)
+            send_nak(first, pending.first - 1);
+          first = pending.first + 1;
+        }
+      }
+
+      void reliable_client::arm_nak_timer()
+      {
+        if(m_nak_timer_armed || m_pending.empty())
+          return;
+
+        m_nak_timer_armed = true;
+        m_nak_timer->expires_from_now(std::chrono::milliseconds(m_params->nak_timeout_ms));
+        m_nak_timer->async_wait(m_strand->wrap([this](const boost::system::error_code& a_ec)
+        {
+          m_nak_timer_armed = false;
+          if(a_ec || !m_is_run)
+            return;
+
+          on_nak_timeout();
+          arm_nak_timer();
+        }));
+      }
+
+      void reliable_client::on_nak_timeout()
+      {
+        if(m_pending.empty())
+          return;
+
+        // retries are counted per head-of-line gap
+        if(m_nak_head != m_next_seq)
+        {
+          m_nak_head = m_next_seq;
+          m_nak_attempts = 0;
+        }
+
+        if(m_nak_attempts < m_params->nak_retries)
+        {
+          m_nak_attempts++;
+          send_naks();
+          return;
+        }
+
+        lose(m_pending.begin()->first - 1);
+        drain();
+      }
+
+      void reliable_client::increment(std::atomic<std::uint64_t>& a_counter, std::uint64_t a_value)
+      {
+        a_counter.store(a_counter.load(std::memory_order_relaxed) + a_value, std::memory_order_relaxed);
+      }
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      ireliable_client::ref create_reliable_client(udp_multicast_reliable_params_t& a_params, boost::asio::io_service& a_io_service)
+      {
+        return std::make_shared<reliable_client>(a_params, a_io_service);
+      }
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
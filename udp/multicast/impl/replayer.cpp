@@ -0,0 +1,189 @@
+#include "../../../communications.h"
+#include "capture_file.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      const int replay_batch_size = 1024;
+
+      class replayer
+        : public ireplayer
+      {
+        public:
+          replayer(udp_multicast_replay_params_t& a_params, boost::asio::io_service& a_io_service);
+          void run() override;
+          void stop() override;
+          void set_on_data(std::function<void(const char *a_data, std::size_t a_len)> a_on_data) override;
+          void set_on_finished(std::function<void()> a_on_finished) override;
+          std::uint64_t replayed_count() override;
+
+        private:
+          void do_replay();
+          void deliver(const char *a_data, std::size_t a_len);
+          void finish();
+
+        private:
+          std::shared_ptr<udp_multicast_replay_params_t> m_params;
+          std::shared_ptr<boost::asio::io_service::strand> m_strand;
+          std::shared_ptr<boost::asio::steady_timer> m_timer;
+          std::shared_ptr<boost::asio::ip::udp::socket> m_resend_sock;
+          boost::asio::ip::udp::endpoint m_resend_ep;
+          std::unique_ptr<capture_reader> m_reader;
+          std::function<void(const char *a_data, std::size_t a_len)> m_on_data_func;
+          std::function<void()> m_on_finished_func;
+          std::chrono::steady_clock::time_point m_start_time;
+          std::uint64_t m_last_timestamp{0};
+          std::int64_t m_elapsed_ns{0};
+          std::atomic<std::uint64_t> m_replayed{0};
+          bool m_is_run{true};
+      };
+
+      replayer::replayer(udp_multicast_replay_params_t& a_params, boost::asio::io_service& a_io_service)
+        : m_params(std::make_shared<udp_multicast_replay_params_t>(a_params))
+        , m_strand(std::make_shared<boost::asio::io_service::strand>(a_io_service))
+        , m_timer(std::make_shared<boost::asio::steady_timer>(a_io_service))
+        , m_reader(std::make_unique<capture_reader>(a_params.file_path))
+      {
+        if(m_params->speed <= 0)
+          m_params->speed = 1.0;
+
+        if(!m_params->resend_group_ip.empty())
+        {
+          m_resend_ep = boost::asio::ip::udp::endpoint(boost::asio::ip::address::from_string(m_params->resend_group_ip), m_params->resend_port);
+          m_resend_sock = std::make_shared<boost::asio::ip::udp::socket>(a_io_service);
+          m_resend_sock->open(m_resend_ep.protocol());
+          m_resend_sock->set_option(boost::asio::ip::multicast::outbound_interface(boost::asio::ip::address_v4::from_string(m_params->resend_interface_ip)));
+          m_resend_sock->set_option(boost::asio::ip::multicast::enable_loopback(true));
+        }
+      }
+
+      void replayer::run()
+      {
+        m_strand->post([this]
+        {
+          m_start_time = std::chrono::steady_clock::now();
+          m_reader->peek_timestamp(m_last_timestamp);
+          do_replay();
+        });
+      }
+
+      void replayer::stop()
+      {
+        m_strand->post([this]
+        {
+          m_is_run = false;
+          m_timer->cancel();
+        });
+      }
+
+      void replayer::set_on_data(std::function<void(const char *a_data, std::size_t a_len)> a_on_data)
+      {
+        m_on_data_func = a_on_data;
+      }
+
+      void replayer::set_on_finished(std::function<void()> a_on_finished)
+      {
+        m_on_finished_func = a_on_finished;
+      }
+
+      std::uint64_t replayer::replayed_count()
+      {
+        return m_replayed.load(std::memory_order_relaxed);
+      }
+
+      void replayer::do_replay()
+      {
+        if(!m_is_run)
+          return;
+
+        std::uint64_t timestamp;
+        const char *data;
+        std::size_t len;
+        for(int i = 0; i < replay_batch_size; i++)
+        {
+          if(!m_reader->peek_timestamp(timestamp))
+          {
+            finish();
+            return;
+          }
+
+          // Timestamps are CLOCK_REALTIME, which can step back; a step back
+          // counts as no gap rather than wrapping the unsigned difference.
+          const std::int64_t elapsed_ns = m_elapsed_ns + std::max<std::int64_t>(0, static_cast<std::int64_t>(timestamp - m_last_timestamp));
+          if(m_params->pace == replay_pace_e::original)
+          {
+            auto offset_ns = static_cast<std::int64_t>(elapsed_ns / m_params->speed);
+            auto due_time = m_start_time + std::chrono::nanoseconds(offset_ns);
+            if(due_time > std::chrono::steady_clock::now())
+            {
+              m_timer->expires_at(due_time);
+              m_timer->async_wait(m_strand->wrap([this](const boost::system::error_code& a_ec)
+              {
+                if(!a_ec)
+                  do_replay();
+              }));
+              return;
+            }
+          }
+
+          if(!m_reader->next(timestamp, data, len))
+          {
+            finish();
+            return;
+          }
+          m_elapsed_ns = elapsed_ns;
+          m_last_timestamp = timestamp;
+          deliver(data, len);
+        }
+
+        // yield between batches so stop() and other handlers get a turn
+        m_strand->post([this]
+        {
+          do_replay();
+        });
+      }
+
+      void replayer::deliver(const char *a_data, std::size_t a_len)
+      {
+        m_replayed.store(m_replayed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+        if(m_resend_sock != nullptr)
+        {
+          boost::system::error_code ec;
+          m_resend_sock->send_to(boost::asio::buffer(a_data, a_len), m_resend_ep, 0, ec);
+        }
+
+        if(m_on_data_func != nullptr)
+          m_on_data_func(a_data, a_len);
+      }
+
+      void replayer::finish()
+      {
+        m_is_run = false;
+        if(m_on_finished_func != nullptr)
+          m_on_finished_func();
+      }
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      ireplayer::ref create_replayer(udp_multicast_replay_params_t& a_params, boost::asio::io_service& a_io_service)
+      {
+        return std::make_shared<common::udp::multicast::replayer>(a_params, a_io_service);
+      }
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
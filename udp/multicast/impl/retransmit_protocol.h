@@ -0,0 +1,24 @@
+#pragma once
+
+#include "../../../codec/message.h"
+
+// Retransmission side channel of reliable multicast, carried over
+// length_prefixed tcp. The receiver asks for a sequence range with a
+// nak_request; the server answers with one retransmit frame per datagram
+// it still holds, a message_header_t followed by the datagram as it was
+// published, and with nak_unavailable for a range it has already dropped.
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+#define COMMUNICATIONS_NAK_FIELDS(FIELD) FIELD(std::uint64_t, first) FIELD(std::uint64_t, last)
+      COMMUNICATIONS_MESSAGE(nak_request, 1, COMMUNICATIONS_NAK_FIELDS)
+      COMMUNICATIONS_MESSAGE(nak_unavailable, 2, COMMUNICATIONS_NAK_FIELDS)
+#undef COMMUNICATIONS_NAK_FIELDS
+
+      const std::uint16_t RETRANSMIT_TYPE = 3;
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
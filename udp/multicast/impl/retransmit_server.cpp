@@ -0,0 +1,204 @@
+#include "../../../communications.h"
+#include "../../../packet_field.h"
+#include "history_ring.h"
+#include "retransmit_protocol.h"
+#include <atomic>
+#include <mutex>
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      // datagrams answered per hold of m_mutex
+      const std::size_t retransmit_batch = 64;
+
+      // store() runs on the publishing thread and requests on the tcp
+      // server's; the history is shared under m_mutex.
+      class retransmit_server
+        : public iretransmit_server
+      {
+        public:
+          retransmit_server(udp_multicast_retransmit_params_t& a_params, boost::asio::io_service& a_io_service);
+          void run() override;
+          void store(const char *a_data, std::size_t a_len) override;
+          udp_multicast_retransmit_stats_t stats() override;
+
+        private:
+          struct counters_t
+          {
+            std::atomic<std::uint64_t> stored{0};
+            std::atomic<std::uint64_t> naks{0};
+            std::atomic<std::uint64_t> retransmitted{0};
+            std::atomic<std::uint64_t> unavailable{0};
+            std::atomic<std::uint64_t> malformed{0};
+          };
+
+          void on_request(const int a_client_id, const char *a_data, std::size_t a_len);
+          void send_packet(const int a_client_id, const char *a_data, std::size_t a_len);
+          void send_unavailable(const int a_client_id, std::uint64_t a_first, std::uint64_t a_last);
+          static void increment(std::atomic<std::uint64_t>& a_counter, std::uint64_t a_value = 1);
+
+        private:
+          std::shared_ptr<udp_multicast_retransmit_params_t> m_params;
+          history_ring m_history;
+          tcp::iserver::ref m_server;
+          std::mutex m_mutex;
+          counters_t m_counters;
+      };
+
+      retransmit_server::retransmit_server(udp_multicast_retransmit_params_t& a_params, boost::asio::io_service& a_io_service)
+        : m_params(std::make_shared<udp_multicast_retransmit_params_t>(a_params))
+        , m_history(a_params.history_path, a_params.history_size, a_params.history_slots)
+      {
+        m_params->tcp.do_read_type = read_func_type_e::length_prefixed;
+        m_server = tcp::create_server(m_params->tcp, a_io_service);
+        m_server->set_on_message([this](const int a_client_id, const char *a_data, std::size_t a_len)
+        {
+          on_request(a_client_id, a_data, a_len);
+        });
+      }
+
+      void retransmit_server::run()
+      {
+        m_server->run();
+      }
+
+      void retransmit_server::store(const char *a_data, std::size_t a_len)
+      {
+        std::uint64_t seq;
+        if(!read_packet_field(m_params->sequence, a_data, a_len, seq))
+        {
+          increment(m_counters.malformed);
+          return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_history.append(seq, a_data, a_len))
+          increment(m_counters.stored);
+      }
+
+      udp_multicast_retransmit_stats_t retransmit_server::stats()
+      {
+        udp_multicast_retransmit_stats_t stats;
+        stats.stored = m_counters.stored.load(std::memory_order_relaxed);
+        stats.naks = m_counters.naks.load(std::memory_order_relaxed);
+        stats.retransmitted = m_counters.retransmitted.load(std::memory_order_relaxed);
+        stats.unavailable = m_counters.unavailable.load(std::memory_order_relaxed);
+        stats.malformed = m_counters.malformed.load(std::memory_order_relaxed);
+        return stats;
+      }
+
+      void retransmit_server::on_request(const int a_client_id, const char *a_data, std::size_t a_len)
+      {
+        if(a_len < nak_request::frame_size || codec::message_type(a_data) != nak_request::type_id)
+        {
+          increment(m_counters.malformed);
+          return;
+        }
+
+        nak_request::view request(a_data);
+        std::uint64_t first = request.first();
+        std::uint64_t last = request.last();
+        if(last < first)
+        {
+          increment(m_counters.malformed);
+          return;
+        }
+        increment(m_counters.naks);
+
+        // the index cannot hold more than history_slots datagrams anyway
+        if(last - first >= m_params->history_slots)
+          last = first + m_params->history_slots - 1;
+
+        bool is_unavailable = false;
+        std::uint64_t unavailable_first = 0;
+        std::uint64_t seq = first;
+        bool is_done = false;
+        while(!is_done)
+        {
+          // m_mutex is taken per batch, so store() on the publishing path
+          // waits for one batch and not for the whole range
+          std::lock_guard<std::mutex> lock(m_mutex);
+          for(std::size_t n = 0; n < retransmit_batch && !is_done; ++n, ++seq)
+          {
+            const char *data;
+            std::size_t len;
+            if(m_history.find(seq, data, len))
+            {
+              if(is_unavailable)
+              {
+                send_unavailable(a_client_id, unavailable_first, seq - 1);
+                is_unavailable = false;
+              }
+              send_packet(a_client_id, data, len);
+            }
+            else if(m_history.has_seen(seq))
+            {
+              if(!is_unavailable)
+              {
+                is_unavailable = true;
+                unavailable_first = seq;
+              }
+            }
+            else
+            {
+              // not published yet; the receiver asks again if it still misses it
+              last = seq - 1;
+              is_done = true;
+              break;
+            }
+
+            is_done = seq == last;
+          }
+        }
+
+        if(is_unavailable)
+          send_unavailable(a_client_id, unavailable_first, last);
+      }
+
+      void retransmit_server::send_packet(const int a_client_id, const char *a_data, std::size_t a_len)
+      {
+        const std::uint32_t frame_len = static_cast<std::uint32_t>(sizeof(codec::message_header_t) + a_len);
+        m_server->send_encoded(a_client_id, frame_len, [a_data, a_len, frame_len](char *a_out)
+        {
+          codec::message_header_t header{frame_len, RETRANSMIT_TYPE, 0};
+          memcpy(a_out, &header, sizeof(header));
+          memcpy(a_out + sizeof(header), a_data, a_len);
+        });
+        increment(m_counters.retransmitted);
+      }
+
+      void retransmit_server::send_unavailable(const int a_client_id, std::uint64_t a_first, std::uint64_t a_last)
+      {
+        codec::send<nak_unavailable>(*m_server, a_client_id, [a_first, a_last](nak_unavailable::builder& a_builder)
+        {
+          a_builder.first(a_first).last(a_last);
+        });
+        increment(m_counters.unavailable, a_last - a_first + 1);
+      }
+
+      void retransmit_server::increment(std::atomic<std::uint64_t>& a_counter, std::uint64_t a_value)
+      {
+        // naks and malformed are bumped outside m_mutex, from the publishing
+        // and the tcp threads alike
+        a_counter.fetch_add(a_value, std::memory_order_relaxed);
+      }
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      iretransmit_server::ref create_retransmit_server(udp_multicast_retransmit_params_t& a_params, boost::asio::io_service& a_io_service)
+      {
+        return std::make_shared<retransmit_server>(a_params, a_io_service);
+      }
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
@@ -0,0 +1,212 @@
+#include "../../../communications.h"
+#include "../../../packet_ring.h"
+#include "socket_options.h"
+#include <atomic>
+#include <thread>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      const int ring_recv_batch_size = 32;
+      const int ring_poll_timeout_ms = 100;
+
+      // Drains the socket on its own thread straight into ring slots, so the
+      // consumer side never touches the socket. front()/pop() must only be
+      // called from one consumer thread.
+      class ring_client
+        : public iring_client
+      {
+        public:
+          explicit ring_client(udp_multicast_ring_params_t& a_params);
+          ~ring_client() override;
+          void run() override;
+          void stop() override;
+          bool front(const char *&a_data, std::size_t& a_len) override;
+          void pop() override;
+          udp_multicast_ring_stats_t stats() override;
+
+        private:
+          void receive_loop();
+          void drain();
+          int receive_batch(int a_count, bool a_into_ring);
+          static void increment(std::atomic<std::uint64_t>& a_counter, std::uint64_t a_value);
+
+        private:
+          std::shared_ptr<udp_multicast_ring_params_t> m_params;
+          boost::asio::io_service m_io_service;
+          std::shared_ptr<boost::asio::ip::udp::socket> m_sock;
+          packet_ring m_ring;
+          std::unique_ptr<buf_array_t> m_discard_buffer = std::make_unique<buf_array_t>();
+          std::array<struct iovec, ring_recv_batch_size> m_iovecs;
+          std::array<struct mmsghdr, ring_recv_batch_size> m_msgs;
+          std::atomic<std::uint64_t> m_received{0};
+          std::atomic<std::uint64_t> m_dropped{0};
+          std::atomic<std::uint64_t> m_truncated{0};
+          std::thread m_thread;
+          std::atomic<bool> m_is_run{false};
+      };
+
+      ring_client::ring_client(udp_multicast_ring_params_t& a_params)
+        : m_params(std::make_shared<udp_multicast_ring_params_t>(a_params))
+        , m_sock(std::make_shared<boost::asio::ip::udp::socket>(m_io_service))
+        , m_ring(a_params.ring_slots, a_params.slot_size)
+      {
+        open_source_group_socket(*m_sock, m_params->multicast);
+      }
+
+      ring_client::~ring_client()
+      {
+        stop();
+      }
+
+      void ring_client::run()
+      {
+        if(m_is_run.exchange(true))
+          return;
+
+        m_thread = std::thread([this]{
+          if(m_params->cpu_core >= 0)
+          {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            CPU_SET(m_params->cpu_core, &cpu_set);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+          }
+          receive_loop();
+        });
+      }
+
+      void ring_client::stop()
+      {
+        m_is_run = false;
+        if(m_thread.joinable() && m_thread.get_id() != std::this_thread::get_id())
+          m_thread.join();
+      }
+
+      bool ring_client::front(const char *&a_data, std::size_t& a_len)
+      {
+        if(m_ring.readable() == 0)
+          return false;
+
+        a_data = m_ring.read_slot(0, a_len);
+        return true;
+      }
+
+      void ring_client::pop()
+      {
+        m_ring.consume(1);
+      }
+
+      udp_multicast_ring_stats_t ring_client::stats()
+      {
+        udp_multicast_ring_stats_t stats;
+        stats.received = m_received.load(std::memory_order_relaxed);
+        stats.dropped = m_dropped.load(std::memory_order_relaxed);
+        stats.truncated = m_truncated.load(std::memory_order_relaxed);
+        return stats;
+      }
+
+      void ring_client::receive_loop()
+      {
+        struct pollfd fd;
+        fd.fd = m_sock->native_handle();
+        fd.events = POLLIN;
+
+        while(m_is_run)
+        {
+          if(poll(&fd, 1, ring_poll_timeout_ms) > 0 && (fd.revents & POLLIN))
+            drain();
+        }
+      }
+
+      void ring_client::drain()
+      {
+        while(true)
+        {
+          std::size_t writable = m_ring.writable();
+          int received;
+          if(writable == 0)
+          {
+            // keep the socket queue moving so the consumer sees fresh data as
+            // soon as it catches up
+            received = receive_batch(ring_recv_batch_size, false);
+            if(received > 0)
+              increment(m_dropped, received);
+          }
+          else
+          {
+            int count = writable < ring_recv_batch_size ? static_cast<int>(writable) : ring_recv_batch_size;
+            received = receive_batch(count, true);
+            if(received > 0)
+            {
+              for(int i = 0; i < received; i++)
+              {
+                if(m_msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+                  increment(m_truncated, 1);
+                m_ring.set_length(i, m_msgs[i].msg_len);
+              }
+              m_ring.publish(received);
+              increment(m_received, received);
+            }
+          }
+
+          if(received < ring_recv_batch_size)
+            return;
+        }
+      }
+
+      int ring_client::receive_batch(int a_count, bool a_into_ring)
+      {
+        for(int i = 0; i < a_count; i++)
+        {
+          if(a_into_ring)
+          {
+            m_iovecs[i].iov_base = m_ring.write_slot(i);
+            m_iovecs[i].iov_len = m_ring.slot_size();
+          }
+          else
+          {
+            m_iovecs[i].iov_base = m_discard_buffer->data();
+            m_iovecs[i].iov_len = buff_size;
+          }
+
+          struct msghdr& hdr = m_msgs[i].msg_hdr;
+          hdr.msg_name = nullptr;
+          hdr.msg_namelen = 0;
+          hdr.msg_iov = &m_iovecs[i];
+          hdr.msg_iovlen = 1;
+          hdr.msg_control = nullptr;
+          hdr.msg_controllen = 0;
+          hdr.msg_flags = 0;
+        }
+
+        return recvmmsg(m_sock->native_handle(), m_msgs.data(), a_count, MSG_DONTWAIT, nullptr);
+      }
+
+      void ring_client::increment(std::atomic<std::uint64_t>& a_counter, std::uint64_t a_value)
+      {
+        a_counter.store(a_counter.load(std::memory_order_relaxed) + a_value, std::memory_order_relaxed);
+      }
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      iring_client::ref create_ring_client(udp_multicast_ring_params_t& a_params)
+      {
+        return std::make_shared<common::udp::multicast::ring_client>(a_params);
+      }
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
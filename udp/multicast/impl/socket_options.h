@@ -0,0 +1,180 @@
+#pragma once
+
+#include "../../../communications.h"
+#include "../../../socket_profile.h"
+#include "bpf_filter.h"
+#include <cstring>
+#include <net/if.h>
+
+namespace common
+{
+  namespace udp
+  {
+    namespace multicast
+    {
+      using group_source_req_t = struct group_source_req;
+
+      struct mcast_join_source_group
+      {
+          mcast_join_source_group()
+            : m_data()
+          {}
+
+          mcast_join_source_group(std::string &source_ip, std::string &group_ip, int port, std::string &interface_name)
+            : mcast_join_source_group()
+          {
+            int ifname_number = if_nametoindex(interface_name.c_str());
+
+            struct sockaddr_in group_addr;
+            group_addr.sin_addr.s_addr = inet_addr(group_ip.c_str());
+            group_addr.sin_port = htons(port);
+            group_addr.sin_family = AF_INET;
+
+            struct sockaddr_in source_addr;
+            source_addr.sin_addr.s_addr = inet_addr(source_ip.c_str());
+            source_addr.sin_port = htons(port);
+            source_addr.sin_family = AF_INET;
+
+            memcpy(&(m_data.gsr_source), (struct sockaddr_storage *) &source_addr, sizeof(struct sockaddr_in));
+            memcpy(&(m_data.gsr_group), (struct sockaddr_storage *) &group_addr, sizeof(struct sockaddr_in));
+
+            m_data.gsr_interface = ifname_number;
+          }
+
+          template<typename Protocol>
+          int level(const Protocol&) const
+          {
+            return IPPROTO_IP;
+          }
+
+          template<typename Protocol>
+          int name(const Protocol&) const
+          {
+            return MCAST_JOIN_SOURCE_GROUP;
+          }
+
+          template<typename Protocol>
+          group_source_req_t* data(const Protocol&)
+          {
+            return &m_data;
+          }
+
+          template<typename Protocol>
+          const group_source_req_t* data(const Protocol&) const
+          {
+            return &m_data;
+          }
+
+          template<typename Protocol>
+          std::size_t size(const Protocol&) const
+          {
+            return sizeof(m_data);
+          }
+
+          template<typename Protocol>
+          void resize(const Protocol&, std::size_t s)
+          {
+            if (s != sizeof(m_data))
+            {
+              std::length_error ex("mcast_join_source_group socket option resize");
+              boost::asio::detail::throw_exception(ex);
+            }
+          }
+
+        private:
+          group_source_req_t m_data;
+      };
+
+      using group_req_t = struct group_req;
+
+      // any-source membership, for a group whose subscription names no source
+      struct mcast_join_group
+      {
+          mcast_join_group()
+            : m_data()
+          {}
+
+          mcast_join_group(std::string &group_ip, int port, std::string &interface_name)
+            : mcast_join_group()
+          {
+            struct sockaddr_in group_addr;
+            group_addr.sin_addr.s_addr = inet_addr(group_ip.c_str());
+            group_addr.sin_port = htons(port);
+            group_addr.sin_family = AF_INET;
+
+            memcpy(&(m_data.gr_group), (struct sockaddr_storage *) &group_addr, sizeof(struct sockaddr_in));
+
+            m_data.gr_interface = if_nametoindex(interface_name.c_str());
+          }
+
+          template<typename Protocol>
+          int level(const Protocol&) const
+          {
+            return IPPROTO_IP;
+          }
+
+          template<typename Protocol>
+          int name(const Protocol&) const
+          {
+            return MCAST_JOIN_GROUP;
+          }
+
+          template<typename Protocol>
+          group_req_t* data(const Protocol&)
+          {
+            return &m_data;
+          }
+
+          template<typename Protocol>
+          const group_req_t* data(const Protocol&) const
+          {
+            return &m_data;
+          }
+
+          template<typename Protocol>
+          std::size_t size(const Protocol&) const
+          {
+            return sizeof(m_data);
+          }
+
+          template<typename Protocol>
+          void resize(const Protocol&, std::size_t s)
+          {
+            if (s != sizeof(m_data))
+            {
+              std::length_error ex("mcast_join_group socket option resize");
+              boost::asio::detail::throw_exception(ex);
+            }
+          }
+
+        private:
+          group_req_t m_data;
+      };
+
+      using so_timestamp = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_TIMESTAMP>;
+      using so_timestampns = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_TIMESTAMPNS>;
+      using so_recvttl = boost::asio::detail::socket_option::boolean<IPPROTO_IP, IP_RECVTTL>;
+      using so_pktinfo = boost::asio::detail::socket_option::boolean<IPPROTO_IP, IP_PKTINFO>;
+      using so_multicast_all = boost::asio::detail::socket_option::boolean<IPPROTO_IP, IP_MULTICAST_ALL>;
+
+      const int buff_size =	16384;
+      using buf_array_t = std::array<char, buff_size>;
+
+      // a_filter, if any, is attached before the bind and join, so no
+      // datagram reaches the socket unfiltered
+      inline void open_source_group_socket(boost::asio::ip::udp::socket& a_sock, udp_multicast_params_t& a_params, const bpf_program_t& a_filter = bpf_program_t())
+      {
+        boost::asio::ip::udp::endpoint ep(boost::asio::ip::address::from_string(a_params.group_ip.c_str()), a_params.port);
+        a_sock.open(ep.protocol());
+        a_sock.set_option(boost::asio::ip::udp::socket::reuse_address(true));
+        a_sock.set_option(so_recvttl(true));
+        a_sock.set_option(so_timestamp(true));
+        apply_socket_options(a_sock, a_params.socket_options);
+        if(!a_filter.empty())
+          attach_filter(a_sock.native_handle(), a_filter);
+        a_sock.bind(ep);
+        a_sock.set_option(mcast_join_source_group(a_params.source_ip, a_params.group_ip, a_params.port, a_params.interface_name));
+      }
+    } //namespace multicast
+  } //namespace udp
+} //namespace common
@@ -0,0 +1,132 @@
+#include "../../../communications.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// multi_client over loopback, with two senders bound to 127.0.0.1 and
+// 127.0.0.2 sending to three groups on one port:
+//   group 1  source-specific, 127.0.0.1 only
+//   group 2  any source
+//   group 3  127.0.0.1 and any source listed separately, so 127.0.0.1 goes
+//            to its own entry and 127.0.0.2 to the any-source one
+// Checks every subscription receives exactly the datagrams meant for it,
+// each once. Exits non-zero on a mismatch.
+//
+//   communications_udp_multicast_multi_test_app [--count=N] [--port=N]
+
+namespace
+{
+  using namespace common::udp::multicast;
+
+  struct test_options_t
+  {
+    std::size_t count = 100;
+    std::uint16_t port = 37400;
+  };
+
+  const char *group_ips[] = {"239.5.8.1", "239.5.8.2", "239.5.8.3"};
+
+  struct subscription_case_t
+  {
+    const char *source_ip;
+    std::size_t group;
+    // datagrams expected from 127.0.0.1 and from 127.0.0.2
+    std::size_t from_first;
+    std::size_t from_second;
+  };
+
+  bool parse_option(const char *a_arg, const char *a_name, std::size_t& a_value)
+  {
+    std::size_t len = strlen(a_name);
+    if(strncmp(a_arg, a_name, len) != 0 || a_arg[len] != '=')
+      return false;
+    a_value = std::stoull(a_arg + len + 1);
+    return true;
+  }
+
+  std::shared_ptr<boost::asio::ip::udp::socket> open_sender(boost::asio::io_service& a_io_service, const char *a_source_ip)
+  {
+    auto sock = std::make_shared<boost::asio::ip::udp::socket>(a_io_service);
+    sock->open(boost::asio::ip::udp::v4());
+    sock->bind({boost::asio::ip::address::from_string(a_source_ip), 0});
+    sock->set_option(boost::asio::ip::multicast::outbound_interface(boost::asio::ip::address_v4::from_string("127.0.0.1")));
+    sock->set_option(boost::asio::ip::multicast::enable_loopback(true));
+    return sock;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  test_options_t options;
+  for(int i = 1; i < argc; i++)
+  {
+    std::size_t port = options.port;
+    if(!parse_option(argv[i], "--count", options.count) &&
+       !parse_option(argv[i], "--port", port))
+    {
+      std::cerr << "unknown option " << argv[i] << std::endl;
+      return 1;
+    }
+    options.port = static_cast<std::uint16_t>(port);
+  }
+
+  const std::size_t count = options.count;
+  const std::vector<subscription_case_t> cases = {
+    {"127.0.0.1", 0, count, 0},
+    {"", 1, count, count},
+    {"127.0.0.1", 2, count, 0},
+    {"", 2, 0, count},
+  };
+
+  common::udp_multicast_multi_params_t params;
+  params.interface_name = "lo";
+  params.socket_options.rcvbuf = 4 * 1024 * 1024;
+  for(const auto& test_case : cases)
+    params.groups.push_back({test_case.source_ip, group_ips[test_case.group], options.port});
+  auto client = create_multi_client(params);
+  std::vector<std::vector<std::size_t>> received(cases.size(), std::vector<std::size_t>(2, 0));
+  for(std::size_t i = 0; i < cases.size(); i++)
+  {
+    client->set_on_data(i, [&received, i](const char *a_data, std::size_t a_len)
+    {
+      if(a_len > 0 && (a_data[0] == 1 || a_data[0] == 2))
+        received[i][a_data[0] - 1]++;
+    });
+  }
+  client->run();
+
+  boost::asio::io_service io_service;
+  std::vector<std::shared_ptr<boost::asio::ip::udp::socket>> senders = {open_sender(io_service, "127.0.0.1"), open_sender(io_service, "127.0.0.2")};
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  for(std::size_t n = 0; n < count; n++)
+  {
+    for(std::size_t sender = 0; sender < senders.size(); sender++)
+    {
+      char datagram[32] = {static_cast<char>(sender + 1)};
+      for(const char *group_ip : group_ips)
+        senders[sender]->send_to(boost::asio::buffer(datagram), {boost::asio::ip::address::from_string(group_ip), options.port});
+    }
+    if(n % 50 == 49)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  client->stop();
+
+  bool is_ok = true;
+  for(std::size_t i = 0; i < cases.size(); i++)
+  {
+    const auto& test_case = cases[i];
+    bool is_case_ok = received[i][0] == test_case.from_first && received[i][1] == test_case.from_second;
+    printf("%-9s %s:%u  from 127.0.0.1 %zu/%zu  from 127.0.0.2 %zu/%zu  %s\n",
+           test_case.source_ip[0] != '\0' ? test_case.source_ip : "any", group_ips[test_case.group], options.port,
+           received[i][0], test_case.from_first, received[i][1], test_case.from_second, is_case_ok ? "ok" : "FAILED");
+    is_ok = is_case_ok && is_ok;
+  }
+  printf("unmatched %llu\n", (unsigned long long)client->unmatched_count());
+  return is_ok ? 0 : 1;
+}
@@ -0,0 +1,270 @@
+#include "../../../communications.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Publishes sequenced datagrams to a loopback source-specific group and
+// receives them through udp::multicast::client in every mode, reporting
+// packet rate, loss from sequence gaps and send-to-callback latency.
+//
+//   communications_udp_multicast_bench [--count=N] [--rate=PPS] [--size=BYTES]
+//                                      [--batch=N] [--threads=N] [--port=N]
+
+namespace
+{
+  using namespace common::udp::multicast;
+  using bench_clock = std::chrono::steady_clock;
+
+  struct bench_options_t
+  {
+    std::size_t count = 200000;
+    std::size_t rate = 100000;
+    std::size_t size = 64;
+    std::size_t batch = 1;
+    std::size_t threads = 4;
+    std::uint16_t port = 37000;
+  };
+
+  struct bench_case_t
+  {
+    common::udp_multicast_backend_e backend;
+    bool use_strand;
+    std::size_t threads;
+  };
+
+  struct bench_header_t
+  {
+    std::uint64_t sequence;
+    std::int64_t send_ns;
+  };
+
+  std::int64_t now_ns()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now().time_since_epoch()).count();
+  }
+
+  const char *backend_name(common::udp_multicast_backend_e a_backend)
+  {
+    return a_backend == common::udp_multicast_backend_e::packet_mmap ? "packet_mmap" : "socket";
+  }
+
+  // The client keeps one receive outstanding, so callbacks never overlap
+  // even without a strand; only the counters read by the publishing thread
+  // have to be atomic.
+  class bench_receiver
+  {
+    public:
+      explicit bench_receiver(std::size_t a_count)
+      {
+        m_latencies.reserve(a_count);
+      }
+
+      void on_data(const char *a_data, std::size_t a_len)
+      {
+        std::int64_t now = now_ns();
+        if(a_len < sizeof(bench_header_t))
+          return;
+
+        bench_header_t header;
+        memcpy(&header, a_data, sizeof(header));
+        m_latencies.push_back(now - header.send_ns);
+
+        if(header.sequence > m_expected)
+        {
+          m_gaps++;
+          m_gap_packets += header.sequence - m_expected;
+        }
+        else if(header.sequence < m_expected && m_gap_packets > 0)
+          m_gap_packets--;  // late, it was already counted as missing
+        if(header.sequence >= m_expected)
+          m_expected = header.sequence + 1;
+
+        if(m_first_ns == 0)
+          m_first_ns = now;
+        m_last_ns = now;
+        m_received.store(m_received.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+      }
+
+      std::uint64_t received() const
+      {
+        return m_received.load(std::memory_order_acquire);
+      }
+
+      void report(const bench_case_t& a_case, std::size_t a_sent)
+      {
+        std::sort(m_latencies.begin(), m_latencies.end());
+        auto percentile = [this](double a_p) -> double
+        {
+          if(m_latencies.empty())
+            return 0;
+          std::size_t index = static_cast<std::size_t>(a_p * (m_latencies.size() - 1));
+          return m_latencies[index] / 1000.0;
+        };
+
+        // sequences missing at the tail never show up as a gap
+        std::uint64_t lost = m_gap_packets + (a_sent - m_expected);
+        double seconds = (m_last_ns - m_first_ns) / 1e9;
+        double pps = seconds > 0 ? received() / seconds : 0;
+
+        printf("%-11s %-6s %7zu %10.0f %9llu %6llu %7.3f%% %8.1f %8.1f %8.1f %8.1f %9.1f\n",
+               backend_name(a_case.backend),
+               a_case.use_strand ? "yes" : "no",
+               a_case.threads,
+               pps,
+               static_cast<unsigned long long>(lost),
+               static_cast<unsigned long long>(m_gaps),
+               a_sent > 0 ? 100.0 * lost / a_sent : 0.0,
+               percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), percentile(1.0));
+      }
+
+    private:
+      std::vector<std::int64_t> m_latencies;
+      std::uint64_t m_expected = 0;
+      std::uint64_t m_gaps = 0;
+      std::uint64_t m_gap_packets = 0;
+      std::int64_t m_first_ns = 0;
+      std::int64_t m_last_ns = 0;
+      std::atomic<std::uint64_t> m_received{0};
+  };
+
+  void run_case(const bench_options_t& a_options, const bench_case_t& a_case, std::uint16_t a_port)
+  {
+    common::udp_multicast_params_t params;
+    params.source_ip = "127.0.0.1";
+    params.group_ip = "239.255.0.1";
+    params.port = a_port;
+    params.interface_name = "lo";
+    params.use_strand = a_case.use_strand;
+    params.backend = a_case.backend;
+
+    boost::asio::io_service io_service;
+    auto work = std::make_shared<boost::asio::io_service::work>(io_service);
+
+    iclient::ref client;
+    try
+    {
+      client = create_client(params, io_service);
+    }
+    catch(const std::exception& e)
+    {
+      printf("%-11s %-6s %7zu skipped: %s\n", backend_name(a_case.backend), a_case.use_strand ? "yes" : "no", a_case.threads, e.what());
+      return;
+    }
+
+    bench_receiver receiver(a_options.count);
+    client->set_on_data([&receiver](const char *a_data, std::size_t a_len)
+     {
+       receiver.on_data(a_data, a_len);
+     });
+    client->run();
+
+    std::vector<std::thread> tgroup;
+    for(std::size_t i = 0; i < a_case.threads; i++)
+    {
+      tgroup.emplace_back(std::thread([&io_service](){
+        io_service.run();
+      }));
+    }
+
+    common::udp_multicast_publisher_params_t publisher_params;
+    publisher_params.source_ip = params.source_ip;
+    publisher_params.group_ip = params.group_ip;
+    publisher_params.port = params.port;
+    publisher_params.interface_name = params.interface_name;
+    publisher_params.loopback = true;
+    publisher_params.batch_size = a_options.batch;
+    publisher_params.max_packets_per_sec = a_options.rate;
+    auto publisher = create_publisher(publisher_params, io_service);
+
+    // let the membership settle before the first datagram
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    std::vector<char> datagram(std::max(a_options.size, sizeof(bench_header_t)));
+    for(std::size_t i = 0; i < a_options.count; i++)
+    {
+      bench_header_t header{i, now_ns()};
+      memcpy(datagram.data(), &header, sizeof(header));
+      publisher->send(datagram.data(), datagram.size());
+    }
+    publisher->flush();
+
+    // wait for the tail, giving up once nothing has arrived for a while
+    std::uint64_t last_received = 0;
+    auto last_progress = bench_clock::now();
+    while(receiver.received() < a_options.count && bench_clock::now() - last_progress < std::chrono::milliseconds(200))
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      if(receiver.received() != last_received)
+      {
+        last_received = receiver.received();
+        last_progress = bench_clock::now();
+      }
+    }
+
+    client->stop();
+    work.reset();
+    io_service.stop();
+    for(auto &thr: tgroup)
+      thr.join();
+
+    receiver.report(a_case, a_options.count);
+  }
+
+  bool parse_option(const char *a_arg, const char *a_name, std::size_t& a_value)
+  {
+    std::size_t len = strlen(a_name);
+    if(strncmp(a_arg, a_name, len) != 0 || a_arg[len] != '=')
+      return false;
+    a_value = std::stoull(a_arg + len + 1);
+    return true;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  bench_options_t options;
+  for(int i = 1; i < argc; i++)
+  {
+    std::size_t port = options.port;
+    if(!parse_option(argv[i], "--count", options.count) &&
+       !parse_option(argv[i], "--rate", options.rate) &&
+       !parse_option(argv[i], "--size", options.size) &&
+       !parse_option(argv[i], "--batch", options.batch) &&
+       !parse_option(argv[i], "--threads", options.threads) &&
+       !parse_option(argv[i], "--port", port))
+    {
+      std::cerr << "unknown option " << argv[i] << std::endl;
+      return 1;
+    }
+    options.port = static_cast<std::uint16_t>(port);
+  }
+
+  std::vector<bench_case_t> cases;
+  for(auto backend : {common::udp_multicast_backend_e::socket, common::udp_multicast_backend_e::packet_mmap})
+  {
+    for(bool use_strand : {false, true})
+    {
+      cases.push_back({backend, use_strand, 1});
+      if(options.threads > 1)
+        cases.push_back({backend, use_strand, options.threads});
+    }
+  }
+
+  printf("%zu datagrams of %zu bytes at %zu pps (0 = unpaced), publisher batch %zu\n",
+         options.count, options.size, options.rate, options.batch);
+  printf("%-11s %-6s %7s %10s %9s %6s %8s %8s %8s %8s %8s %9s\n",
+         "backend", "strand", "threads", "pps", "lost", "gaps", "loss", "p50us", "p90us", "p99us", "p999us", "maxus");
+
+  // a fresh port per case keeps stragglers of one run out of the next
+  std::uint16_t port = options.port;
+  for(const auto& bench_case : cases)
+    run_case(options, bench_case, port++);
+
+  return 0;
+}
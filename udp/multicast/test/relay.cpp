@@ -0,0 +1,279 @@
+#include "../../../communications.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Relay over loopback: publishes updates for a set of keys to a multicast
+// group and re-serves them through a relay to two tcp subscribers, one
+// reading as they arrive and one that only starts reading after the feed
+// is over, so it falls behind and is conflated. Both must end with the
+// latest update of every key and see each key's updates in order. Then
+// stops the relay and checks both subscribers are disconnected and no new
+// one is accepted.
+//
+//   communications_udp_multicast_relay_test_app [--count=N] [--keys=N]
+//                                               [--rate=PPS] [--port=N]
+
+namespace
+{
+  using namespace common::udp::multicast;
+  using test_clock = std::chrono::steady_clock;
+
+  struct test_options_t
+  {
+    std::size_t count = 50000;
+    std::size_t keys = 100;
+    std::size_t rate = 20000;
+    std::uint16_t port = 37300;
+  };
+
+  const std::size_t update_size = 200;
+
+  // reads length_prefixed frames of {key, seq} updates until the relay
+  // closes the connection
+  class subscriber
+  {
+    public:
+      subscriber(boost::asio::io_service& a_io_service, std::size_t a_keys)
+        : m_sock(a_io_service)
+        , m_last(a_keys, 0)
+      {
+      }
+
+      void connect(std::uint16_t a_port)
+      {
+        m_sock.open(boost::asio::ip::tcp::v4());
+        // small, so the relay queues for a subscriber that is not reading
+        m_sock.set_option(boost::asio::socket_base::receive_buffer_size(4096));
+        m_sock.connect({boost::asio::ip::address::from_string("127.0.0.1"), a_port});
+      }
+
+      void start()
+      {
+        m_thread = std::thread([this]{ read(); });
+      }
+
+      // unblocks a reader the relay never disconnected
+      void join()
+      {
+        if(!m_is_closed)
+        {
+          boost::system::error_code ec;
+          m_sock.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+        }
+        if(m_thread.joinable())
+          m_thread.join();
+      }
+
+      bool is_closed() const
+      {
+        return m_is_closed;
+      }
+
+      bool has_latest(const std::vector<std::uint32_t>& a_latest)
+      {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        return m_last == a_latest;
+      }
+
+      std::size_t frames()
+      {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        return m_frames;
+      }
+
+      std::size_t out_of_order()
+      {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        return m_out_of_order;
+      }
+
+    private:
+      void read()
+      {
+        std::vector<char> buf(64 * 1024);
+        std::string pending;
+        boost::system::error_code ec;
+        while(true)
+        {
+          std::size_t len = m_sock.read_some(boost::asio::buffer(buf), ec);
+          if(ec)
+            break;
+          pending.append(buf.data(), len);
+
+          std::size_t pos = 0;
+          std::uint32_t frame_len;
+          while(pending.size() - pos >= sizeof(frame_len))
+          {
+            memcpy(&frame_len, &pending[pos], sizeof(frame_len));
+            if(pending.size() - pos < frame_len)
+              break;
+            on_update(&pending[pos + sizeof(frame_len)]);
+            pos += frame_len;
+          }
+          pending.erase(0, pos);
+        }
+        m_is_closed = true;
+      }
+
+      void on_update(const char *a_update)
+      {
+        std::uint32_t key;
+        std::uint32_t seq;
+        memcpy(&key, a_update, sizeof(key));
+        memcpy(&seq, a_update + sizeof(key), sizeof(seq));
+
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_frames++;
+        if(key >= m_last.size() || seq <= m_last[key])
+        {
+          m_out_of_order++;
+          return;
+        }
+        m_last[key] = seq;
+      }
+
+    private:
+      boost::asio::ip::tcp::socket m_sock;
+      std::thread m_thread;
+      std::mutex m_mutex;
+      std::vector<std::uint32_t> m_last;
+      std::size_t m_frames = 0;
+      std::size_t m_out_of_order = 0;
+      std::atomic<bool> m_is_closed{false};
+  };
+
+  bool parse_option(const char *a_arg, const char *a_name, std::size_t& a_value)
+  {
+    std::size_t len = strlen(a_name);
+    if(strncmp(a_arg, a_name, len) != 0 || a_arg[len] != '=')
+      return false;
+    a_value = std::stoull(a_arg + len + 1);
+    return true;
+  }
+
+  template<typename Condition>
+  bool wait_for(Condition a_condition)
+  {
+    auto deadline = test_clock::now() + std::chrono::seconds(10);
+    while(!a_condition())
+    {
+      if(test_clock::now() > deadline)
+        return false;
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return true;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  test_options_t options;
+  for(int i = 1; i < argc; i++)
+  {
+    std::size_t port = options.port;
+    if(!parse_option(argv[i], "--count", options.count) &&
+       !parse_option(argv[i], "--keys", options.keys) &&
+       !parse_option(argv[i], "--rate", options.rate) &&
+       !parse_option(argv[i], "--port", port))
+    {
+      std::cerr << "unknown option " << argv[i] << std::endl;
+      return 1;
+    }
+    options.port = static_cast<std::uint16_t>(port);
+  }
+  if(options.keys == 0 || options.count < options.keys)
+  {
+    std::cerr << "--count must be at least --keys" << std::endl;
+    return 1;
+  }
+
+  boost::asio::io_service io_service;
+  boost::asio::io_service::work work(io_service);
+  std::thread io_thread([&io_service](){
+    io_service.run();
+  });
+
+  common::udp_multicast_relay_params_t relay_params;
+  relay_params.multicast.source_ip = "127.0.0.1";
+  relay_params.multicast.group_ip = "239.5.7.1";
+  relay_params.multicast.port = options.port;
+  relay_params.multicast.interface_name = "lo";
+  relay_params.multicast.socket_options.rcvbuf = 4 * 1024 * 1024;
+  relay_params.tcp.ip = "127.0.0.1";
+  relay_params.tcp.port = static_cast<std::uint16_t>(options.port + 1);
+  relay_params.key.offset = 0;
+  relay_params.key.width = 4;
+  relay_params.key.byte_order = common::byte_order_e::little_endian;
+  relay_params.max_queued_bytes = 64 * 1024;
+  auto relay = create_relay(relay_params, io_service);
+  relay->run();
+
+  boost::asio::io_service subscriber_io_service;
+  subscriber live(subscriber_io_service, options.keys);
+  subscriber behind(subscriber_io_service, options.keys);
+  live.connect(relay_params.tcp.port);
+  behind.connect(relay_params.tcp.port);
+  live.start();
+
+  common::udp_multicast_publisher_params_t publisher_params;
+  publisher_params.source_ip = "127.0.0.1";
+  publisher_params.group_ip = relay_params.multicast.group_ip;
+  publisher_params.port = relay_params.multicast.port;
+  publisher_params.interface_name = "lo";
+  publisher_params.loopback = true;
+  publisher_params.max_packets_per_sec = options.rate;
+  auto publisher = create_publisher(publisher_params, io_service);
+
+  bool is_ok = wait_for([&relay]{ return relay->stats().subscribers == 2; });
+  if(!is_ok)
+    printf("subscribers did not connect\n");
+
+  std::vector<std::uint32_t> latest(options.keys, 0);
+  std::vector<char> update(update_size, 0);
+  for(std::uint32_t seq = 1; seq <= options.count; seq++)
+  {
+    std::uint32_t key = seq % options.keys;
+    memcpy(update.data(), &key, sizeof(key));
+    memcpy(update.data() + sizeof(key), &seq, sizeof(seq));
+    publisher->send(update.data(), update.size());
+    latest[key] = seq;
+  }
+  publisher->flush();
+
+  wait_for([&relay, &options]{ return relay->stats().received >= options.count; });
+  behind.start();
+  bool is_live_ok = wait_for([&live, &latest]{ return live.has_latest(latest); });
+  bool is_behind_ok = wait_for([&behind, &latest]{ return behind.has_latest(latest); });
+  auto stats = relay->stats();
+
+  relay->stop();
+  bool is_stopped = wait_for([&live, &behind]{ return live.is_closed() && behind.is_closed(); });
+  boost::system::error_code ec;
+  boost::asio::ip::tcp::socket late(subscriber_io_service);
+  late.connect({boost::asio::ip::address::from_string("127.0.0.1"), relay_params.tcp.port}, ec);
+  bool is_refused = static_cast<bool>(ec);
+  live.join();
+  behind.join();
+
+  io_service.stop();
+  io_thread.join();
+
+  printf("relay: received %llu forwarded %llu conflated %llu flushed %llu malformed %llu conflating %llu\n",
+         (unsigned long long)stats.received, (unsigned long long)stats.forwarded, (unsigned long long)stats.conflated,
+         (unsigned long long)stats.flushed, (unsigned long long)stats.malformed, (unsigned long long)stats.conflating);
+  printf("live subscriber: %zu frames, %zu out of order, %s\n", live.frames(), live.out_of_order(), is_live_ok ? "latest of every key" : "STALE");
+  printf("behind subscriber: %zu frames, %zu out of order, %s\n", behind.frames(), behind.out_of_order(), is_behind_ok ? "latest of every key" : "STALE");
+  printf("stop: %s, %s\n", is_stopped ? "subscribers disconnected" : "SUBSCRIBERS STILL CONNECTED", is_refused ? "new connections refused" : "NEW CONNECTION ACCEPTED");
+
+  is_ok = is_ok && stats.received == options.count && is_live_ok && is_behind_ok &&
+          live.out_of_order() == 0 && behind.out_of_order() == 0 && is_stopped && is_refused;
+  printf("%s\n", is_ok ? "ok" : "FAILED");
+  return is_ok ? 0 : 1;
+}
@@ -0,0 +1,162 @@
+#include "../../../communications.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Reliable multicast over loopback: publishes sequenced datagrams, stores
+// every one in a retransmit server and deliberately skips sending every
+// Nth, then checks that a reliable_client delivers the whole feed in order,
+// the skipped ones recovered over tcp. With a history smaller than the
+// feed the oldest losses come back as unavailable and are reported as gaps.
+//
+//   communications_udp_multicast_reliable_test_app [--count=N] [--drop=N]
+//                                                  [--rate=PPS] [--history=BYTES]
+//                                                  [--port=N]
+
+namespace
+{
+  using namespace common::udp::multicast;
+
+  struct test_options_t
+  {
+    std::size_t count = 100000;
+    std::size_t drop = 100;
+    std::size_t rate = 50000;
+    std::size_t history = 64 * 1024 * 1024;
+    std::uint16_t port = 37100;
+  };
+
+  bool parse_option(const char *a_arg, const char *a_name, std::size_t& a_value)
+  {
+    std::size_t len = strlen(a_name);
+    if(strncmp(a_arg, a_name, len) != 0 || a_arg[len] != '=')
+      return false;
+    a_value = std::stoull(a_arg + len + 1);
+    return true;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  test_options_t options;
+  for(int i = 1; i < argc; i++)
+  {
+    std::size_t port = options.port;
+    if(!parse_option(argv[i], "--count", options.count) &&
+       !parse_option(argv[i], "--drop", options.drop) &&
+       !parse_option(argv[i], "--rate", options.rate) &&
+       !parse_option(argv[i], "--history", options.history) &&
+       !parse_option(argv[i], "--port", port))
+    {
+      std::cerr << "unknown option " << argv[i] << std::endl;
+      return 1;
+    }
+    options.port = static_cast<std::uint16_t>(port);
+  }
+
+  common::packet_field_t sequence;
+  sequence.offset = 0;
+  sequence.width = 8;
+  sequence.byte_order = common::byte_order_e::little_endian;
+
+  boost::asio::io_service io_service;
+  boost::asio::io_service::work work(io_service);
+  std::thread io_thread([&io_service](){
+    io_service.run();
+  });
+
+  common::udp_multicast_retransmit_params_t retransmit_params;
+  retransmit_params.tcp.ip = "127.0.0.1";
+  retransmit_params.tcp.port = options.port;
+  retransmit_params.sequence = sequence;
+  retransmit_params.history_size = options.history;
+  auto retransmit = create_retransmit_server(retransmit_params, io_service);
+  retransmit->run();
+
+  common::udp_multicast_reliable_params_t reliable_params;
+  reliable_params.multicast.source_ip = "127.0.0.1";
+  reliable_params.multicast.group_ip = "239.5.5.5";
+  reliable_params.multicast.port = options.port;
+  reliable_params.multicast.interface_name = "lo";
+  reliable_params.retransmit.ip = "127.0.0.1";
+  reliable_params.retransmit.port = options.port;
+  reliable_params.retransmit.use_strand = false;
+  reliable_params.sequence = sequence;
+  auto receiver = create_reliable_client(reliable_params, io_service);
+
+  std::atomic<std::uint64_t> expected{0};
+  std::atomic<std::uint64_t> out_of_order{0};
+  std::atomic<std::uint64_t> lost{0};
+  receiver->set_on_data([&expected, &out_of_order](std::uint64_t a_seq, const char * /*a_data*/, std::size_t /*a_len*/)
+  {
+    if(a_seq != expected.load())
+      out_of_order++;
+    expected = a_seq + 1;
+  });
+  receiver->set_on_gap([&expected, &lost](std::uint64_t a_first, std::uint64_t a_last)
+  {
+    lost += a_last - a_first + 1;
+    expected = a_last + 1;
+  });
+  receiver->run();
+
+  common::udp_multicast_publisher_params_t publisher_params;
+  publisher_params.source_ip = "127.0.0.1";
+  publisher_params.group_ip = "239.5.5.5";
+  publisher_params.port = options.port;
+  publisher_params.interface_name = "lo";
+  publisher_params.loopback = true;
+  publisher_params.max_packets_per_sec = options.rate;
+  auto publisher = create_publisher(publisher_params, io_service);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  std::vector<char> datagram(64, 0);
+  std::size_t skipped = 0;
+  for(std::uint64_t seq = 0; seq < options.count; seq++)
+  {
+    memcpy(datagram.data(), &seq, sizeof(seq));
+    retransmit->store(datagram.data(), datagram.size());
+    // never skip the last one: a gap is only seen once something follows it
+    if(options.drop != 0 && seq % options.drop == options.drop - 1 && seq + 1 != options.count)
+    {
+      skipped++;
+      continue;
+    }
+    publisher->send(datagram.data(), datagram.size());
+  }
+  publisher->flush();
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while(std::chrono::steady_clock::now() < deadline)
+  {
+    auto stats = receiver->stats();
+    if(stats.delivered + stats.lost >= options.count)
+      break;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+
+  receiver->stop();
+  io_service.stop();
+  io_thread.join();
+
+  auto stats = receiver->stats();
+  auto server_stats = retransmit->stats();
+  printf("published %zu, skipped %zu\n", options.count - skipped, skipped);
+  printf("receiver: received %llu delivered %llu gaps %llu naks %llu recovered %llu lost %llu duplicates %llu out of order %llu\n",
+         (unsigned long long)stats.received, (unsigned long long)stats.delivered, (unsigned long long)stats.gaps,
+         (unsigned long long)stats.naks, (unsigned long long)stats.recovered, (unsigned long long)stats.lost,
+         (unsigned long long)stats.duplicates, (unsigned long long)out_of_order.load());
+  printf("server: stored %llu naks %llu retransmitted %llu unavailable %llu\n",
+         (unsigned long long)server_stats.stored, (unsigned long long)server_stats.naks,
+         (unsigned long long)server_stats.retransmitted, (unsigned long long)server_stats.unavailable);
+
+  bool is_complete = stats.delivered + stats.lost == options.count && out_of_order == 0;
+  printf("%s\n", is_complete ? "complete and in order" : "INCOMPLETE");
+  return is_complete ? 0 : 1;
+}